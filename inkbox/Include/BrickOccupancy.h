@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+
+#include <glad/glad.h>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "Shader.h"
+#include "Texture.h"
+
+#define BRICK_SIDE 8
+#define BRICK_LIST_BINDING 3 // Has to match bricks.glsl
+
+// Which 8x8x8 bricks of the 3D volume have anything going on. Each update flags the bricks that
+// hold ink or velocity above a threshold, dilates that by one brick so the fluid can move into
+// the neighbours, and compacts the result into a list on the GPU together with the indirect
+// dispatch arguments for it. Passes compiled with SPARSE_BRICKS (see bricks.glsl) then only run
+// over the listed bricks. Storage stays dense, the fields in a brick that isn't listed are
+// expected to be zero and bricks that drop off the list are handed out to be cleared.
+class BrickOccupancy
+{
+public:
+	BrickOccupancy();
+	~BrickOccupancy();
+
+	// size has to be a multiple of BRICK_SIDE and BRICK_SIDE a multiple of local_size. Stays
+	// inactive when there are more bricks than GL_MAX_COMPUTE_WORK_GROUP_COUNT allows.
+	bool Init(glm::uvec3 size, glm::uvec3 local_size, const std::string& img_format);
+	bool IsActive() const { return numBricks > 0; }
+
+	// Only the listed bricks are looked at, the rest are known to be empty. Cells within
+	// seed.w of seed.xyz count as active whatever they hold, that's where an impulse is about
+	// to land. A negative seed.w means no impulse.
+	void Update(Texture& velocity, Texture& ink, float threshold, glm::vec4 seed);
+
+	// Starts over with every brick listed, for when the fields changed behind the list's back
+	void Reset();
+
+	// The listed bricks along x and their cell blocks of the shader's local size along y
+	void Dispatch(GLComputeShader& shader);
+	// One work group per listed brick, the shader's local size is the brick
+	void DispatchBricks(GLComputeShader& shader);
+	// Same as Dispatch over the bricks that dropped off the list in the last update
+	void DispatchRetired(GLComputeShader& shader);
+
+	float ActiveFraction() const { return activeFraction; } // A few frames old, -1 until known
+
+private:
+	void Bind(GLComputeShader& shader, int list_offset);
+	void PollCount();
+
+	glm::uvec3 grid;
+	int numBricks;
+	int groupsPerBrick;
+	glm::uvec3 compactWorkGroups;
+
+	GLComputeShader activityShader;
+	GLComputeShader compactShader;
+
+	unsigned int occupiedBuffer;
+	unsigned int activeBuffer;
+	unsigned int listBuffer;     // Active bricks first, retired ones from numBricks on
+	unsigned int dispatchBuffer; // Indirect arguments for cells, bricks and retired cells
+	unsigned int readbackBuffer;
+	GLsync readbackFence;
+	float activeFraction;
+};
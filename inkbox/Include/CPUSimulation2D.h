@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+#include "FFTPoisson.h"
+#include "SimulationBackend.h"
+#include "ThreadPool.h"
+
+// Double-buffered grid stored as one contiguous plane per channel
+class CPUField2D
+{
+public:
+	CPUField2D(int width, int height, int channels);
+
+	float* Front(int channel) { return &buffers[front][channel * size]; }
+	float* Back(int channel) { return &buffers[front ^ 1][channel * size]; }
+	void Swap() { front ^= 1; }
+	void Clear();
+
+	int Channels() const { return channels; }
+
+private:
+	int size;
+	int channels;
+	int front;
+	std::vector<float> buffers[2];
+};
+
+// CPU version of InkBox2DSimulation::ComputeFields. Runs the same pass sequence with the same
+// interior stencils as the 2D shaders, split into row bands across a thread pool. The pressure
+// solve is Jacobi, or the FFT solver when it's picked and the boundaries are off.
+class CPUSimulation2D : public ISimulationBackend
+{
+public:
+	CPUSimulation2D(int width, int height, SimulationVars* vars, ImpulseState* impulse, int num_threads = 0);
+
+	virtual const char* BackendName() const override { return "cpu"; }
+	virtual void ComputeFields(float delta_t, float frame_fraction = 1.f) override;
+	virtual void ClearFields() override;
+	virtual void Finish() override {}
+	virtual SolverStats& Stats() override { return stats; }
+	virtual ResidualNorms MeasurePressureResidual() override;
+
+	// Interleaves a field into width*height RGB floats, e.g. for uploading to a texture
+	void ReadField(SimulationField field, float* rgb);
+
+	int Width() const { return width; }
+	int Height() const { return height; }
+	int NumThreads() const { return pool.NumThreads(); }
+
+private:
+	void ComputeBoundaryValues(CPUField2D& field, float scale);
+	void Advect(CPUField2D& quantity, float dissipation, float delta_t);
+	void AddImpulse(CPUField2D& field, glm::vec2 position, glm::vec3 force, float radius, bool radial);
+	void ComputeVorticity();
+	void AddVorticity();
+	int SolvePoissonSystem(CPUField2D& x, CPUField2D& b, float alpha, float beta, ResidualNorms& norms);
+	void RelaxPoissonSystem(CPUField2D& x, CPUField2D& b, float alpha, float beta, int iterations);
+	int SolvePoissonFFT(CPUField2D& x, CPUField2D& b, float alpha, float beta, ResidualNorms& norms);
+	ResidualNorms MeasureResidual(CPUField2D& x, CPUField2D& b, float alpha, float beta);
+	void ComputeDivergence();
+	void SubtractPressureGradient();
+	float MeasureMaxSpeed();
+	float Sample(const float* plane, float x, float y) const;
+
+	int width;
+	int height;
+	SimulationVars* vars;
+	ImpulseState* impulse;
+	SolverStats stats;
+	ThreadPool pool;
+
+	CPUField2D velocity;
+	CPUField2D ink;
+	CPUField2D pressure;
+	CPUField2D vorticity;
+	CPUField2D divergence;
+	CPUField2D temp;
+
+	std::unique_ptr<FFTPoissonSolver> fftSolver; // Created on first use
+};
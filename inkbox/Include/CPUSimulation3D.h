@@ -0,0 +1,116 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "FFTPoisson.h"
+#include "SimulationBackend.h"
+#include "ThreadPool.h"
+
+#define BRICK_SIDE 8
+#define BRICK_CELLS (BRICK_SIDE * BRICK_SIDE * BRICK_SIDE)
+#define HALO_SIDE (BRICK_SIDE + 2)
+#define HALO_CELLS (HALO_SIDE * HALO_SIDE * HALO_SIDE)
+
+// Maps voxel coordinates to storage. The volume is cut into 8x8x8 bricks which are laid out one
+// after another in Morton order, cells inside a brick are x-fastest. A brick is 2KB per channel
+// so a stencil's working set stays in L1/L2 and neighbouring bricks are usually close in memory.
+class BrickLayout
+{
+public:
+	BrickLayout(int width, int height, int depth);
+
+	int NumBricks() const { return int(slotCoords.size()); }
+	int NumCells() const { return NumBricks() * BRICK_CELLS; }
+	glm::ivec3 Size() const { return size; }
+
+	// First voxel of the brick stored in a slot
+	glm::ivec3 BrickOrigin(int slot) const { return slotCoords[slot] * BRICK_SIDE; }
+	int Index(int x, int y, int z) const;
+
+	// Copies a brick plus a one cell border into a HALO_SIDE^3 block. Cells below 0 take the edge
+	// value and cells past the far side read as 0, same as clamp_coord + imageLoad in the 3D shaders.
+	void GatherHalo(const float* plane, int slot, float* halo) const;
+
+	// Copy one brick between storage and a width*height*depth x-fastest array
+	void ToLinear(const float* plane, int slot, float* linear) const;
+	void FromLinear(const float* linear, int slot, float* plane) const;
+
+private:
+	glm::ivec3 size;
+	glm::ivec3 bricks;
+	std::vector<int> brickSlots; // Linear brick coordinate -> slot
+	std::vector<glm::ivec3> slotCoords;
+};
+
+// Double-buffered brick-tiled volume, one plane per channel
+class CPUField3D
+{
+public:
+	CPUField3D(const BrickLayout& layout, int channels);
+
+	float* Front(int channel) { return &buffers[front][channel * size]; }
+	float* Back(int channel) { return &buffers[front ^ 1][channel * size]; }
+	void Swap() { front ^= 1; }
+	void Clear();
+
+	int Channels() const { return channels; }
+
+private:
+	int size;
+	int channels;
+	int front;
+	std::vector<float> buffers[2];
+};
+
+// CPU version of InkBox3DSimulation::ComputeFields for machines without a usable GPU. Every pass
+// works a brick at a time with the bricks handed out through a work-stealing pool, the 7-point
+// stencils run over the brick's x rows with SIMD. Dimensions have to be multiples of BRICK_SIDE.
+class CPUSimulation3D : public ISimulationBackend
+{
+public:
+	CPUSimulation3D(int width, int height, int depth, SimulationVars* vars, ImpulseState* impulse, int num_threads = 0);
+
+	virtual const char* BackendName() const override { return "cpu"; }
+	virtual void ComputeFields(float delta_t, float frame_fraction = 1.f) override;
+	virtual void ClearFields() override;
+	virtual void Finish() override {}
+	virtual SolverStats& Stats() override { return stats; }
+	virtual ResidualNorms MeasurePressureResidual() override;
+
+	// Writes a field out as width*height*depth linear RGBA floats, e.g. for uploading to a texture
+	void ReadField(SimulationField field, float* rgba);
+
+	glm::ivec3 Size() const { return layout.Size(); }
+	int NumThreads() const { return pool.NumThreads(); }
+
+private:
+	void Advect(CPUField3D& quantity, float dissipation, float gravity, float delta_t);
+	void AddImpulse(CPUField3D& field, glm::vec3 position, glm::vec4 force, float radius);
+	int SolvePoissonSystem(CPUField3D& x, CPUField3D& b, float alpha, float beta, ResidualNorms& norms);
+	void RelaxPoissonSystem(CPUField3D& x, CPUField3D& b, float alpha, float beta, int iterations);
+	int SolvePoissonFFT(CPUField3D& x, CPUField3D& b, float alpha, float beta, ResidualNorms& norms);
+	ResidualNorms MeasureResidual(CPUField3D& x, CPUField3D& b, float alpha, float beta);
+	void ComputeDivergence();
+	void SubtractPressureGradient();
+	void ComputeBoundaryValues(CPUField3D& field, float scale);
+	float MeasureMaxSpeed();
+
+	BrickLayout layout;
+	SimulationVars* vars;
+	ImpulseState* impulse;
+	SolverStats stats;
+	ThreadPool pool;
+
+	CPUField3D velocity;
+	CPUField3D ink;
+	CPUField3D pressure;
+	CPUField3D divergence;
+	CPUField3D temp;
+
+	std::unique_ptr<FFTPoissonSolver> fftSolver; // Created on first use
+	std::vector<float> fftBuffer;
+};
@@ -5,9 +5,38 @@
 
 #include <glm/vec3.hpp>
 
-#define LOG_INFO(FMT,...) printf("[INFO] " FMT "\n",__VA_ARGS__)
-#define LOG_WARN(FMT,...) printf("[WARN] " FMT "\n",__VA_ARGS__)
-#define LOG_ERROR(FMT,...) printf("[ERRO] " FMT "\n",__VA_ARGS__)
+// Only MSVC's headers are written to survive the min/max macros below, elsewhere everything that
+// uses the names has to come in first
+#ifndef _MSC_VER
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <glm/geometric.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/rotate_vector.hpp>
+#endif
+
+#define LOG_INFO(FMT,...) printf("[INFO] " FMT "\n", ##__VA_ARGS__)
+#define LOG_WARN(FMT,...) printf("[WARN] " FMT "\n", ##__VA_ARGS__)
+#define LOG_ERROR(FMT,...) printf("[ERRO] " FMT "\n", ##__VA_ARGS__)
 
 #define _GL_CHECK_FOR_ERRORS() __CheckForGLErrors(__FILE__, __LINE__,__FUNCTION__)
 
@@ -31,6 +60,7 @@
 #define _GL_WRAP8(GLFUNC,a,b,c,d,e,f,g,h) GLFUNC((a),(b),(c),(d),(e),(f),(g),(h)); __CheckForGLErrors(__FILE__, __LINE__,#GLFUNC)
 #define _GL_WRAP9(GLFUNC,a,b,c,d,e,f,g,h,i) GLFUNC((a),(b),(c),(d),(e),(f),(g),(h),(i)); __CheckForGLErrors(__FILE__, __LINE__,#GLFUNC)
 #define _GL_WRAP10(GLFUNC,a,b,c,d,e,f,g,h,i,j) GLFUNC((a),(b),(c),(d),(e),(f),(g),(h),(i),(j)); __CheckForGLErrors(__FILE__, __LINE__,#GLFUNC)
+#define _GL_WRAP11(GLFUNC,a,b,c,d,e,f,g,h,i,j,k) GLFUNC((a),(b),(c),(d),(e),(f),(g),(h),(i),(j),(k)); __CheckForGLErrors(__FILE__, __LINE__,#GLFUNC)
 #else
 #define _GL_WRAP0(GLFUNC) GLFUNC();
 #define _GL_WRAP1(GLFUNC,a) GLFUNC((a));
@@ -43,6 +73,7 @@
 #define _GL_WRAP8(GLFUNC,a,b,c,d,e,f,g,h) GLFUNC((a),(b),(c),(d),(e),(f),(g),(h));
 #define _GL_WRAP9(GLFUNC,a,b,c,d,e,f,g,h,i) GLFUNC((a),(b),(c),(d),(e),(f),(g),(h),(i));
 #define _GL_WRAP10(GLFUNC,a,b,c,d,e,f,g,h,i,j) GLFUNC((a),(b),(c),(d),(e),(f),(g),(h),(i),(j));
+#define _GL_WRAP11(GLFUNC,a,b,c,d,e,f,g,h,i,j,k) GLFUNC((a),(b),(c),(d),(e),(f),(g),(h),(i),(j),(k));
 #endif
 
 void __CheckForGLErrors(const char* file, int line, const char* function);
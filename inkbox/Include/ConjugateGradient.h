@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <glm/vec3.hpp>
+
+#include "Shader.h"
+#include "Texture.h"
+#include "ResidualMonitor.h"
+
+// Preconditioned conjugate gradient for the 3D pressure system, the same one jacobi.comp relaxes.
+// Everything stays on the GPU: dot products are summed per work group and then by a single work
+// group into a small buffer of scalars that the following kernels read, so the only readback is
+// the ResidualMonitor's. The solver's vectors are r32f whatever the field textures use.
+class ConjugateGradientSolver
+{
+public:
+    ConjugateGradientSolver();
+    ~ConjugateGradientSolver();
+
+    // field_format is the image format of the pressure and divergence textures
+    bool Init(glm::uvec3 size, glm::uvec3 local_size, const std::string& field_format, bool incomplete_poisson);
+
+    // Starts from x's current contents and writes the solution back into it
+    int Solve(Texture& x, Texture& b, float alpha, float beta, ResidualMonitor& monitor, int max_iterations, float tolerance, int step);
+
+private:
+    struct WorkTextures
+    {
+        WorkTextures(glm::uvec3 size);
+
+        Texture X;
+        Texture R;
+        Texture Z;
+        Texture P;
+        Texture AP; // Also holds the first incomplete Poisson pass
+    };
+
+    void BindBuffers();
+    void Execute(GLComputeShader& shader);
+    void Precondition(float beta);
+    void Reduce(int stage);
+
+    glm::uvec3 size;
+    glm::uvec3 workGroups;
+    int numGroups;
+    bool incompletePoisson;
+
+    GLComputeShader initShader;
+    GLComputeShader applyShader;
+    GLComputeShader updateShader;
+    GLComputeShader upperShader;
+    GLComputeShader lowerShader;
+    GLComputeShader directionShader;
+    GLComputeShader reduceShader;
+    GLComputeShader finishShader;
+
+    unsigned int partialsBuffer;
+    unsigned int scalarsBuffer;
+    std::unique_ptr<WorkTextures> work; // Allocated by the first solve
+};
@@ -32,7 +32,10 @@ public:
 	bool Init();
 	virtual void Clear(float r = 0.f, float g = 0.f, float b = 0.f, float a = 0.0f) override;
 	virtual void Bind() override;
+	void BindWith(FBO& second); // Two colour targets for passes with a second output, until the next Bind
 	virtual void BindTexture(int unit_id) override { texture.Bind(unit_id); }
+	void Upload(const float* rgb) { texture.Upload(rgb, GL_RGB); }
+	void Download(float* rgb) { texture.Download(rgb, GL_RGB); }
 
 	virtual int Id() override { return fboId; }
 	virtual int TextureId() override { return texture.Id(); }
@@ -43,6 +46,7 @@ public:
 
 private:
 	bool initialized;
+	bool secondTarget;
 	int width;
 	int height;
 	int depth;
@@ -54,9 +58,9 @@ private:
 class SwapFBO : public IFBO
 {
 public:
-	SwapFBO(int width, int height, int depth)
-		: w0(width, height, depth)
-		, w1(width, height, depth)
+	SwapFBO(int width, int height, int depth, int channels = 3)
+		: w0(width, height, depth, channels)
+		, w1(width, height, depth, channels)
 		, ptr0(&w0)
 		, ptr1(&w1)
 	{}
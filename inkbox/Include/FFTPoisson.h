@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+#include "ThreadPool.h"
+
+// Direct solve of beta * x - sum(neighbours) = alpha * b, the system the Jacobi passes relax, on
+// a periodic grid. FFTs along every axis diagonalise the stencil so the whole solve is a forward
+// transform, one divide per frequency and an inverse transform. Radix-2 only, so every dimension
+// has to be a power of two. 2D grids have size.z == 1. Arrays are linear and x-fastest.
+class FFTPoissonSolver
+{
+public:
+	FFTPoissonSolver(glm::ivec3 size);
+
+	static bool Supports(glm::ivec3 size);
+
+	glm::ivec3 Size() const { return size; }
+
+	// b and x may be the same array. The constant mode has no solution when beta equals the
+	// number of neighbours, it comes out as 0.
+	void Solve(const float* b, float* x, float alpha, float beta, ThreadPool& pool);
+
+private:
+	void Transform(bool inverse, ThreadPool& pool);
+
+	glm::ivec3 size;
+	std::vector<float> re;
+	std::vector<float> im;
+	std::vector<float> cosTable[3]; // cos/sin(2 pi k / n) for k < n / 2, per axis
+	std::vector<float> sinTable[3];
+	std::vector<float> eigen[3];    // Neighbour sum's eigenvalue 2 cos(2 pi k / n), per axis
+};
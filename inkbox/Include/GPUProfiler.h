@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define GPU_PROFILER_MAX_FRAMES 16
+#define GPU_PROFILER_SAMPLES 1024   // Per-dispatch samples kept for each pass
+#define GPU_PROFILER_HISTORY 120    // Frames kept for the per-frame averages
+
+struct PassTimings
+{
+	std::string Label;
+	float CallsPerFrame;
+	float Min;          // Per dispatch, all in milliseconds
+	float Avg;
+	float P99;
+	float FrameTotal;   // Average time spent in the pass per frame
+};
+
+// Times labelled GPU passes with timestamp queries. Each frame's queries go into one slot of a
+// ring that's several frames deep and are only read once the GPU says they're available, so
+// profiling never stalls the pipeline like a blocking glGetQueryObject would. Passes don't nest.
+// Does nothing until Init is called with a context current. Everything but the readouts
+// (Timings, Report and the frame counts) has to be called on the thread with that context.
+class GPUProfiler
+{
+public:
+	static GPUProfiler& Get();
+
+	GPUProfiler();
+
+	void Init(int frames_in_flight);
+	bool IsActive() const { return numSlots > 0; }
+
+	void NewFrame();
+	void Begin(const std::string& label);
+	void End();
+
+	// Reads back every finished frame. Waiting is only meant for the end of a run.
+	void Collect(bool wait);
+
+	// Forgets the samples gathered so far, e.g. after warming up
+	void Reset();
+
+	std::vector<PassTimings> Timings() const;
+	std::string Report() const;
+	void LogReport() const;
+
+	int FramesMeasured() const { return framesMeasured; }
+	int FramesDropped() const { return framesDropped; }
+
+	class Scope
+	{
+	public:
+		Scope(const std::string& label) { GPUProfiler::Get().Begin(label); }
+		~Scope() { GPUProfiler::Get().End(); }
+	};
+
+private:
+	struct Pass
+	{
+		int Label;
+		int FirstQuery;
+	};
+
+	struct FrameSlot
+	{
+		std::vector<unsigned int> Queries;
+		std::vector<Pass> Passes;
+		int Used;
+		bool Pending;
+		bool Traced;
+		double ClockOffset; // TraceRecorder time minus GPU time, in microseconds
+	};
+
+	struct PassHistory
+	{
+		PassHistory(const std::string& label);
+
+		std::string Label;
+		std::vector<float> Samples;     // Ring of per-dispatch times
+		std::vector<float> FrameTimes;  // Ring of per-frame totals
+		std::vector<int> FrameCalls;
+		int NextSample;
+		int NextFrame;
+	};
+
+	bool TryRead(FrameSlot& slot, bool wait);
+
+	FrameSlot slots[GPU_PROFILER_MAX_FRAMES];
+	int numSlots;
+	int current;
+	bool passOpen;
+	std::map<std::string, int> labelIds;
+	mutable std::mutex historyLock; // The control panel reads the history from another thread
+	std::vector<PassHistory> history;
+	std::vector<unsigned long long> timestamps;
+	std::atomic<int> framesMeasured;
+	std::atomic<int> framesDropped;
+};
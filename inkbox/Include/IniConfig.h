@@ -2,6 +2,7 @@
 #pragma once
 
 #include <fstream>
+#include <string>
 
 
 struct IniConfig
@@ -11,12 +12,44 @@ struct IniConfig
 	void Load(std::istream& stream);
 	void Print();
 
-	int NumJacobiIterations;
+	int NumJacobiIterations; // Red-black runs half of this and of MaxJacobiIterations, each of its iterations is two passes
+	std::string PressureSolver;
+	int MultigridLevels;
+	int MultigridSmoothingIterations;
+	int MultigridCycles;
+	float SOROmega;
+	std::string PCGPreconditioner;
+	float ResidualTolerance;
+	int ResidualCheckInterval; // CPU only, iterations between residual checks
+	int ResidualPlanStep; // GPU only, how far each solve's iteration count moves from the last, and the fewest it runs
+	int MaxJacobiIterations;
+	std::string JacobiKernel;
+	int JacobiSweepsPerDispatch; // JacobiKernel=tiled (3D) only, 1 to 8
+	bool PressureWarmStart;
+	bool FuseDivergenceJacobi;
+	bool SparseBricks;
+	float BrickActivityThreshold;
+	std::string AdvectionScheme;
+	bool AdvectionRK2;
+	bool AdaptiveTimestep;
+	float CFLNumber;
+	int MaxSubsteps;
+	float SubstepBudgetMs;
+	float SimulationTickRate;
+	float ControlPanelFPS;
+	float RenderScale;
+	std::string SimulationBackend;
+	int CPUThreads;
 	float ScrollSensitivity;
 	float MouseOrbitSensitivity;
 	float KeyOrbitSensitivity;
 	float RainbowModeHueMultiplier;
 	float DropletsModeDelay;
+	int RandomSeed;
+	int GPUProfilerFrames;
+	std::string TraceFile;
+	int TraceFrames;
+	std::string ShaderCacheDir; // Empty to compile every shader on every run
 
 	int TextureComponentWidth;
 	bool UseSnormTextures;
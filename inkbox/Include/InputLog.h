@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include <glm/vec3.hpp>
+
+#include "Interface.h"
+#include "StepScheduler.h"
+
+#define INPUT_LOG_MAGIC 0x4C584249 // "IBXL"
+#define INPUT_LOG_VERSION 2
+
+enum class InputLogMode
+{
+	Record,
+	Replay
+};
+
+// Binary log of the impulse stream, one entry per simulated frame. Recording stores the substeps
+// and the impulse each frame ended up with, replaying overwrites them with the logged ones, so a
+// replay does the same work as the original run regardless of mouse input, frame timing, the
+// speed readback or the droplets RNG.
+//
+// Layout (little endian): uint32 magic, uint32 version, int32 width/height/depth, then per frame
+// a flags byte, the float frame time, int32 substeps and the float substep time, followed by
+// position+delta when force or ink is active and the ink colour when ink is active. Version 1
+// logs have no substeps and replay as a single step of the frame time.
+class InputLog
+{
+public:
+	InputLog(InputLogMode mode, const std::string& path, glm::ivec3 size);
+
+	// Records this frame, or replaces its steps and the impulse with the next logged frame.
+	// Returns false once a replay has run out of frames, leaving the steps alone.
+	bool Step(FrameSteps& steps, ImpulseState& impulse);
+
+	InputLogMode Mode() const { return mode; }
+	int Frames() const { return frames; }
+
+private:
+	enum Flags : uint8_t
+	{
+		Force = 0x1,
+		Ink = 0x2,
+		Radial = 0x4
+	};
+
+	void Record(const FrameSteps& steps, const ImpulseState& impulse);
+	bool Replay(FrameSteps& steps, ImpulseState& impulse);
+
+	template<typename T>
+	void Write(const T& value) { out.write(reinterpret_cast<const char*>(&value), sizeof(T)); }
+
+	template<typename T>
+	bool Read(T& value) { return bool(in.read(reinterpret_cast<char*>(&value), sizeof(T))); }
+
+	InputLogMode mode;
+	std::string path;
+	std::ofstream out;
+	std::ifstream in;
+	uint32_t version;
+	int frames;
+	bool finished;
+};
@@ -1,7 +1,8 @@
 
 #pragma once
 
-#include <chrono>
+#include <random>
+#include <string>
 
 #include <glm/vec2.hpp>
 
@@ -11,9 +12,10 @@
 #define TEXTBUFF_LEN (TEXTBOX_LEN * sizeof(char))
 #define MAIN_WINDOW_TITLE " i n k b o x "
 #define CONTROLS_WINDLW_TITLE " c o n t r o l s "
-#define FRAME_DELAY_ADJUSTMENT_MOD 4
+#define HEADLESS_TIMESTEP (1.0f / 60)
 
 struct GLFWwindow;
+struct SolverStats;
 
 struct InkBoxWindows
 {
@@ -21,11 +23,19 @@ struct InkBoxWindows
 	~InkBoxWindows();
 
 	bool InitGLContexts(int width, int height, bool main_resizeable, int ctrl_width, int ctrl_height);
+	bool InitHeadlessContext(int width, int height);
 
 	GLFWwindow* Main;
 	GLFWwindow* Controls;
+	GLFWwindow* Worker; // Hidden, shares objects with Main and runs the simulation thread
 
 	glm::vec2 ViewportSize;
+	bool Headless;
+
+private:
+	// Surfaceless EGL display/context, only set when headless on Linux
+	void* eglDisplay;
+	void* eglContext;
 };
 
 enum class SimulationField
@@ -36,6 +46,26 @@ enum class SimulationField
 	Vorticity
 };
 
+enum class PressureSolverType
+{
+	Jacobi,
+	Multigrid,
+	RedBlack,   // Gauss-Seidel with over-relaxation
+	ConjugateGradient,
+	FFT         // Direct periodic solve, CPU backends with the boundaries off
+};
+
+PressureSolverType ParsePressureSolverType(const std::string& name);
+
+enum class AdvectionType
+{
+	Nearest,    // 3D only, at most one cell per step
+	Trilinear,  // Plain semi-Lagrangian, bilinear in 2D
+	MacCormack
+};
+
+AdvectionType ParseAdvectionType(const std::string& name);
+
 struct ImpulseState
 {
 	ImpulseState();
@@ -44,6 +74,17 @@ struct ImpulseState
 	void Reset();
 	bool IsActive() const { return InkActive || ForceActive; }
 	glm::vec4 TickRainbowMode(float delta_t);
+	void TickDropletsMode(float delta_t, int width, int height);
+	void TickDropletsMode(glm::ivec3 size, float force_multiplier, bool drop_now); // 3D, counts frames
+
+	// Picks this frame's ink colour. Called once per frame before the fields are computed so the
+	// backends all splat the same colour and an InputLog can record or override it.
+	void PrepareFrame(const struct SimulationVars& vars, float delta_t);
+
+	// The droplets use their own generator so runs are repeatable for a given seed. It starts
+	// from RandomSeed, reseeding also restarts the droplet timing.
+	void Seed(unsigned int seed);
+	int Random(int range) { return int(Rng() % unsigned(range)); }
 
 	glm::vec3 LastPos;
 	glm::vec3 CurrentPos;
@@ -51,13 +92,18 @@ struct ImpulseState
 	bool InkActive;
 	bool Radial;
 	glm::vec3 Delta;
+	glm::vec4 Colour;
 
 	float RainbowModeHue;
+	float DropletsAcc;
+	float NextDroplet;
+	std::mt19937 Rng;
 };
 
 struct SimulationVars
 {
 	SimulationVars();
+	void Set3DDefaults(int width);
 
 	bool SelfAdvect;
 	bool AdvectInk;
@@ -80,6 +126,8 @@ struct SimulationVars
 	float ForceMultiplier;
 	glm::vec4 InkColour;
 	SimulationField DisplayField;
+	PressureSolverType PressureSolver;
+	float SOROmega;
 };
 
 struct VarTextBoxes
@@ -98,6 +146,7 @@ struct VarTextBoxes
 	char Gravity[TEXTBOX_LEN];
 	char InkVolume[TEXTBOX_LEN];
 	char ForceMultiplier[TEXTBOX_LEN];
+	char SOROmega[TEXTBOX_LEN];
 };
 
 class ControlPanel
@@ -108,29 +157,21 @@ public:
 	ControlPanel(GLFWwindow* win, SimulationVars* vars, VarTextBoxes* texts, ImpulseState* impulse);
 	void Render(bool& update_vars, bool& clear_buffers);
 	GLFWwindow* WindowPtr() const { return window; }
+	void SetSolverStats(SolverStats* stats) { solverStats = stats; }
+	void SetThumbnails(FBO* ufbo, FBO* pfbo, FBO* ifbo, FBO* vfbo); // Drawn by the next Render
+	bool ThumbnailsVisible() const { return thumbnailsVisible; } // As of the last Render
 
 private:
 	GLFWwindow* window;
 	SimulationVars* simvars;
 	VarTextBoxes* texts;
 	ImpulseState* impulse;
+	SolverStats* solverStats;
 	bool is3D;
 	FBO* velocity;
 	FBO* vorticity;
 	FBO* pressure;
 	FBO* ink;
+	bool thumbnailsVisible;
 };
 
-class FPSLimiter
-{
-public:
-	FPSLimiter(int fps);
-	void Regulate();
-	float AverageFPS() const { return 1000 / avgFrameTime; }
-private:
-	float simFrameTime;
-	float avgFrameTime;
-	int fpsDelay;
-	int adjustmentCtr;
-	std::chrono::steady_clock::time_point lastTime;
-};
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class GLShader;
+
+// Linked programs saved to disk with glGetProgramBinary, so later runs can skip compiling and
+// linking. A program's entry is keyed by its shaders' processed source (defines, includes, local
+// size and image format are all baked in) and the driver. Programs the driver won't take back
+// are compiled as usual and saved over, and a new driver empties the directory.
+class ProgramCache
+{
+public:
+	static ProgramCache& Get();
+
+	// Needs a current context the first time, false if ShaderCacheDir is empty or the driver
+	// has no binary formats
+	bool IsEnabled();
+
+	std::string Key(const std::vector<GLShader*>& shaders);
+	bool Load(unsigned int program, const std::string& key);
+	void Store(unsigned int program, const std::string& key);
+
+private:
+	ProgramCache();
+	void Init();
+	std::filesystem::path EntryPath(const std::string& key) const;
+
+	std::mutex lock;
+	bool initialized;
+	bool enabled;
+	std::string driver;
+	std::filesystem::path dir;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "Shader.h"
+
+#define RESIDUAL_READBACK_DEPTH 4
+
+struct ResidualNorms
+{
+    ResidualNorms() : L2(-1), Max(-1) {}
+    bool IsValid() const { return L2 >= 0; }
+
+    float L2;   // Root mean square of the residual
+    float Max;  // Largest absolute residual component
+};
+
+struct SolverStats
+{
+    SolverStats();
+
+    ResidualNorms Pressure;
+    ResidualNorms Diffusion;
+    int PressureIterations;
+    int DiffusionIterations;
+    float MaxSpeed; // Fastest back-trace in cells per unit of delta_t, -1 until measured
+    int Substeps;   // Simulation steps in the last displayed frame
+    float TickRate; // Sim thread ticks per second, -1 when the simulation isn't on its own thread
+    float ActiveBricks; // Share of the 3D volume's bricks being simulated, -1 when it's all of them
+};
+
+// Reduces per-workgroup residual partials (written by a residual shader into PartialsBuffer)
+// down to a pair of norms on the GPU and reads them back asynchronously through fences
+class ResidualMonitor
+{
+public:
+    ResidualMonitor();
+    ~ResidualMonitor();
+    bool Init();
+
+    // Iterations for the next solve to a tolerance, which then measures its residual once at the
+    // end. A solve that met the tolerance lets the next one try `step` fewer, one that didn't gets
+    // `step` more. The readbacks never stall so this follows the solves from a frame or two ago.
+    int Plan(float tolerance, int step, int max_iterations);
+
+    void BindPartials(int binding, int num_partials);
+    void Reduce(int num_partials, int num_cells);
+    bool Poll();
+
+    // Blocks until every readback in flight is back, only for the end of a run
+    ResidualNorms Wait();
+
+    ResidualNorms Latest() const { return latest; }
+
+private:
+    struct Readback
+    {
+        unsigned int Buffer;
+        GLsync Fence;
+        int Iterations; // What the solve was planned to run
+    };
+
+    GLComputeShader reduceShader;
+    unsigned int partialsBuffer;
+    int maxPartials;
+    Readback ring[RESIDUAL_READBACK_DEPTH];
+    int head;
+    int count;
+    int planned; // 0 until the first Plan
+    ResidualNorms latest;
+    int latestIterations;
+};
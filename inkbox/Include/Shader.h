@@ -2,14 +2,13 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 
-#define MEASURE_CS_TIMES 0
-
 class FBO;
 
 enum class ShaderType
@@ -22,22 +21,32 @@ enum class ShaderType
 
 class GLShader
 {
+    friend class GLShaderProgram;
+
 public:
-    GLShader(const char* path, ShaderType type, glm::uvec3 compute_local_size = glm::uvec3(), std::string overrideImageFormat = std::string());
+    GLShader(const char* path, ShaderType type, glm::uvec3 compute_local_size = glm::uvec3(), std::string overrideImageFormat = std::string(), std::vector<std::string> defines = std::vector<std::string>());
+    // With the ProgramCache on this only defers, the source is compiled by the first link
+    // that misses the cache and its errors come out of Link
     bool Compile();
     void Discard();
     int Id() const { return id; }
     std::string FileName() const { return fileName; }
     glm::vec3 ComputeLocalSize() const { return computeShaderLocalSize; }
+    ShaderType Type() const { return type; }
+    const std::string& SourceCode() const { return sourceCode; }
+    const std::string& OverrideImageFormat() const { return overrideImgFmt; }
 
 private:
 
+    bool CompileSource();
+
     std::string ProcessSourceCode(std::string source);
 
     std::string sourceFile;
     std::string fileName;
     std::string sourceCode; // processed
     std::string overrideImgFmt;
+    std::vector<std::string> defines; // "NAME VALUE", injected after #version
     int id;
     ShaderType type;
     glm::uvec3 computeShaderLocalSize;
@@ -52,8 +61,8 @@ public:
     GLShaderProgram();
     ~GLShaderProgram();
     virtual void Init();
-    bool Link();
-    virtual void Attach(const GLShader& shader);
+    bool Link(); // Loads the program from the ProgramCache if it can
+    virtual void Attach(GLShader& shader);
     void Detach(const GLShader& shader);
     void Use();
     int Id() const { return id; }
@@ -81,39 +90,17 @@ public:
 
 private:
     int id;
+    std::vector<GLShader*> attached; // Until the next Link
     std::map<std::string, int> uniformLocLookup;
     int GetUniformLoc(std::string name);
 };
 
-#if MEASURE_CS_TIMES
-struct ShaderTimingInfo
-{
-    ShaderTimingInfo()
-        : TotalTime(0)
-        , NumExecutions(0)
-    {
-    }
-
-    double AverageTime() const { return TotalTime / NumExecutions; }
-
-    double TotalTime;
-    long NumExecutions;
-};
-#endif
-
 class GLComputeShader : public GLShaderProgram
 {
 public:
-    void Init() override;
+    // Dispatches are timed by the GPUProfiler under the program's Name
     void Execute(int x, int y, int z);
     void Execute(glm::uvec3 num_work_groups);
-
-#if MEASURE_CS_TIMES
-    ShaderTimingInfo const TimingInfo() { return timing; }
-private:
-
-    unsigned int timeQuery0;
-    unsigned int timeQuery1;
-    ShaderTimingInfo timing;
-#endif
+    // Work group counts come from a GL_DISPATCH_INDIRECT_BUFFER, offset in bytes
+    void ExecuteIndirect(unsigned int buffer, long long offset);
 };
\ No newline at end of file
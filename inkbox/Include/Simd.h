@@ -0,0 +1,42 @@
+#pragma once
+
+// Minimal float vector wrappers for the CPU backends. AVX when the compiler targets it
+// (/arch:AVX2 or -mavx2, set for Release builds), SSE2 on any x64 build and plain floats
+// everywhere else.
+
+#if defined(__AVX2__) || defined(__AVX__)
+#include <immintrin.h>
+
+#define SIMD_WIDTH 8
+typedef __m256 simd_t;
+#define SIMD_LOAD(p) _mm256_loadu_ps(p)
+#define SIMD_STORE(p,v) _mm256_storeu_ps((p),(v))
+#define SIMD_SET1(a) _mm256_set1_ps(a)
+#define SIMD_ADD(a,b) _mm256_add_ps((a),(b))
+#define SIMD_SUB(a,b) _mm256_sub_ps((a),(b))
+#define SIMD_MUL(a,b) _mm256_mul_ps((a),(b))
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+#define SIMD_WIDTH 4
+typedef __m128 simd_t;
+#define SIMD_LOAD(p) _mm_loadu_ps(p)
+#define SIMD_STORE(p,v) _mm_storeu_ps((p),(v))
+#define SIMD_SET1(a) _mm_set1_ps(a)
+#define SIMD_ADD(a,b) _mm_add_ps((a),(b))
+#define SIMD_SUB(a,b) _mm_sub_ps((a),(b))
+#define SIMD_MUL(a,b) _mm_mul_ps((a),(b))
+
+#else
+
+#define SIMD_WIDTH 1
+typedef float simd_t;
+#define SIMD_LOAD(p) (*(p))
+#define SIMD_STORE(p,v) (*(p) = (v))
+#define SIMD_SET1(a) (a)
+#define SIMD_ADD(a,b) ((a) + (b))
+#define SIMD_SUB(a,b) ((a) - (b))
+#define SIMD_MUL(a,b) ((a) * (b))
+
+#endif
@@ -2,6 +2,8 @@
 #pragma once
 
 #include <mutex>
+#include <memory>
+#include <vector>
 
 #include <glm/vec2.hpp>
 
@@ -11,27 +13,55 @@
 #include "FBO.h"
 #include "VertexList.h"
 #include "Interface.h"
-
-#define NUM_JACOBI_ROUNDS 30
+#include "ResidualMonitor.h"
+#include "SimulationBackend.h"
+#include "SimulationThread.h"
+#include "StepScheduler.h"
+#include "CPUSimulation2D.h"
+
+#define MULTIGRID_MIN_SIDE 8
+#define RESIDUAL_GROUP_SIDE 8
+#define THUMBNAIL_WIDTH 150 // Same as the control panel draws them
+
+// One coarse level of the multigrid pressure solver
+struct MultigridLevel
+{
+	MultigridLevel(int width, int height);
+	SwapFBO Error;	// Error correction for the level above, single channel like pressure
+	FBO Rhs;		// Restricted residual of the level above
+	VertexList Quad;	// Inset by this level's own one cell border
+	int Width;
+	int Height;
+};
 
 struct SimulationFields
 {
 	SimulationFields(int width, int height, int depth = 0);
-	FBO& Get(SimulationField field);
 	void Resize(int w, int h, GLShaderProgram& shader, VertexList& quad);
+	void CreateMultigridLevels(int w, int h);
 	SwapFBO Velocity;
-	FBO Vorticity;
+	FBO Vorticity;		// Scalar fields have a single channel
 	SwapFBO Pressure;
+	FBO Divergence;
 	SwapFBO Ink;
-	FBO Temp;
+	FBO Temp;			// Diffusion right hand side, MacCormack's forward pass
 
-	FBO VelocityVis;
-	FBO PressureVis;
-	FBO VorticityVis;
-	FBO InkVis;
+	std::vector<std::unique_ptr<MultigridLevel>> Multigrid;
 };
 
-class InkBox2DSimulation
+// Small copies of the visualizations for the control panel, the displayed field is drawn
+// straight into the frame that gets presented
+struct ThumbnailSet
+{
+	ThumbnailSet(int width, int height);
+	void Resize(int w, int h, GLShaderProgram& shader, VertexList& quad);
+	FBO Velocity;
+	FBO Pressure;
+	FBO Vorticity;
+	FBO Ink;
+};
+
+class InkBox2DSimulation : public ISimulationBackend
 {
 	friend struct InkBoxWindows;
 
@@ -40,48 +70,115 @@ public:
 
 	bool CreateScene();
 	void WindowLoop();
+	HeadlessResult RunHeadless(int frames, const ImpulseScript& script = ImpulseScript());
+	SimulationVars& Vars() { return vars; }
+	ImpulseState& Impulse() { return impulseState; }
+	void SetInputLog(InputLog* log) { inputLog = log; }
 	void Terminate();
 	
-	void DrawQuad();
+	void DrawQuad(const std::string& pass);
+	void DrawQuad(const std::string& pass, VertexList& q);
+	void RenderVisualization(SimulationField field, FBO& target);
+	void RenderThumbnails();
 	void SetDimensions(int w, int h);
 	void CopyFBO(FBO& dest, FBO& src);
+	void CopyFBO(FBO& dest, FBO& src, VertexList& q);
+
+	// The GPU fields as width*height linear RGB floats, laid out like CPUSimulation2D::ReadField
+	void ReadField(SimulationField field, float* rgb);
+
+	virtual const char* BackendName() const override { return "gpu"; }
+	virtual void ComputeFields(float delta_t, float frame_fraction = 1.f) override;
+	virtual void ClearFields() override;
+	virtual void Finish() override;
+	virtual SolverStats& Stats() override { return stats; }
+	virtual ResidualNorms MeasurePressureResidual() override;
 	
 private:
 
 	bool CreateShaderOps();
 	void ProcessInputs();
+	void Resize(int w, int h);
+	void StartSimulationThread();
+	void Tick(float tick_time);
+	void Present();
+	void RenderControlPanel();
 
 	SimulationFields fbos;
 	SimulationVars vars;
 	ControlPanel controlPanel;
 	float delta_t;
-	void ComputeFields();
+	void CreateBackend();
+	void UploadCPUFields();
+	void Advect(SwapFBO& quantity, float dissipation);
 	void ComputeBoundaryValues(SwapFBO& swap, float scale);
-	void SolvePoissonSystem(SwapFBO& swap, FBO& initial_value, float alpha, float beta);
-	void SolvePoissonSystem(SwapFBO& swap, float alpha, float beta);
-	void TickDropletsMode();
-	glm::vec2 RandPos();
+	int SolvePoissonSystem(SwapFBO& swap, FBO& b, float alpha, float beta, ResidualMonitor& monitor, int iterations = 0, bool red_black = false);
+	int SolvePoissonSystem(SwapFBO& swap, float alpha, float beta, ResidualMonitor& monitor);
+	int SolvePoissonSystem(FBO*& x, FBO*& scratch, FBO& b, float alpha, float beta, ResidualMonitor& monitor, int iterations, bool red_black = false);
+	void RelaxPoissonSystem(SwapFBO& swap, FBO& b, float alpha, float beta, glm::vec2 stride, VertexList& q, int iterations);
+	void RelaxPoissonSystem(FBO*& x, FBO*& scratch, FBO& b, float alpha, float beta, glm::vec2 stride, int iterations);
+	void RelaxRedBlack(FBO*& x, FBO*& scratch, FBO& b, float alpha, float beta, int iterations);
+	void MeasureResidual(FBO& x, FBO& b, float alpha, float beta, ResidualMonitor& monitor);
+	void MeasureMaxSpeed();
+	int SolvePressureMultigrid(SwapFBO& swap, FBO& initial_value, float alpha);
+	void VCycle(SwapFBO& x, FBO& b, int level, float alpha, int w, int h);
 
 	QuadShaderOp impulse;
 	QuadShaderOp radialImpulse;
 	QuadShaderOp vorticity;
 	QuadShaderOp addVorticity;
 	QuadShaderOp advection;
+	QuadShaderOp macCormack;
 	QuadShaderOp poissonSolver;
-	QuadShaderOp gradient;
 	QuadShaderOp divergence;
-	QuadShaderOp subtract;
+	QuadShaderOp project;
 
 	GLFWwindow* window;
-	FPSLimiter limiter;
+	GLFWwindow* worker;
 	int width;
 	int height;
 	glm::vec2 rdv;
 	ImpulseState impulseState;
+	InputLog* inputLog;
 	VarTextBoxes ui;
 	bool paused;
+	AdvectionType advectionType;
+
+	ISimulationBackend* backend;
+	std::unique_ptr<CPUSimulation2D> cpuBackend;
+	std::vector<float> uploadBuffer;
+
+	// The window loop presents on this thread while another one ticks the simulation. The
+	// control panel works on its own copies, the rest is guarded by shared.Lock.
+	SimulationThread simThread;
+	SharedSimulationState shared;
+	FrameMailbox frames;
+	std::unique_ptr<FBO> presentFrames[PRESENT_SLOTS];
+	FrameMailbox thumbnailFrames; // The panel's context samples them, they go through a mailbox too
+	std::unique_ptr<ThumbnailSet> thumbnails[PRESENT_SLOTS];
+
+	// Sim thread only. A frame is only published when something changed, thumbnails only
+	// when the panel shows them and at most ControlPanelFPS times a second.
+	bool frameStale;
+	SimulationField publishedField;
+	bool thumbnailsStale;
+	double nextThumbnails;
+	SimulationVars panelVars;
+	SolverStats panelStats;
+	ImpulseState panelImpulse;
+	glm::vec2 cursorPos;
+	bool leftDown;
+	bool rightDown;
+
+	SolverStats stats;
+	ResidualMonitor pressureMonitor;
+	ResidualMonitor velocityDiffusionMonitor;
+	ResidualMonitor inkDiffusionMonitor;
+	ResidualMonitor speedMonitor;
+	StepScheduler scheduler;
 
 	VertexList quad;
+	VertexList presentQuad; // Same as quad, vertex arrays aren't shared between contexts
 	VertexList borderT;
 	VertexList borderB;
 	VertexList borderL;
@@ -90,10 +187,14 @@ private:
 	GLShaderProgram impulseShader;
 	GLShaderProgram radialImpulseShader;
 	GLShaderProgram advectionShader;
+	GLShaderProgram macCormackShader;
 	GLShaderProgram jacobiShader;
+	GLShaderProgram redBlackShader;
+	GLShaderProgram residualShader;
+	GLShaderProgram prolongateShader;
 	GLShaderProgram divShader;
-	GLShaderProgram gradShader;
-	GLShaderProgram subtractShader;
+	GLShaderProgram divJacobiShader;
+	GLShaderProgram projectShader;
 	GLShaderProgram boundaryShader;
 	GLShaderProgram vorticityShader;
 	GLShaderProgram addVorticityShader;
@@ -101,4 +202,6 @@ private:
 	GLShaderProgram inkVisShader;
 	GLShaderProgram vectorVisShader;
 	GLShaderProgram copyShader;
+	GLComputeShader residualNormShader;
+	GLComputeShader speedNormShader;
 };
\ No newline at end of file
@@ -5,12 +5,23 @@
 #include "Interface.h"
 #include "Camera.h"
 #include "Simulation2D.h"
+#include "CPUSimulation3D.h"
+#include "ResidualMonitor.h"
+#include "ConjugateGradient.h"
+#include "StepScheduler.h"
+#include "SimulationThread.h"
+#include "BrickOccupancy.h"
+
+#define JACOBI_TILE_SIDE 16 // The tiled kernel's columns, sparse bricks stream a brick at a time instead
+#define JACOBI_SLAB_DEPTH 32
+#define JACOBI_MAX_SWEEPS 8 // A 32x32 work group and a 32x32 float plane of shared memory per sweep
+#define MACROCELL_SIDE 8 // Has to match view.frag and macrocells.comp
 
 struct SimulationTextures
 {
 	SimulationTextures(int width, int height, int depth)
 		: Velocity(width, height, depth, 4)
-		, Pressure(width, height, depth, 4)
+		, Pressure(width, height, depth, 1)
 		, Ink(width, height, depth, 4)
 		, Divergence(width, height, depth, 1)
 		, Temp(width, height, depth, 4)
@@ -19,67 +30,145 @@ struct SimulationTextures
 
 	SwapTexture Ink;
 	SwapTexture Velocity;
-	SwapTexture Pressure; // TODO: Pressure only needs 1 channel
+	Texture Pressure;
+	std::unique_ptr<Texture> PressureScratch; // Only the Jacobi solver needs it, red-black works in place
 	Texture Divergence;
-	Texture Temp;
+	Texture Temp; // Diffusion right hand side, MacCormack's forward pass
 };
 
-class InkBox3DSimulation
+class InkBox3DSimulation : public ISimulationBackend
 {
 public:
 	InkBox3DSimulation(const InkBoxWindows& app, int width, int height, int depth);
 	bool CreateScene();
 	void WindowLoop();
+	HeadlessResult RunHeadless(int frames, const ImpulseScript& script = ImpulseScript());
+	SimulationVars& Vars() { return vars; }
+	ImpulseState& Impulse() { return impulseState; }
+	void SetInputLog(InputLog* log) { inputLog = log; }
 	void ScrollCallback(double xoffset, double yoffset);
 
+	// ISimulationBackend, runs the fields on the GPU
+	virtual const char* BackendName() const override { return "gpu"; }
+	virtual void ComputeFields(float delta_t, float frame_fraction = 1.f) override;
+	virtual void ClearFields() override;
+	virtual void Finish() override;
+	virtual SolverStats& Stats() override { return stats; }
+	virtual ResidualNorms MeasurePressureResidual() override;
+
+	// The GPU fields as width*height*depth linear RGBA floats, laid out like CPUSimulation3D::ReadField
+	void ReadField(SimulationField field, float* rgba);
+	void WriteField(SimulationField field, const float* rgba);
+
 private:
+	Texture& FieldTexture(SimulationField field);
+	void CreateBackend();
+	void UploadCPUFields();
 	void ProcessInputs();
 	void UpdatePickCoord();
-	void TickDropletsMode();
-	void ComputeFields();
-	void SolvePoissonSystem(SwapTexture& swap, Texture& initial_value, float alpha, float beta);
+	void TickDropletsMode(bool drop_now);
+	void CreatePresentation();
+	void StartSimulationThread();
+	void Tick(float tick_time);
+	void Present();
+	void RenderControlPanel();
+	void Advect(SwapTexture& quantity, float dissipation, float gravity, float delta_t);
+	int SolvePoissonSystem(SwapTexture& swap, float alpha, float beta, ResidualMonitor& monitor);
+	int SolvePoissonSystem(Texture*& x, Texture*& scratch, Texture& b, float alpha, float beta, ResidualMonitor& monitor, bool scalar_field, int iterations, bool red_black = false);
+	int RelaxPoissonSystem(Texture*& x, Texture*& scratch, Texture& b, float alpha, float beta, bool scalar_field, int max_iterations = 1);
+	int RelaxRedBlack(Texture& x, Texture& b, float alpha, float beta);
+	void MeasureResidual(Texture& x, Texture& b, float alpha, float beta, ResidualMonitor& monitor, bool scalar_field);
+	void MeasureMaxSpeed();
 	void ComputeBoundaryValues(SwapTexture& swap, float scale);
 	void CopyImage(Texture& dest, Texture& src);
-	void ClearFields();
+	void UpdateActiveBricks();
+	void Dispatch(GLComputeShader& shader); // Over the active bricks when there are any
 
 	std::mutex scrollMtx;
 	double scrollAcc;
 
 	GLFWwindow* window;
+	GLFWwindow* worker;
 	int wwidth;
 	int wheight;
-	FPSLimiter limiter;
 	int width;
 	int height;
 	int depth;
 	glm::mat4 cubeModel;
 	glm::mat4 projection;
 	glm::mat4 invProjView;
-	float delta_t;
 	bool paused;
 	glm::uvec3 computeLocalSize;
 	glm::uvec3 computeWorkGroups;
+	glm::uvec3 jacobiTiledWorkGroups;
+	glm::uvec3 redBlackWorkGroups; // One colour at a time, so half as wide
+	int jacobiSweeps; // 0 when the tiled kernel isn't in use
+	AdvectionType advectionType;
 	ImpulseState impulseState;
+	InputLog* inputLog;
 	SimulationVars vars;
 	VarTextBoxes ui;
 	ControlPanel controlPanel;
+	// The window loop presents on this thread while another one ticks the simulation. The
+	// control panel works on its own copies, the rest is guarded by shared.Lock.
+	SimulationThread simThread;
+	SharedSimulationState shared;
+	FrameMailbox frames;
+	std::unique_ptr<Texture> presentFrames[PRESENT_SLOTS]; // Copies of the ink
+	std::unique_ptr<Texture> presentMacrocells[PRESENT_SLOTS]; // Their largest ink per macro-cell, for skipping empty space
+	glm::uvec3 macrocellWorkGroups;
+	SimulationVars panelVars;
+	SolverStats panelStats;
+	ImpulseState panelImpulse;
+	bool picked;          // A click hit the cube since the last tick
+	glm::vec3 pickPos;
+	glm::vec3 pickForce;
+	bool dropNow;
+
+	SolverStats stats;
+	ResidualMonitor pressureMonitor;
+	ResidualMonitor velocityDiffusionMonitor;
+	ResidualMonitor inkDiffusionMonitor;
+	ResidualMonitor speedMonitor;
+	StepScheduler scheduler;
+	ConjugateGradientSolver pcgSolver;
+	BrickOccupancy bricks; // Only initialised with SparseBricks on
 
 	Camera camera;
-	VertexList cube;
+	VertexList cube;        // Both made on the present context
 	VertexList cubeBorder;
+	std::unique_ptr<FBO> lowResView; // The rays go here first at a RenderScale below 1
+	glm::ivec2 framebufferSize;
 	glm::vec3 cubeVertices[8];
 
 	GLShaderProgram viewShader;
+	GLShaderProgram viewLowResShader;
+	GLShaderProgram upsampleShader;
 	GLShaderProgram borderShader;
 	GLComputeShader impulseShader;
 	GLComputeShader advectionShader;
+	GLComputeShader macCormackShader;
 	GLComputeShader jacobiShader;
+	GLComputeShader jacobiScalarShader;
+	GLComputeShader jacobiTiledShader;
+	GLComputeShader redBlackShader;
+	GLComputeShader residualShader;
+	GLComputeShader residualScalarShader;
 	GLComputeShader divShader;
-	GLComputeShader gradShader;
-	GLComputeShader subtractShader;
+	GLComputeShader divFusedShader;
+	GLComputeShader projectShader;
 	GLComputeShader copyShader;
 	GLComputeShader clearShader;
+	GLComputeShader clearScalarShader;
 	GLComputeShader boundaryShader;
+	GLComputeShader speedNormShader;
+	GLComputeShader macrocellShader;
+	GLComputeShader sparseClearShader;
+	GLComputeShader sparseClearScalarShader;
 
 	SimulationTextures textures;
+
+	ISimulationBackend* backend;
+	std::unique_ptr<CPUSimulation3D> cpuBackend;
+	std::vector<float> uploadBuffer;
 };
\ No newline at end of file
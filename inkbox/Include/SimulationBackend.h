@@ -0,0 +1,53 @@
+#pragma once
+
+#include <functional>
+
+#include <glm/vec3.hpp>
+
+#include "Interface.h"
+#include "ResidualMonitor.h"
+#include "StepScheduler.h"
+
+#define NUM_JACOBI_ROUNDS 30
+
+class InputLog;
+
+// Anything that can advance the simulation fields by a frame. Backends are constructed with
+// pointers to the shared SimulationVars/ImpulseState so the same scene can run on the GPU or the CPU.
+class ISimulationBackend
+{
+public:
+	virtual ~ISimulationBackend() {}
+
+	virtual const char* BackendName() const = 0;
+	// frame_fraction is delta_t's share of the displayed frame. Dissipation and gravity are per
+	// frame, a substep only applies its share of them.
+	virtual void ComputeFields(float delta_t, float frame_fraction = 1.f) = 0;
+	virtual void ClearFields() = 0;
+	virtual void Finish() = 0; // Block until the last ComputeFields has completed
+	virtual SolverStats& Stats() = 0;
+	// The pressure's residual against the last divergence, measured now whatever the tolerance.
+	// Waits for the GPU, it's for reports at the end of a run.
+	virtual ResidualNorms MeasurePressureResidual() = 0;
+};
+
+// Sets the impulse for one frame of a scripted headless run
+typedef std::function<void(int frame, ImpulseState& impulse)> ImpulseScript;
+
+struct HeadlessResult
+{
+	int Frames;
+	double Seconds;
+};
+
+// Steps a backend for a number of frames with a fixed timestep and droplets mode supplying
+// the impulses, then reports the throughput. A depth of 0 means a 2D grid. With an input log
+// every frame is recorded, or replayed until the log runs out. A script replaces droplets mode.
+HeadlessResult RunHeadless(ISimulationBackend& backend, SimulationVars& vars, ImpulseState& impulse, glm::ivec3 size, int frames,
+	InputLog* log = nullptr, const ImpulseScript& script = ImpulseScript());
+
+// Advances the fields by one displayed frame, split into as many substeps as the scheduler plans.
+// With an input log the plan is recorded along with the impulse, or a replay runs the logged
+// substeps instead, since the speed readback the plan follows isn't deterministic. The impulse
+// goes in with the first substep only. Returns false once a replay has run out of frames.
+bool RunFrame(ISimulationBackend& backend, ImpulseState& impulse, StepScheduler& scheduler, float frame_time, InputLog* log);
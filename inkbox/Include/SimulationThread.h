@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include <glad/glad.h>
+
+#include "Interface.h"
+#include "ResidualMonitor.h"
+
+#define PRESENT_SLOTS 3
+#define SIM_THREAD_MAX_BACKLOG 4 // Ticks the sim thread can fall behind before it skips them
+
+struct GLFWwindow;
+
+// Hands finished frames from the sim thread to the present thread. With three slots the sim
+// always has one to write that isn't the latest or the one on screen, so neither thread waits
+// for the other. Each side fences its GL work on a slot and the other side's context waits on
+// the fence on the GPU (glWaitSync) before using the slot. What a slot holds is up to the
+// simulation, the mailbox only hands out indices, and the present side can be any context
+// sharing with the sim's (the 2D control panel takes its thumbnails through a second one).
+class FrameMailbox
+{
+public:
+	FrameMailbox();
+	~FrameMailbox();
+
+	// Sim side, the slot to fill next, then make it the latest
+	int BeginWrite();
+	void EndWrite();
+
+	// Present side, the latest finished slot or the one shown last time if nothing newer has
+	// finished, -1 before the first. EndRead fences the reads so the sim can write it again.
+	int BeginRead();
+	void EndRead();
+
+private:
+	void Fence(int slot);
+
+	std::mutex lock;
+	GLsync fences[PRESENT_SLOTS];
+	int writing;
+	int latest;
+	int reading;
+};
+
+// What the present thread and the sim thread both touch, guarded by Lock. The control panel
+// edits its own copy of the vars which the present thread pushes here, each tick starts from
+// them and leaves its stats and impulse here for the panel to show.
+struct SharedSimulationState
+{
+	SharedSimulationState();
+
+	std::mutex Lock;
+	SimulationVars Vars;
+	SolverStats Stats;
+	ImpulseState Impulse;
+	bool Paused;
+	bool ClearRequested;
+	bool ThumbnailsVisible;
+};
+
+// Calls tick(delta_t) at a fixed rate on its own thread with a GLFW window's context current.
+// The context has to share objects with the present window and can't be current anywhere else
+// while the thread runs. A tick that overruns is followed straight away by the next one, past
+// SIM_THREAD_MAX_BACKLOG ticks behind the rest are skipped and the simulation runs slow.
+// The GPU profiler and trace recorder frames follow the ticks.
+class SimulationThread
+{
+public:
+	SimulationThread();
+	~SimulationThread();
+
+	void Start(GLFWwindow* context, float tick_rate, const std::function<void(float)>& tick);
+	void Stop(); // Waits for the current tick, the context is released when it returns
+	bool IsRunning() const { return thread.joinable(); }
+
+	float MeasuredRate() const { return measuredRate; } // Ticks per second
+
+private:
+	void Run(GLFWwindow* context, float tick_rate);
+
+	std::thread thread;
+	std::atomic<bool> running;
+	std::atomic<float> measuredRate;
+	std::function<void(float)> tick;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#define SCHEDULER_MAX_FRAME_TIME 0.1f // A hitch longer than this is simulated as if it weren't
+
+// How one displayed frame gets simulated
+struct FrameSteps
+{
+	float FrameTime;   // Wall-clock time the frame covers
+	int Substeps;
+	float SubstepTime; // delta_t of each substep
+};
+
+// Splits each displayed frame's wall-clock time into simulation substeps. A substep's delta_t is
+// capped so the fastest cell moves at most CFLNumber cells, and the number of substeps is capped
+// by SubstepBudgetMs using the cost of the last few frames. When the budget runs out the
+// simulation falls behind the wall clock instead of taking longer steps. A calm fluid gets a
+// single step per frame.
+class StepScheduler
+{
+public:
+	StepScheduler();
+
+	// frame_time is the wall-clock time since the last frame, max_speed the fastest back-trace
+	// in cells per unit of delta_t (negative when unknown). Returns how many substeps to run.
+	int Plan(float frame_time, float max_speed);
+
+	// Wall-clock seconds the planned substeps took, plus drawing the frame
+	void Measure(double seconds);
+
+	float SubstepTime() const { return substepTime; }
+	int Substeps() const { return substeps; }
+
+private:
+	bool enabled;
+	float cfl;
+	int maxSubsteps;
+	double budget;
+	double stepCost; // Running average in seconds, 0 until measured
+	float substepTime;
+	int substeps;
+};
@@ -13,7 +13,7 @@ class TestManager
 public:
 	static TestManager& Get();
 	void Add(class TestRoutine* test);
-	void RunTests();
+	bool RunTests(); // True if every test passed
 
 private:
 	std::vector<class TestRoutine*> testList;
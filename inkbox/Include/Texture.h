@@ -14,6 +14,8 @@ public:
 
     void Bind(int unit_id);
     void BindToImage(int unit_idx, int access);
+    void Upload(const float* data, int data_format);
+    void Download(float* data, int data_format);
 
     int Id() const { return id; }
     int Width() const { return width; }
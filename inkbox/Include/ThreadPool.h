@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads used by the CPU backends. The calling thread takes part in every
+// job so a pool of N threads owns N-1 workers.
+class ThreadPool
+{
+public:
+	ThreadPool(int num_threads = 0); // 0 = one per hardware thread
+	~ThreadPool();
+
+	int NumThreads() const { return int(workers.size()) + 1; }
+
+	// Splits [begin, end) into one contiguous band per thread and blocks until every band is done
+	void ParallelFor(int begin, int end, const std::function<void(int, int)>& func);
+
+	// Calls func for every item in [0, count). Each thread starts on its own contiguous range and
+	// steals half of another thread's remaining range once it runs out. Blocks until all are done.
+	void ParallelForEach(int count, const std::function<void(int)>& func);
+
+private:
+	struct StealRange
+	{
+		std::mutex Lock;
+		int Begin;
+		int End;
+	};
+
+	void WorkerLoop(int index);
+	void Dispatch();
+	void RunJob(int index);
+	void RunBand(int index);
+	void RunStealing(int index);
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<StealRange[]> ranges;
+	std::mutex mtx;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	const std::function<void(int, int)>* job;
+	const std::function<void(int)>* itemJob;
+	int jobBegin;
+	int jobEnd;
+	int generation;
+	int pending;
+	bool stopping;
+};
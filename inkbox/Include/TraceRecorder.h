@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class TraceTrack
+{
+	CPU = 1,
+	GPU = 2,
+	Present = 3 // The windowed app's main thread, the simulation runs on its own thread there
+};
+
+// Captures CPU scopes and GPU pass ranges for a fixed number of frames and writes them out as
+// Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev). GPU ranges come from the
+// GPUProfiler a few frames late and are moved onto the CPU clock, so the two tracks line up.
+// Events can come from any thread, frames are counted on the thread that runs the simulation.
+class TraceRecorder
+{
+public:
+	static TraceRecorder& Get();
+
+	TraceRecorder();
+
+	void Start(const std::string& path, int frames);
+	void Stop(); // Waits for outstanding GPU ranges and writes the file
+	bool IsRecording() const { return recording; }
+
+	// Call at the top of every frame, before GPUProfiler::NewFrame
+	void NewFrame();
+
+	// Microseconds since the recorder was created
+	double Now() const;
+	void AddEvent(TraceTrack track, const std::string& name, double begin, double duration);
+
+	// Track the calling thread's scopes go on, CPU unless set
+	static void SetThreadTrack(TraceTrack track);
+
+	class Scope
+	{
+	public:
+		Scope(const char* name);
+		~Scope();
+	private:
+		const char* name;
+		double begin;
+	};
+
+private:
+	struct Event
+	{
+		std::string Name;
+		double Begin;
+		double Duration;
+		TraceTrack Track;
+	};
+
+	bool Write();
+
+	std::chrono::steady_clock::time_point epoch;
+	std::mutex controlLock; // Serialises Start and Stop
+	std::mutex eventsLock;
+	std::vector<Event> events;
+	std::string path;
+	std::atomic<bool> recording;
+	int framesLeft;
+	int frameNumber;
+	double frameBegin;
+};
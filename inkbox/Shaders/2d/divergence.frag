@@ -2,16 +2,31 @@
 
 precision highp float;
 
+// With FUSE_JACOBI the first Jacobi iteration of the pressure solve is written to a second target,
+// it only needs the divergence at the texel itself. WARM_START starts from last frame's pressure
+// instead of 0.
+
 uniform sampler2D field;
 uniform float gs;
 
+#ifdef FUSE_JACOBI
+#ifdef WARM_START
+uniform sampler2D pressure;
+#endif
+
+uniform float alpha;
+uniform float beta;
+
+layout(location = 1) out vec4 PressureOut;
+#endif
+
 varying vec2 coord;
 varying vec2 pxT;
 varying vec2 pxB;
 varying vec2 pxL;
 varying vec2 pxR;
 
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
 
 void main()
 {
@@ -23,4 +38,14 @@ void main()
     float div = (R.x - L.x)/(2 * gs) + (T.y - B.y)/(2 * gs);
 
     FragColor = vec4(div, 0.0, 0.0, 1.0);
-}
\ No newline at end of file
+
+#ifdef FUSE_JACOBI
+    // Same as jacobi.frag, with a zero start the neighbours are all 0
+    float sum = 0.0;
+#ifdef WARM_START
+    sum = texture2D(pressure, pxL).x + texture2D(pressure, pxR).x + texture2D(pressure, pxB).x + texture2D(pressure, pxT).x;
+#endif
+
+    PressureOut = vec4((sum + alpha * div) / beta, 0.0, 0.0, 1.0);
+#endif
+}
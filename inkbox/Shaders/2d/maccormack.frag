@@ -0,0 +1,42 @@
+#version 330 core
+
+precision highp float;
+
+// Second half of MacCormack advection, see advection.frag for the first. Tracing the forward
+// result back to the start of the step estimates its error, half of which is taken off again. The
+// result is clamped to the 4 texels the forward step interpolated between so it can't overshoot.
+
+uniform float delta_t;                      // Time step
+uniform float dissipation = 1.0f;           // Dissipation factor
+uniform sampler2D velocity;                 // The velocity field doing the advecting
+uniform sampler2D quantity;                 // The quantity at the start of the step
+uniform sampler2D forward;                  // advection.frag's result without dissipation
+uniform vec2 rdv;
+uniform float gs;
+
+varying vec2 coord;
+
+out vec4 FragColor;
+
+void main()
+{
+    vec2 u1 = texture2D(velocity, coord).xy;
+    vec2 pos0 = coord - delta_t * gs * u1;
+
+    vec3 back = texture2D(forward, coord + delta_t * gs * u1).xyz;
+    vec3 corrected = texture2D(forward, coord).xyz + 0.5 * (texture2D(quantity, coord).xyz - back);
+
+    ivec2 last = textureSize(quantity, 0) - 1;
+    ivec2 base = ivec2(floor(clamp(pos0 / rdv - 0.5, vec2(0), vec2(last))));
+
+    vec3 lo = vec3(1e30);
+    vec3 hi = vec3(-1e30);
+    for (int i = 0; i < 4; i++)
+    {
+        vec3 q = texelFetch(quantity, min(base + ivec2(i & 1, i >> 1), last), 0).xyz;
+        lo = min(lo, q);
+        hi = max(hi, q);
+    }
+
+    FragColor = vec4(dissipation * clamp(corrected, lo, hi), 1.0);
+}
\ No newline at end of file
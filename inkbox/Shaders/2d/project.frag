@@ -0,0 +1,30 @@
+#version 330 core
+
+precision highp float;
+
+// U = W - grad(P) in one pass, the gradient never goes through memory
+
+uniform sampler2D velocity;
+uniform sampler2D pressure;
+uniform float gs;
+
+varying vec2 coord;
+varying vec2 pxT;
+varying vec2 pxB;
+varying vec2 pxL;
+varying vec2 pxR;
+
+out vec4 FragColor;
+
+void main()
+{
+    float R = texture2D(pressure, pxR).x;
+    float L = texture2D(pressure, pxL).x;
+    float B = texture2D(pressure, pxB).x;
+    float T = texture2D(pressure, pxT).x;
+    
+    vec2 gradient = vec2(R-L, T-B)/(2 * gs);
+    vec2 v = texture2D(velocity, coord).xy - gradient;
+
+    FragColor = vec4(v, 0.0, 1.0);
+}
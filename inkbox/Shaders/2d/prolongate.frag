@@ -0,0 +1,17 @@
+#version 330 core
+
+precision highp float;
+
+uniform sampler2D x;    // Fine level solution
+uniform sampler2D e;    // Coarse level error correction
+
+varying vec2 coord;
+
+out vec4 FragColor;
+
+void main()
+{
+    // Bilinear filtering on the coarse texture does the interpolation
+    vec3 result = texture2D(x, coord).xyz + texture2D(e, coord).xyz;
+    FragColor = vec4(result, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#version 330 core
+
+precision highp float;
+
+// One half of a red-black Gauss-Seidel sweep of the system in jacobi.frag. Only the cells of one
+// colour are relaxed, the others are copied through, so a red pass followed by a black pass reads
+// the freshly updated neighbours. omega > 1 over-relaxes.
+
+uniform float beta;
+uniform float alpha;
+uniform float omega;
+uniform int parity;
+uniform sampler2D x;
+uniform sampler2D b;
+
+varying vec2 coord;
+varying vec2 pxT;
+varying vec2 pxB;
+varying vec2 pxL;
+varying vec2 pxR;
+
+out vec4 FragColor;
+
+void main()
+{
+    vec3 xC = texture2D(x, coord).xyz;
+
+    ivec2 cell = ivec2(gl_FragCoord.xy);
+    if (((cell.x + cell.y) & 1) != parity)
+    {
+        FragColor = vec4(xC, 1.0);
+        return;
+    }
+
+    vec3 xL = texture2D(x, pxL).xyz;
+    vec3 xR = texture2D(x, pxR).xyz;
+    vec3 xB = texture2D(x, pxB).xyz;
+    vec3 xT = texture2D(x, pxT).xyz;
+    vec3 bC = texture2D(b, coord).xyz;
+
+    vec3 gs = (xL + xR + xB + xT + (alpha * bC)) / beta;
+
+    FragColor = vec4(mix(xC, gs, omega), 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+// Shared by advection_trilinear.comp and maccormack.comp. Positions are in voxels, voxel centres
+// on whole numbers.
+
+vec3 to_uvw(vec3 pos, vec3 size)
+{
+    return (pos + 0.5) / size;
+}
+
+// Where the fluid at coord was `dist` ago, dist being delta_t / gs. The velocity is in box widths
+// per second, gs is a voxel's width. Negative traces forward. RK2 takes the velocity at the
+// midpoint instead of at the voxel.
+vec3 trace(sampler3D velocity, ivec3 coord, float dist)
+{
+    vec3 pos = vec3(coord);
+    vec3 u = texelFetch(velocity, coord, 0).xyz;
+
+#ifdef RK2
+    u = texture(velocity, to_uvw(pos - 0.5 * dist * u, vec3(textureSize(velocity, 0)))).xyz;
+#endif
+
+    return pos - dist * u;
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+// Included by the 3D passes after their local size. Compiled with SPARSE_BRICKS the pass is
+// dispatched indirectly over the bricks BrickOccupancy listed, the bricks along x and each brick's
+// work groups along y. Otherwise it's the usual dense dispatch.
+
+#ifndef BRICK_SIDE
+#define BRICK_SIDE 8
+#endif
+
+#ifdef SPARSE_BRICKS
+layout(std430, binding=3) readonly buffer BrickList
+{
+    uint brick_list[];  // x | y << 10 | z << 20
+};
+
+uniform int brick_list_offset = 0;
+
+ivec3 unpack_brick(uint entry)
+{
+    return ivec3(entry & 0x3FFu, (entry >> 10) & 0x3FFu, entry >> 20);
+}
+#endif
+
+const ivec3 BRICK_GROUPS = ivec3(BRICK_SIDE) / ivec3(gl_WorkGroupSize);
+
+// First cell of this work group's block
+ivec3 group_origin()
+{
+#ifdef SPARSE_BRICKS
+    ivec3 brick = unpack_brick(brick_list[brick_list_offset + int(gl_WorkGroupID.x)]);
+
+    int i = int(gl_WorkGroupID.y);
+    ivec3 block = ivec3(i % BRICK_GROUPS.x, (i / BRICK_GROUPS.x) % BRICK_GROUPS.y, i / (BRICK_GROUPS.x * BRICK_GROUPS.y));
+    return brick * BRICK_SIDE + block * ivec3(gl_WorkGroupSize);
+#else
+    return ivec3(gl_WorkGroupID) * ivec3(gl_WorkGroupSize);
+#endif
+}
+
+ivec3 cell_coord()
+{
+    return group_origin() + ivec3(gl_LocalInvocationID);
+}
\ No newline at end of file
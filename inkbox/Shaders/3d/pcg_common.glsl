@@ -0,0 +1,70 @@
+// Shared by the pcg_*.comp kernels, included after the local size declaration. The pressure and
+// divergence images use FIELD_FORMAT (defined by the solver to match the textures), the solver's
+// own vectors are always r32f.
+
+#ifndef FIELD_FORMAT
+#define FIELD_FORMAT r16_snorm
+#endif
+
+// One partial sum per work group, added up by pcg_reduce.comp
+layout(std430, binding=0) buffer Partials
+{
+    float partials[];
+};
+
+// Kept on the GPU so the iterations never wait on a readback
+layout(std430, binding=1) buffer Scalars
+{
+    float rz;       // r.z of the current iteration
+    float cg_alpha; // Step along p
+    float cg_beta;  // Weight of the old p in the new one
+};
+
+shared float pcg_sums[gl_WorkGroupSize.x * gl_WorkGroupSize.y * gl_WorkGroupSize.z];
+
+ivec3 clamp_coord(ivec3 coord, ivec3 size)
+{
+    return clamp(coord, ivec3(0, 0, 0), size);
+}
+
+// Diagonal of the matrix applied by jacobi.comp. Neighbours below 0 are clamped onto the cell itself.
+float diagonal(ivec3 coord, float beta)
+{
+    return beta - float(coord.x == 0) - float(coord.y == 0) - float(coord.z == 0);
+}
+
+uint group_index()
+{
+    return gl_WorkGroupID.x + gl_NumWorkGroups.x * (gl_WorkGroupID.y + gl_NumWorkGroups.y * gl_WorkGroupID.z);
+}
+
+// Tree reduction over the work group, only invocation 0 gets the total. Has to be reached by
+// every invocation and the work group size must be a power of two.
+float workgroup_sum(float value)
+{
+    uint lid = gl_LocalInvocationIndex;
+    pcg_sums[lid] = value;
+    barrier();
+
+    for (uint s = (gl_WorkGroupSize.x * gl_WorkGroupSize.y * gl_WorkGroupSize.z) / 2; s > 0; s >>= 1)
+    {
+        if (lid < s)
+        {
+            pcg_sums[lid] += pcg_sums[lid + s];
+        }
+
+        barrier();
+    }
+
+    return pcg_sums[0];
+}
+
+void store_partial(float value)
+{
+    float sum = workgroup_sum(value);
+
+    if (gl_LocalInvocationIndex == 0)
+    {
+        partials[group_index()] = sum;
+    }
+}
\ No newline at end of file
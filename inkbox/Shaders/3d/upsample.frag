@@ -0,0 +1,42 @@
+#version 430
+
+// Brings view.frag's reduced resolution output up to the window, drawn over the cube again. Each
+// pixel blends the four nearest low resolution pixels bilinearly, each weighted down by how far
+// its distance to the cube is from this pixel's. Ink then doesn't bleed over the silhouette or
+// pick up the background from pixels that missed the cube.
+
+#define DEPTH_EPS 0.01
+
+varying vec3 coord;
+varying vec3 coord_wpos;
+varying vec3 cube_wpos;
+
+uniform sampler2D low_res;  // rgb the colour, a the distance to the cube or 0 where it missed
+uniform vec3 camera_wpos;
+uniform vec2 scale;         // Low resolution pixels per window pixel
+
+out vec4 FragColor;
+
+void main()
+{
+    float dist = length(coord_wpos - camera_wpos);
+    vec2 p = gl_FragCoord.xy * scale - 0.5;
+    ivec2 base = ivec2(floor(p));
+    vec2 f = p - vec2(base);
+    ivec2 last = textureSize(low_res, 0) - 1;
+
+    vec3 colour = vec3(0);
+    float total = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        ivec2 corner = ivec2(i & 1, i >> 1);
+        vec4 s = texelFetch(low_res, clamp(base + corner, ivec2(0), last), 0);
+        vec2 bilinear = mix(1 - f, f, vec2(corner));
+        float w = s.a > 0 ? bilinear.x * bilinear.y / (DEPTH_EPS + abs(s.a - dist)) : 0;
+
+        colour += w * s.rgb;
+        total += w;
+    }
+
+    FragColor = vec4(total > 0 ? colour / total : vec3(0), 1);
+}
\ No newline at end of file
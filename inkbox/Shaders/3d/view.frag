@@ -1,7 +1,15 @@
 #version 430
 
+// Compiled with LOW_RES it draws into a smaller target for upsample.frag. The ray starts where it
+// enters the cube and the alpha holds the distance to there in place of the transmittance. With
+// the camera inside the cube only the back faces are drawn, the ray starts at the camera and the
+// alpha holds the distance to the face drawn instead, like upsample.frag measures.
+
 #define STEPS 500
 #define STEP_SIZE 0.005
+#define MACROCELL_SIDE 8                // Same as macrocells.comp
+#define SKIP_ERROR (1.0 / 1024)         // Most colour a skipped macro-cell may have added
+#define MIN_TRANSMITTANCE (1.0 / 256)   // Nothing behind this shows on an 8 bit display
 
 varying vec3 coord;
 varying vec3 coord_wpos;     // A world-space coordinate on the surface of the cube
@@ -10,6 +18,10 @@ varying vec3 cube_wpos;     // Center of the cube in world space
 layout(rgba16_snorm) 
 uniform image3D field;
 
+layout(r16_snorm)
+uniform image3D occupancy;  // Largest ink component per macro-cell, from macrocells.comp
+
+uniform mat4 model;
 uniform vec3 camera_wpos;
 uniform vec3 camera_dir;
 uniform vec4 bg_colour;
@@ -19,14 +31,6 @@ out vec4 FragColor;
 
 ////////////////////////////////////////////////////////////////////////
 
-bool inside_cube(vec3 pos)
-{
-    vec3 q = box_size / 2;
-    vec3 diff = abs(pos) - q;
-    float dist = length(max(diff, vec3(0, 0, 0)));
-    return dist <= 0.001;
-}
-
 vec3 world_to_cube(vec3 wpos)
 {
     vec3 h = box_size / 2;
@@ -34,37 +38,81 @@ vec3 world_to_cube(vec3 wpos)
     return diff * h + h;
 }
 
+// Where a ray start + t * step enters and leaves the box [lo, hi], in steps
+vec2 clip_steps(vec3 start, vec3 step, vec3 lo, vec3 hi)
+{
+    vec3 s = vec3(step.x != 0 ? step.x : 1e-9, step.y != 0 ? step.y : 1e-9, step.z != 0 ? step.z : 1e-9);
+    vec3 t0 = (lo - start) / s;
+    vec3 t1 = (hi - start) / s;
+    vec3 near = min(t0, t1);
+    vec3 far = max(t0, t1);
+    return vec2(max(max(near.x, near.y), near.z), min(min(far.x, far.y), far.z));
+}
+
+// Steps through the field at STEP_SIZE like always, but only between where the ray enters and
+// leaves the field, over macro-cells with next to nothing in them and until the ink in front
+// hides the rest
 vec4 ray_march(vec3 pos, vec3 dir)
 {
     float alpha = 1.0;
     vec3 colour = vec3(0, 0, 0);
 
-    for (int i = 0; i < STEPS; i++)
+    vec3 start = world_to_cube(pos);
+    vec3 step = world_to_cube(pos + dir * STEP_SIZE) - start;
+
+    vec2 inside = clip_steps(start, step, vec3(0), box_size);
+    int last = min(int(ceil(inside.y)), STEPS);
+
+    for (int i = max(int(ceil(inside.x)), 0); i < last && alpha > MIN_TRANSMITTANCE;)
     {
-        if (!inside_cube(pos))
+        ivec3 cube_coord = ivec3(start + i * step);
+        ivec3 macro = cube_coord / MACROCELL_SIDE;
+        float occupied = imageLoad(occupancy, macro).x;
+
+        if (occupied < SKIP_ERROR)
         {
-            //alpha *= (1 - bg_colour.a);
-            colour += bg_colour.rgb * alpha;
-            break;
+            // Straight to the first step past the macro-cell if what it holds adds up to little
+            vec3 lo = vec3(macro * MACROCELL_SIDE);
+            int next = max(int(ceil(clip_steps(start, step, lo, lo + MACROCELL_SIDE).y)), i + 1);
+            if (occupied * (next - i) < SKIP_ERROR)
+            {
+                i = next;
+                continue;
+            }
         }
 
-        ivec3 cube_coord = ivec3(world_to_cube(pos));
         vec4 value = imageLoad(field, cube_coord);
 
         alpha *= (1 - value.a);
         colour += value.rgb * alpha;
-        
-        pos += dir * STEP_SIZE;
+        i++;
     }
 
+    // The background shows where the ray leaves the box_size / 2 wide world region within STEPS
+    vec2 world = clip_steps(pos - cube_wpos, dir * STEP_SIZE, -box_size / 2 - 0.001, box_size / 2 + 0.001);
+    if (floor(world.y) + 1 < STEPS)
+        colour += bg_colour.rgb * alpha;
+
     return vec4(colour, alpha);
 }
 
 void main()
 {
     vec3 ray_pos = coord_wpos;
+
     vec3 ray_dir = ray_pos - camera_wpos;
 
+#ifdef LOW_RES
+    // The model only scales the cube. From inside the cube the rays start at the camera.
+    vec3 half_size = 0.5 * vec3(model[0][0], model[1][1], model[2][2]);
+    float enter = clip_steps(camera_wpos, ray_dir, cube_wpos - half_size, cube_wpos + half_size).x;
+    ray_pos = camera_wpos + max(enter, 0) * ray_dir;
+#endif
+
     vec4 ray_colour = ray_march(ray_pos, ray_dir);
+#ifdef LOW_RES
+    // Never 0, that's left for pixels that missed the cube
+    ray_colour.a = enter > 0 ? length(ray_pos - camera_wpos) : length(ray_dir);
+#endif
     FragColor = ray_colour;
 }
\ No newline at end of file
@@ -0,0 +1,349 @@
+// Entry point of the inkbox_bench target. Runs a fixed set of scenarios headless and prints the
+// results as CSV so runs on different machines, backends and texture formats can be compared.
+//
+// inkbox_bench [filter...] [--backend gpu|cpu] [--texture 16|32] [--jacobi simple|tiled[:sweeps]]
+//              [--max-iterations] [--frames N] [--csv file]
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include "Simulation2D.h"
+#include "Simulation3D.h"
+#include "CPUSimulation2D.h"
+#include "CPUSimulation3D.h"
+#include "GPUProfiler.h"
+#include "IniConfig.h"
+
+using namespace std;
+using namespace glm;
+
+#define BENCH_SEED 1234
+#define BENCH_WARMUP_FRAMES 20
+#define BENCH_FRAMES 200
+#define BENCH_STIR_PERIOD 120.0f  // Frames per revolution of the stir
+#define BENCH_3D_SPLAT_INTERVAL 8 // 3D splats are heavy and logged, so only every few frames
+
+enum class BenchImpulse
+{
+    Stir,
+    FastStir,
+    Droplets
+};
+
+struct BenchScenario
+{
+    const char* Name;
+    ivec3 Size; // z == 0 means 2D
+    BenchImpulse Impulse;
+    function<void(SimulationVars&)> Setup;
+};
+
+struct BenchResult
+{
+    string Scenario;
+    ivec3 Size;
+    HeadlessResult Run;
+    SolverStats Stats;
+    vector<PassTimings> Passes;
+};
+
+void _NoSetup(SimulationVars&) {}
+
+void _VorticitySetup(SimulationVars& vars)
+{
+    vars.AddVorticity = true;
+    vars.Vorticity = 0.05f;
+}
+
+// Only the impulses and the projection, ink advection stays on so the 2D sims don't skip the frame
+void _PressureOnlySetup(SimulationVars& vars)
+{
+    vars.SelfAdvect = false;
+    vars.DiffuseVelocity = false;
+    vars.DiffuseInk = false;
+    vars.AddVorticity = false;
+}
+
+const BenchScenario scenarios[] =
+{
+    { "2d_512",           ivec3(512, 512, 0),     BenchImpulse::Stir,     _NoSetup },
+    { "2d_1024",          ivec3(1024, 1024, 0),   BenchImpulse::Stir,     _NoSetup },
+    { "2d_2048",          ivec3(2048, 2048, 0),   BenchImpulse::Stir,     _NoSetup },
+    { "3d_64",            ivec3(64, 64, 64),      BenchImpulse::Stir,     _NoSetup },
+    { "3d_128",           ivec3(128, 128, 128),   BenchImpulse::Stir,     _NoSetup },
+    { "3d_256",           ivec3(256, 256, 256),   BenchImpulse::Stir,     _NoSetup },
+    { "droplets_2d_1024", ivec3(1024, 1024, 0),   BenchImpulse::Droplets, _NoSetup },
+    { "droplets_3d_128",  ivec3(128, 128, 128),   BenchImpulse::Droplets, _NoSetup },
+    { "vorticity_stir",   ivec3(1024, 1024, 0),   BenchImpulse::FastStir, _VorticitySetup },
+    { "pressure_only_2d", ivec3(1024, 1024, 0),   BenchImpulse::Stir,     _PressureOnlySetup },
+    { "pressure_only_3d", ivec3(128, 128, 128),   BenchImpulse::Stir,     _PressureOnlySetup },
+};
+
+// The same circular stir every run, in grid cells. 2D drags the mouse around the middle of the
+// grid, 3D pushes along the circle in the xz plane.
+ImpulseScript _StirScript(ivec3 size, const SimulationVars& vars, float period)
+{
+    float force_multiplier = vars.ForceMultiplier;
+
+    return [=](int frame, ImpulseState& impulse)
+    {
+        const float PI = 3.14159265f;
+        float step = 2 * PI / period;
+        float angle = frame * step;
+        float radius = 0.25f * min(size.x, size.y);
+
+        impulse.Radial = false;
+        impulse.InkActive = true;
+        impulse.ForceActive = true;
+
+        if (size.z == 0)
+        {
+            vec3 centre(size.x / 2, size.y / 2, 0);
+            impulse.LastPos = centre + radius * vec3(cos(angle - step), sin(angle - step), 0);
+            impulse.CurrentPos = centre + radius * vec3(cos(angle), sin(angle), 0);
+            impulse.Delta = impulse.CurrentPos - impulse.LastPos;
+        }
+        else if (frame % BENCH_3D_SPLAT_INTERVAL == 0)
+        {
+            vec3 centre(size.x / 2, size.y / 2, size.z / 2);
+            impulse.CurrentPos = centre + radius * vec3(cos(angle), 0, sin(angle));
+            impulse.Delta = vec3(-sin(angle), 0, cos(angle)) * force_multiplier;
+        }
+        else
+        {
+            impulse.InkActive = false;
+            impulse.ForceActive = false;
+        }
+    };
+}
+
+string _TextureFormatName(bool cpu)
+{
+    if (cpu)
+        return "f32";
+
+    if (IniConfig::Get().UseSnormTextures)
+        return "rgba16_snorm";
+
+    return IniConfig::Get().TextureComponentWidth == 32 ? "rgba32f" : "rgba16f";
+}
+
+BenchResult _RunScenario(const BenchScenario& scenario, InkBoxWindows& app, int frames)
+{
+    ivec3 size = scenario.Size;
+    bool cpu = IniConfig::Get().SimulationBackend.compare("cpu") == 0;
+
+    SimulationVars cpu_vars;
+    ImpulseState cpu_impulse;
+    unique_ptr<ISimulationBackend> cpu_sim;
+    unique_ptr<InkBox2DSimulation> sim2d;
+    unique_ptr<InkBox3DSimulation> sim3d;
+    SimulationVars* vars = &cpu_vars;
+
+    if (cpu)
+    {
+        if (size.z == 0)
+        {
+            cpu_sim = make_unique<CPUSimulation2D>(size.x, size.y, &cpu_vars, &cpu_impulse, IniConfig::Get().CPUThreads);
+        }
+        else
+        {
+            cpu_vars.Set3DDefaults(size.x);
+            cpu_sim = make_unique<CPUSimulation3D>(size.x, size.y, size.z, &cpu_vars, &cpu_impulse, IniConfig::Get().CPUThreads);
+        }
+    }
+    else if (size.z == 0)
+    {
+        sim2d = make_unique<InkBox2DSimulation>(app, size.x, size.y);
+        if (!sim2d->CreateScene())
+            throw runtime_error("Failed to create the 2D scene");
+
+        vars = &sim2d->Vars();
+    }
+    else
+    {
+        sim3d = make_unique<InkBox3DSimulation>(app, size.x, size.y, size.z);
+        if (!sim3d->CreateScene())
+            throw runtime_error("Failed to create the 3D scene");
+
+        vars = &sim3d->Vars();
+    }
+
+    scenario.Setup(*vars);
+
+    // Every scenario starts from the same droplets seed, whatever inkbox.ini has
+    ImpulseState& impulse = cpu ? cpu_impulse : (sim2d ? sim2d->Impulse() : sim3d->Impulse());
+    impulse.Seed(BENCH_SEED);
+
+    ImpulseScript script;
+    if (scenario.Impulse != BenchImpulse::Droplets)
+    {
+        float period = scenario.Impulse == BenchImpulse::FastStir ? BENCH_STIR_PERIOD / 4 : BENCH_STIR_PERIOD;
+        script = _StirScript(size, *vars, period);
+    }
+
+    // The measured frames carry on the script where the warm-up left it
+    int frame_offset = 0;
+    ImpulseScript offset_script;
+    if (script)
+        offset_script = [&](int frame, ImpulseState& impulse) { script(frame + frame_offset, impulse); };
+
+    auto run = [&](int n) -> HeadlessResult
+    {
+        if (cpu)
+            return RunHeadless(*cpu_sim, cpu_vars, cpu_impulse, size, n, nullptr, offset_script);
+        else if (sim2d)
+            return sim2d->RunHeadless(n, offset_script);
+        else
+            return sim3d->RunHeadless(n, offset_script);
+    };
+
+    LOG_INFO("Scenario %s", scenario.Name);
+    run(BENCH_WARMUP_FRAMES);
+    frame_offset = BENCH_WARMUP_FRAMES;
+    GPUProfiler::Get().Reset();
+
+    ISimulationBackend* backend = cpu ? cpu_sim.get() : (sim2d ? (ISimulationBackend*)sim2d.get() : sim3d.get());
+
+    BenchResult result;
+    result.Scenario = scenario.Name;
+    result.Size = size;
+    result.Run = run(frames);
+    result.Stats = backend->Stats();
+    result.Passes = GPUProfiler::Get().Timings();
+
+    // Measured once after the timed frames, so checking it doesn't change what gets timed
+    result.Stats.Pressure = backend->MeasurePressureResidual();
+    return result;
+}
+
+string _FormatResults(const vector<BenchResult>& results)
+{
+    bool cpu = IniConfig::Get().SimulationBackend.compare("cpu") == 0;
+    string backend = cpu ? "cpu" : "gpu";
+    string format = _TextureFormatName(cpu);
+
+    ostringstream out;
+    char line[512];
+
+    out << "kind,scenario,backend,format,size,frames,ms_per_frame,mcells_per_sec,pressure_iters,pressure_residual" << endl;
+    for (const BenchResult& r : results)
+    {
+        double cells = double(r.Size.x) * r.Size.y * max(r.Size.z, 1);
+        string dims = r.Size.z == 0 ? to_string(r.Size.x) + "x" + to_string(r.Size.y)
+            : to_string(r.Size.x) + "x" + to_string(r.Size.y) + "x" + to_string(r.Size.z);
+
+        snprintf(line, sizeof(line), "result,%s,%s,%s,%s,%d,%.4f,%.3f,%d,%.4e", r.Scenario.c_str(), backend.c_str(), format.c_str(), dims.c_str(),
+            r.Run.Frames, r.Run.Seconds * 1000 / r.Run.Frames, cells * r.Run.Frames / r.Run.Seconds / 1e6, r.Stats.PressureIterations, r.Stats.Pressure.L2);
+        out << line << endl;
+    }
+
+    out << "kind,scenario,pass,calls_per_frame,min_ms,avg_ms,p99_ms,ms_per_frame" << endl;
+    for (const BenchResult& r : results)
+    {
+        for (const PassTimings& t : r.Passes)
+        {
+            snprintf(line, sizeof(line), "pass,%s,%s,%.2f,%.4f,%.4f,%.4f,%.4f", r.Scenario.c_str(), t.Label.c_str(), t.CallsPerFrame, t.Min, t.Avg, t.P99, t.FrameTotal);
+            out << line << endl;
+        }
+    }
+
+    return out.str();
+}
+
+int main(int argc, char** argv)
+{
+    vector<string> args;
+    for (int i = 1; i < argc; i++)
+        args.push_back(string(argv[i]));
+
+    int frames = BENCH_FRAMES;
+    bool max_iterations = false;
+    string csv_path;
+    vector<string> filters;
+
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        bool has_value = i + 1 < args.size();
+
+        if (args[i].compare("--backend") == 0 && has_value)
+            IniConfig::Get().SimulationBackend = args[++i];
+        else if (args[i].compare("--texture") == 0 && has_value)
+            IniConfig::Get().TextureComponentWidth = atoi(args[++i].c_str());
+        else if (args[i].compare("--jacobi") == 0 && has_value)
+        {
+            // e.g. tiled:4 for the 3D tiled kernel with 4 sweeps per dispatch
+            string kernel = args[++i];
+            size_t colon = kernel.find(':');
+            if (colon != string::npos)
+                IniConfig::Get().JacobiSweepsPerDispatch = atoi(kernel.substr(colon + 1).c_str());
+            IniConfig::Get().JacobiKernel = kernel.substr(0, colon);
+        }
+        else if (args[i].compare("--max-iterations") == 0)
+            max_iterations = true;
+        else if (args[i].compare("--frames") == 0 && has_value)
+        {
+            // max is a macro, it would evaluate the ++i twice
+            frames = atoi(args[++i].c_str());
+            frames = max(frames, 1);
+        }
+        else if (args[i].compare("--csv") == 0 && has_value)
+            csv_path = args[++i];
+        else
+            filters.push_back(args[i]);
+    }
+
+    // The solves run inkbox.ini's iteration counts. --max-iterations instead sets a tolerance no
+    // solve can meet, so they all ramp up to MaxJacobiIterations. Nothing here is saved back to
+    // inkbox.ini.
+    if (max_iterations)
+        IniConfig::Get().ResidualTolerance = 1e-20f;
+
+    IniConfig::Get().Print();
+
+    InkBoxWindows app;
+    vector<BenchResult> results;
+
+    try
+    {
+        bool cpu = IniConfig::Get().SimulationBackend.compare("cpu") == 0;
+        if (!cpu && !app.InitHeadlessContext(512, 512))
+            return -1;
+
+        for (const BenchScenario& scenario : scenarios)
+        {
+            bool selected = filters.empty();
+            for (const string& f : filters)
+                selected |= string(scenario.Name).find(f) != string::npos;
+
+            if (selected)
+                results.push_back(_RunScenario(scenario, app, frames));
+        }
+    }
+    catch (exception& ex)
+    {
+        cout << "Unhandled error: " << ex.what() << endl;
+        return -1;
+    }
+
+    string table = _FormatResults(results);
+    cout << endl << table;
+
+    if (!csv_path.empty())
+    {
+        ofstream fout(csv_path, ios::out);
+        fout << table;
+        if (!fout.good())
+        {
+            LOG_ERROR("Failed to write %s", csv_path.c_str());
+            return -1;
+        }
+    }
+
+    return 0;
+}
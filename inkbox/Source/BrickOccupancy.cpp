@@ -0,0 +1,230 @@
+#include "BrickOccupancy.h"
+
+#include <vector>
+
+#include "Common.h"
+
+using namespace std;
+using namespace glm;
+
+// Offsets of the three indirect commands in dispatchBuffer, in uints. Same as brick_compact.comp.
+#define CELL_DISPATCH 0
+#define BRICK_DISPATCH 3
+#define RETIRE_DISPATCH 6
+#define DISPATCH_ARGS 9
+
+bool _InitBrickShader(const char* file, GLComputeShader& program, uvec3 local_size, const string& img_format)
+{
+    GLShader cs(file, ShaderType::Compute, local_size, img_format, { "SPARSE_BRICKS" });
+    if (!cs.Compile())
+        return false;
+
+    program.Init();
+    program.Attach(cs);
+    if (!program.Link())
+        return false;
+
+    program.Name = cs.FileName();
+    cs.Discard();
+    return true;
+}
+
+BrickOccupancy::BrickOccupancy()
+    : numBricks(0)
+    , groupsPerBrick(0)
+    , occupiedBuffer(0)
+    , activeBuffer(0)
+    , listBuffer(0)
+    , dispatchBuffer(0)
+    , readbackBuffer(0)
+    , readbackFence(nullptr)
+    , activeFraction(-1)
+{
+}
+
+BrickOccupancy::~BrickOccupancy()
+{
+    if (readbackFence)
+        glDeleteSync(readbackFence);
+
+    unsigned int buffers[] = { occupiedBuffer, activeBuffer, listBuffer, dispatchBuffer, readbackBuffer };
+    for (unsigned int buffer : buffers)
+    {
+        if (buffer != 0)
+        {
+            _GL_WRAP2(glDeleteBuffers, 1, &buffer);
+        }
+    }
+}
+
+bool BrickOccupancy::Init(uvec3 size, uvec3 local_size, const string& img_format)
+{
+    grid = size / uvec3(BRICK_SIDE);
+    uvec3 per_brick = uvec3(BRICK_SIDE) / local_size;
+    groupsPerBrick = per_brick.x * per_brick.y * per_brick.z;
+    compactWorkGroups = (grid + local_size - uvec3(1)) / local_size;
+
+    // The listed bricks go along x, so there can't be more of them than a dispatch allows
+    int max_groups = 0;
+    _GL_WRAP3(glGetIntegeri_v, GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+    if (grid.x * grid.y * grid.z > unsigned(max_groups))
+    {
+        LOG_WARN("Sparse bricks: %u bricks are more than one dispatch can take, simulating the whole volume", grid.x * grid.y * grid.z);
+        return true;
+    }
+
+    if (!_InitBrickShader("3d\\brick_activity.comp", activityShader, uvec3(BRICK_SIDE), img_format)
+        || !_InitBrickShader("3d\\brick_compact.comp", compactShader, local_size, img_format))
+        return false;
+
+    int num_bricks = grid.x * grid.y * grid.z;
+
+    _GL_WRAP2(glGenBuffers, 1, &occupiedBuffer);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, occupiedBuffer);
+    _GL_WRAP4(glBufferData, GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * num_bricks, nullptr, GL_DYNAMIC_COPY);
+
+    _GL_WRAP2(glGenBuffers, 1, &activeBuffer);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, activeBuffer);
+    _GL_WRAP4(glBufferData, GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * num_bricks, nullptr, GL_DYNAMIC_COPY);
+
+    _GL_WRAP2(glGenBuffers, 1, &listBuffer);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, listBuffer);
+    _GL_WRAP4(glBufferData, GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * num_bricks * 2, nullptr, GL_DYNAMIC_COPY);
+
+    _GL_WRAP2(glGenBuffers, 1, &dispatchBuffer);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, dispatchBuffer);
+    _GL_WRAP4(glBufferData, GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * DISPATCH_ARGS, nullptr, GL_DYNAMIC_COPY);
+
+    _GL_WRAP2(glGenBuffers, 1, &readbackBuffer);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, readbackBuffer);
+    _GL_WRAP4(glBufferData, GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_STREAM_READ);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, 0);
+
+    numBricks = num_bricks;
+    Reset();
+
+    LOG_INFO("Sparse bricks: %dx%dx%d bricks of %d cells", grid.x, grid.y, grid.z, BRICK_SIDE);
+    return true;
+}
+
+void BrickOccupancy::Reset()
+{
+    if (!IsActive())
+        return;
+
+    // Everything listed and flagged active, the next update retires whatever turns out empty and
+    // that clears it. Fields that were never written get cleaned up the same way.
+    vector<GLuint> list(numBricks);
+    for (int i = 0; i < numBricks; i++)
+    {
+        uvec3 b(i % grid.x, (i / grid.x) % grid.y, i / (grid.x * grid.y));
+        list[i] = b.x | (b.y << 10) | (b.z << 20);
+    }
+
+    vector<GLuint> active(numBricks, 1);
+    GLuint per_brick = GLuint(groupsPerBrick);
+    GLuint args[DISPATCH_ARGS] = { GLuint(numBricks), per_brick, 1, GLuint(numBricks), 1, 1, 0, per_brick, 1 };
+
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, listBuffer);
+    _GL_WRAP4(glBufferSubData, GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * numBricks, list.data());
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, activeBuffer);
+    _GL_WRAP4(glBufferSubData, GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * numBricks, active.data());
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, dispatchBuffer);
+    _GL_WRAP4(glBufferSubData, GL_SHADER_STORAGE_BUFFER, 0, sizeof(args), args);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void BrickOccupancy::Update(Texture& velocity, Texture& ink, float threshold, vec4 seed)
+{
+    PollCount();
+
+    // Empty bricks aren't looked at so their flags have to start at 0
+    GLuint zero = 0;
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, occupiedBuffer);
+    _GL_WRAP5(glClearBufferData, GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, 0);
+
+    activityShader.Use();
+    activityShader.SetFloat("threshold", threshold);
+    activityShader.SetImage("velocity_r", velocity, 0, GL_READ_ONLY);
+    activityShader.SetImage("ink_r", ink, 1, GL_READ_ONLY);
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, 0, occupiedBuffer);
+    DispatchBricks(activityShader);
+
+    // The list is rebuilt from scratch, the activity pass above was the last to use the old one
+    GLuint per_brick = GLuint(groupsPerBrick);
+    GLuint args[DISPATCH_ARGS] = { 0, per_brick, 1, 0, 1, 1, 0, per_brick, 1 };
+    _GL_WRAP1(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, dispatchBuffer);
+    _GL_WRAP4(glBufferSubData, GL_SHADER_STORAGE_BUFFER, 0, sizeof(args), args);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, 0);
+
+    compactShader.Use();
+    compactShader.SetVec3("grid_size", vec3(grid));
+    compactShader.SetVec4("seed", seed);
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, 0, occupiedBuffer);
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, 1, activeBuffer);
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, 2, dispatchBuffer);
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, BRICK_LIST_BINDING, listBuffer);
+    compactShader.Execute(compactWorkGroups);
+
+    // The list is read by the following passes, the arguments by their dispatches and the copy below
+    _GL_WRAP1(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // One count in flight at a time, it's only for display
+    if (!readbackFence)
+    {
+        _GL_WRAP2(glBindBuffer, GL_COPY_READ_BUFFER, dispatchBuffer);
+        _GL_WRAP2(glBindBuffer, GL_COPY_WRITE_BUFFER, readbackBuffer);
+        _GL_WRAP5(glCopyBufferSubData, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sizeof(GLuint) * BRICK_DISPATCH, 0, sizeof(GLuint));
+        _GL_WRAP2(glBindBuffer, GL_COPY_READ_BUFFER, 0);
+        _GL_WRAP2(glBindBuffer, GL_COPY_WRITE_BUFFER, 0);
+
+        readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        _GL_WRAP0(glFlush);
+    }
+}
+
+void BrickOccupancy::Dispatch(GLComputeShader& shader)
+{
+    Bind(shader, 0);
+    shader.ExecuteIndirect(dispatchBuffer, sizeof(GLuint) * CELL_DISPATCH);
+}
+
+void BrickOccupancy::DispatchBricks(GLComputeShader& shader)
+{
+    Bind(shader, 0);
+    shader.ExecuteIndirect(dispatchBuffer, sizeof(GLuint) * BRICK_DISPATCH);
+}
+
+void BrickOccupancy::DispatchRetired(GLComputeShader& shader)
+{
+    Bind(shader, numBricks);
+    shader.ExecuteIndirect(dispatchBuffer, sizeof(GLuint) * RETIRE_DISPATCH);
+}
+
+void BrickOccupancy::Bind(GLComputeShader& shader, int list_offset)
+{
+    shader.Use();
+    shader.SetInt("brick_list_offset", list_offset);
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, BRICK_LIST_BINDING, listBuffer);
+}
+
+void BrickOccupancy::PollCount()
+{
+    if (!readbackFence)
+        return;
+
+    GLenum status = glClientWaitSync(readbackFence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return;
+
+    GLuint count = 0;
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, readbackBuffer);
+    _GL_WRAP4(glGetBufferSubData, GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &count);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, 0);
+
+    glDeleteSync(readbackFence);
+    readbackFence = nullptr;
+    activeFraction = float(count) / numBricks;
+}
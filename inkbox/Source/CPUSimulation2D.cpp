@@ -0,0 +1,528 @@
+#include "CPUSimulation2D.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/geometric.hpp>
+#include <glm/vec4.hpp>
+
+#include "Common.h"
+#include "IniConfig.h"
+#include "Simd.h"
+
+using namespace std;
+using namespace glm;
+
+// Same clamp as add_vorticity.frag
+#define VORTICITY_EPSILON 0.00024414f
+
+CPUField2D::CPUField2D(int width, int height, int channels)
+    : size(width * height)
+    , channels(channels)
+    , front(0)
+{
+    buffers[0].resize(size * channels, 0.f);
+    buffers[1].resize(size * channels, 0.f);
+}
+
+void CPUField2D::Clear()
+{
+    fill(buffers[0].begin(), buffers[0].end(), 0.f);
+    fill(buffers[1].begin(), buffers[1].end(), 0.f);
+}
+
+// Runs a stencil over the interior cells of rows [y0, y1). The shaders only ever draw the inset
+// quad so the outermost ring of cells is left to the boundary pass, same as here.
+template<typename TVec, typename TScalar>
+inline void _ForInteriorRows(int width, int y0, int y1, TVec vec_op, TScalar scalar_op)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        int i = y * width + 1;
+        int row_end = y * width + width - 1;
+
+        for (; i + SIMD_WIDTH <= row_end; i += SIMD_WIDTH)
+            vec_op(i);
+
+        for (; i < row_end; i++)
+            scalar_op(i);
+    }
+}
+
+CPUSimulation2D::CPUSimulation2D(int width, int height, SimulationVars* vars, ImpulseState* impulse, int num_threads)
+    : width(width)
+    , height(height)
+    , vars(vars)
+    , impulse(impulse)
+    , pool(num_threads)
+    , velocity(width, height, 2)
+    , ink(width, height, 3)
+    , pressure(width, height, 1)
+    , vorticity(width, height, 1)
+    , divergence(width, height, 1)
+    , temp(width, height, 3)
+{
+    LOG_INFO("CPU backend: %dx%d on %d threads, %d-wide SIMD", width, height, pool.NumThreads(), SIMD_WIDTH);
+}
+
+void CPUSimulation2D::ClearFields()
+{
+    velocity.Clear();
+    ink.Clear();
+    pressure.Clear();
+    vorticity.Clear();
+    divergence.Clear();
+    temp.Clear();
+}
+
+void CPUSimulation2D::ComputeFields(float delta_t, float frame_fraction)
+{
+    if (!vars->SelfAdvect && !vars->AdvectInk && !vars->DiffuseVelocity && !vars->AddVorticity)
+        return;
+
+    if (vars->SelfAdvect)
+    {
+        ComputeBoundaryValues(velocity, -1);
+        Advect(velocity, pow(vars->AdvectionDissipation, frame_fraction), delta_t);
+    }
+
+    if (vars->AdvectInk)
+    {
+        ComputeBoundaryValues(ink, 0);
+        Advect(ink, pow(vars->InkAdvectionDissipation, frame_fraction), delta_t);
+    }
+
+    if (impulse->IsActive())
+    {
+        auto diff = impulse->Delta;
+        vec3 force(min(max(diff.x, -vars->GridScale), vars->GridScale),
+                   min(max(diff.y, -vars->GridScale), vars->GridScale),
+                   0);
+
+        vec2 position = vec2(impulse->CurrentPos.x / width, impulse->CurrentPos.y / height);
+        AddImpulse(velocity, position, force, vars->SplatRadius, impulse->Radial);
+
+        if (impulse->InkActive)
+        {
+            AddImpulse(ink, position, vec3(impulse->Colour), vars->InkVolume, false);
+        }
+    }
+
+    if (vars->AddVorticity)
+    {
+        ComputeVorticity();
+        ComputeBoundaryValues(velocity, -1);
+        AddVorticity();
+    }
+
+    if (vars->DiffuseVelocity)
+    {
+        float alpha = (vars->GridScale * vars->GridScale) / (vars->Viscosity * delta_t);
+        stats.DiffusionIterations = SolvePoissonSystem(velocity, velocity, alpha, alpha + 4.0f, stats.Diffusion);
+    }
+
+    if (vars->DiffuseInk)
+    {
+        float alpha = (vars->GridScale * vars->GridScale) / (vars->InkViscosity * delta_t);
+        ResidualNorms norms;
+        SolvePoissonSystem(ink, ink, alpha, alpha + 4.0f, norms);
+    }
+
+    ComputeDivergence();
+    if (!IniConfig::Get().PressureWarmStart)
+        pressure.Clear();
+
+    if (vars->PressureSolver == PressureSolverType::FFT && !vars->BoundariesEnabled && FFTPoissonSolver::Supports(ivec3(width, height, 1)))
+        stats.PressureIterations = SolvePoissonFFT(pressure, divergence, -vars->GridScale * vars->GridScale, 4.0f, stats.Pressure);
+    else
+        stats.PressureIterations = SolvePoissonSystem(pressure, divergence, -vars->GridScale * vars->GridScale, 4.0f, stats.Pressure);
+    SubtractPressureGradient();
+
+    ComputeBoundaryValues(velocity, -1);
+
+    if (IniConfig::Get().AdaptiveTimestep)
+        stats.MaxSpeed = MeasureMaxSpeed();
+}
+
+void CPUSimulation2D::ComputeBoundaryValues(CPUField2D& field, float scale)
+{
+    if (!vars->BoundariesEnabled)
+        return;
+
+    // Each edge takes the scaled value of the cell next to it
+    for (int c = 0; c < field.Channels(); c++)
+    {
+        float* f = field.Front(c);
+
+        for (int x = 0; x < width; x++)
+        {
+            f[x] = scale * f[width + x];
+            f[(height - 1) * width + x] = scale * f[(height - 2) * width + x];
+        }
+
+        for (int y = 0; y < height; y++)
+        {
+            f[y * width] = scale * f[y * width + 1];
+            f[y * width + width - 1] = scale * f[y * width + width - 2];
+        }
+    }
+}
+
+float CPUSimulation2D::Sample(const float* plane, float x, float y) const
+{
+    // Bilinear with clamp-to-edge, x and y are in texels with cell centers on integers
+    x = min(max(x, -1.f), float(width));
+    y = min(max(y, -1.f), float(height));
+
+    float fx0 = floor(x);
+    float fy0 = floor(y);
+    float tx = x - fx0;
+    float ty = y - fy0;
+
+    int x0 = min(max(int(fx0), 0), width - 1);
+    int x1 = min(max(int(fx0) + 1, 0), width - 1);
+    int y0 = min(max(int(fy0), 0), height - 1);
+    int y1 = min(max(int(fy0) + 1, 0), height - 1);
+
+    float bottom = plane[y0 * width + x0] + tx * (plane[y0 * width + x1] - plane[y0 * width + x0]);
+    float top = plane[y1 * width + x0] + tx * (plane[y1 * width + x1] - plane[y1 * width + x0]);
+    return bottom + ty * (top - bottom);
+}
+
+void CPUSimulation2D::Advect(CPUField2D& quantity, float dissipation, float delta_t)
+{
+    // Back-trace in texture coordinates like advection.frag, then convert to texels
+    float step_x = delta_t * vars->GridScale * width;
+    float step_y = delta_t * vars->GridScale * height;
+
+    const float* u = velocity.Front(0);
+    const float* v = velocity.Front(1);
+
+    pool.ParallelFor(1, height - 1, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = 1; x < width - 1; x++)
+            {
+                int i = y * width + x;
+                float sx = x - step_x * u[i];
+                float sy = y - step_y * v[i];
+
+                for (int c = 0; c < quantity.Channels(); c++)
+                    quantity.Back(c)[i] = dissipation * Sample(quantity.Front(c), sx, sy);
+            }
+        }
+    });
+
+    quantity.Swap();
+}
+
+void CPUSimulation2D::AddImpulse(CPUField2D& field, vec2 position, vec3 force, float radius, bool radial)
+{
+    pool.ParallelFor(1, height - 1, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = 1; x < width - 1; x++)
+            {
+                int i = y * width + x;
+                vec2 diff = position - vec2((x + 0.5f) / width, (y + 0.5f) / height);
+                float falloff = exp(-dot(diff, diff) / radius);
+
+                vec3 effect = force * falloff;
+                if (radial)
+                {
+                    float len = length(diff);
+                    effect = len > 0 ? vec3(diff / len, 0) * falloff : vec3(0);
+                }
+
+                for (int c = 0; c < field.Channels(); c++)
+                    field.Back(c)[i] = field.Front(c)[i] + effect[c];
+            }
+        }
+    });
+
+    field.Swap();
+}
+
+void CPUSimulation2D::ComputeVorticity()
+{
+    const float* u = velocity.Front(0);
+    const float* v = velocity.Front(1);
+    float* out = vorticity.Front(0);
+    int w = width;
+    float inv_2gs = 1.f / (2 * vars->GridScale);
+
+    pool.ParallelFor(1, height - 1, [&](int y0, int y1) {
+        simd_t s = SIMD_SET1(inv_2gs);
+        _ForInteriorRows(w, y0, y1,
+            [&](int i) {
+                simd_t dv = SIMD_SUB(SIMD_LOAD(v + i + 1), SIMD_LOAD(v + i - 1));
+                simd_t du = SIMD_SUB(SIMD_LOAD(u + i + w), SIMD_LOAD(u + i - w));
+                SIMD_STORE(out + i, SIMD_MUL(SIMD_SUB(dv, du), s));
+            },
+            [&](int i) {
+                out[i] = ((v[i + 1] - v[i - 1]) - (u[i + w] - u[i - w])) * inv_2gs;
+            });
+    });
+}
+
+void CPUSimulation2D::AddVorticity()
+{
+    const float* u = velocity.Front(0);
+    const float* v = velocity.Front(1);
+    const float* vort = vorticity.Front(0);
+    float* out_u = velocity.Back(0);
+    float* out_v = velocity.Back(1);
+    int w = width;
+    float inv_2gs = 1.f / (2 * vars->GridScale);
+    float scale = vars->Vorticity;
+
+    pool.ParallelFor(1, height - 1, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = 1; x < width - 1; x++)
+            {
+                int i = y * w + x;
+                vec2 force = vec2(abs(vort[i + w]) - abs(vort[i - w]), abs(vort[i + 1]) - abs(vort[i - 1])) * inv_2gs;
+                force /= sqrt(max(VORTICITY_EPSILON, dot(force, force)));
+                force *= scale * vort[i] * vec2(1, -1);
+
+                // The shader is run with delta_t = 1
+                out_u[i] = u[i] + force.x;
+                out_v[i] = v[i] + force.y;
+            }
+        }
+    });
+
+    velocity.Swap();
+}
+
+int CPUSimulation2D::SolvePoissonSystem(CPUField2D& x, CPUField2D& b, float alpha, float beta, ResidualNorms& norms)
+{
+    // Keep b separate from x, solving a field in place uses its starting value as b
+    CPUField2D* rhs = &b;
+    if (&x == &b)
+    {
+        for (int c = 0; c < x.Channels(); c++)
+            memcpy(temp.Front(c), x.Front(c), sizeof(float) * width * height);
+
+        rhs = &temp;
+    }
+
+    float tolerance = IniConfig::Get().ResidualTolerance;
+    if (tolerance <= 0)
+    {
+        RelaxPoissonSystem(x, *rhs, alpha, beta, NUM_JACOBI_ROUNDS & (~0x1));
+        return NUM_JACOBI_ROUNDS & (~0x1);
+    }
+
+    // No readback latency on the CPU so the residual is always current
+    int interval = max(IniConfig::Get().ResidualCheckInterval, 1);
+    int max_iterations = IniConfig::Get().MaxJacobiIterations;
+    int iterations = 0;
+
+    while (iterations < max_iterations)
+    {
+        int n = min(interval, max_iterations - iterations);
+        RelaxPoissonSystem(x, *rhs, alpha, beta, n);
+        iterations += n;
+
+        norms = MeasureResidual(x, *rhs, alpha, beta);
+        if (norms.L2 <= tolerance)
+            break;
+    }
+
+    return iterations;
+}
+
+// One direct solve over the whole grid, ring included, with the edges wrapping around. Counts as
+// one iteration in the stats.
+int CPUSimulation2D::SolvePoissonFFT(CPUField2D& x, CPUField2D& b, float alpha, float beta, ResidualNorms& norms)
+{
+    if (!fftSolver)
+        fftSolver = make_unique<FFTPoissonSolver>(ivec3(width, height, 1));
+
+    for (int c = 0; c < x.Channels(); c++)
+        fftSolver->Solve(b.Front(c), x.Front(c), alpha, beta, pool);
+
+    if (IniConfig::Get().ResidualTolerance > 0)
+        norms = MeasureResidual(x, b, alpha, beta);
+
+    return 1;
+}
+
+void CPUSimulation2D::RelaxPoissonSystem(CPUField2D& x, CPUField2D& b, float alpha, float beta, int iterations)
+{
+    int w = width;
+    float rbeta = 1.f / beta;
+
+    for (int iter = 0; iter < iterations; iter++)
+    {
+        for (int c = 0; c < x.Channels(); c++)
+        {
+            const float* in = x.Front(c);
+            const float* bc = b.Front(c);
+            float* out = x.Back(c);
+
+            pool.ParallelFor(1, height - 1, [&](int y0, int y1) {
+                simd_t a = SIMD_SET1(alpha);
+                simd_t rb = SIMD_SET1(rbeta);
+                _ForInteriorRows(w, y0, y1,
+                    [&](int i) {
+                        simd_t sum = SIMD_ADD(SIMD_ADD(SIMD_LOAD(in + i - 1), SIMD_LOAD(in + i + 1)),
+                                              SIMD_ADD(SIMD_LOAD(in + i - w), SIMD_LOAD(in + i + w)));
+                        sum = SIMD_ADD(sum, SIMD_MUL(a, SIMD_LOAD(bc + i)));
+                        SIMD_STORE(out + i, SIMD_MUL(sum, rb));
+                    },
+                    [&](int i) {
+                        out[i] = (in[i - 1] + in[i + 1] + in[i - w] + in[i + w] + alpha * bc[i]) * rbeta;
+                    });
+            });
+        }
+
+        x.Swap();
+    }
+}
+
+// Back-trace distance in cells per unit of delta_t of the fastest cell, see Advect
+float CPUSimulation2D::MeasureMaxSpeed()
+{
+    vector<float> row_maxes(height, 0.f);
+    const float* u = velocity.Front(0);
+    const float* v = velocity.Front(1);
+
+    pool.ParallelFor(0, height, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            float row_max = 0;
+            for (int i = y * width; i < (y + 1) * width; i++)
+                row_max = max(row_max, u[i] * u[i] + v[i] * v[i]);
+
+            row_maxes[y] = row_max;
+        }
+    });
+
+    float max_sq = *max_element(row_maxes.begin(), row_maxes.end());
+    return vars->GridScale * max(width, height) * sqrt(max_sq);
+}
+
+ResidualNorms CPUSimulation2D::MeasurePressureResidual()
+{
+    return MeasureResidual(pressure, divergence, -vars->GridScale * vars->GridScale, 4.0f);
+}
+
+ResidualNorms CPUSimulation2D::MeasureResidual(CPUField2D& x, CPUField2D& b, float alpha, float beta)
+{
+    // Same residual as residual_norm.comp but over the interior cells only. Partials are kept per
+    // row and summed in order so the result doesn't depend on which thread finished first.
+    int w = width;
+    vector<double> row_sums(height, 0.0);
+    vector<float> row_maxes(height, 0.f);
+
+    pool.ParallelFor(1, height - 1, [&](int y0, int y1) {
+        for (int y = y0; y < y1; y++)
+        {
+            double row_sum = 0;
+            float row_max = 0;
+
+            for (int c = 0; c < x.Channels(); c++)
+            {
+                const float* xc = x.Front(c);
+                const float* bc = b.Front(c);
+
+                for (int i = y * w + 1; i < y * w + w - 1; i++)
+                {
+                    float r = bc[i] - (beta * xc[i] - (xc[i - 1] + xc[i + 1] + xc[i - w] + xc[i + w])) / alpha;
+                    row_sum += r * r;
+                    row_max = max(row_max, abs(r));
+                }
+            }
+
+            row_sums[y] = row_sum;
+            row_maxes[y] = row_max;
+        }
+    });
+
+    double sum_sq = 0;
+    float max_abs = 0;
+    for (int y = 1; y < height - 1; y++)
+    {
+        sum_sq += row_sums[y];
+        max_abs = max(max_abs, row_maxes[y]);
+    }
+
+    ResidualNorms norms;
+    norms.L2 = float(sqrt(sum_sq / (double(width - 2) * (height - 2))));
+    norms.Max = max_abs;
+    return norms;
+}
+
+void CPUSimulation2D::ComputeDivergence()
+{
+    const float* u = velocity.Front(0);
+    const float* v = velocity.Front(1);
+    float* out = divergence.Front(0);
+    int w = width;
+    float inv_2gs = 1.f / (2 * vars->GridScale);
+
+    pool.ParallelFor(1, height - 1, [&](int y0, int y1) {
+        simd_t s = SIMD_SET1(inv_2gs);
+        _ForInteriorRows(w, y0, y1,
+            [&](int i) {
+                simd_t du = SIMD_SUB(SIMD_LOAD(u + i + 1), SIMD_LOAD(u + i - 1));
+                simd_t dv = SIMD_SUB(SIMD_LOAD(v + i + w), SIMD_LOAD(v + i - w));
+                SIMD_STORE(out + i, SIMD_MUL(SIMD_ADD(du, dv), s));
+            },
+            [&](int i) {
+                out[i] = ((u[i + 1] - u[i - 1]) + (v[i + w] - v[i - w])) * inv_2gs;
+            });
+    });
+}
+
+void CPUSimulation2D::SubtractPressureGradient()
+{
+    // gradient.frag and subtract.frag in one pass
+    const float* p = pressure.Front(0);
+    const float* u = velocity.Front(0);
+    const float* v = velocity.Front(1);
+    float* out_u = velocity.Back(0);
+    float* out_v = velocity.Back(1);
+    int w = width;
+    float inv_2gs = 1.f / (2 * vars->GridScale);
+
+    pool.ParallelFor(1, height - 1, [&](int y0, int y1) {
+        simd_t s = SIMD_SET1(inv_2gs);
+        _ForInteriorRows(w, y0, y1,
+            [&](int i) {
+                simd_t gx = SIMD_MUL(SIMD_SUB(SIMD_LOAD(p + i + 1), SIMD_LOAD(p + i - 1)), s);
+                simd_t gy = SIMD_MUL(SIMD_SUB(SIMD_LOAD(p + i + w), SIMD_LOAD(p + i - w)), s);
+                SIMD_STORE(out_u + i, SIMD_SUB(SIMD_LOAD(u + i), gx));
+                SIMD_STORE(out_v + i, SIMD_SUB(SIMD_LOAD(v + i), gy));
+            },
+            [&](int i) {
+                out_u[i] = u[i] - (p[i + 1] - p[i - 1]) * inv_2gs;
+                out_v[i] = v[i] - (p[i + w] - p[i - w]) * inv_2gs;
+            });
+    });
+
+    velocity.Swap();
+}
+
+void CPUSimulation2D::ReadField(SimulationField field, float* rgb)
+{
+    CPUField2D* src = &ink;
+    if (field == SimulationField::Velocity)
+        src = &velocity;
+    else if (field == SimulationField::Pressure)
+        src = &pressure;
+    else if (field == SimulationField::Vorticity)
+        src = &vorticity;
+
+    int size = width * height;
+    for (int c = 0; c < 3; c++)
+    {
+        const float* plane = c < src->Channels() ? src->Front(c) : nullptr;
+        for (int i = 0; i < size; i++)
+            rgb[i * 3 + c] = plane ? plane[i] : 0.f;
+    }
+}
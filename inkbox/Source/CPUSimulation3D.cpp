@@ -0,0 +1,598 @@
+#include "CPUSimulation3D.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <glm/geometric.hpp>
+
+#include "Common.h"
+#include "IniConfig.h"
+#include "Simd.h"
+
+using namespace std;
+using namespace glm;
+
+// Same threshold as advection.comp
+#define SPEED_THRESHOLD 0.0001f
+
+static_assert(BRICK_SIDE % SIMD_WIDTH == 0, "Brick rows must be a whole number of SIMD vectors");
+
+uint64_t _MortonCode(ivec3 c)
+{
+    uint64_t code = 0;
+    for (int bit = 0; bit < 21; bit++)
+    {
+        code |= uint64_t((c.x >> bit) & 1) << (3 * bit);
+        code |= uint64_t((c.y >> bit) & 1) << (3 * bit + 1);
+        code |= uint64_t((c.z >> bit) & 1) << (3 * bit + 2);
+    }
+
+    return code;
+}
+
+// sign(d) * step(SPEED_THRESHOLD, abs(d)) from advection.comp
+inline int _GridClamp(float d)
+{
+    return d >= SPEED_THRESHOLD ? 1 : (d <= -SPEED_THRESHOLD ? -1 : 0);
+}
+
+// Runs op(i, h) over every cell of the brick starting at storage index base, a SIMD vector of
+// cells at a time. i is the storage index and h the matching index in a GatherHalo block.
+template<typename TOp>
+inline void _ForBrickRows(int base, TOp op)
+{
+    for (int z = 0; z < BRICK_SIDE; z++)
+    {
+        for (int y = 0; y < BRICK_SIDE; y++)
+        {
+            int i = base + (z * BRICK_SIDE + y) * BRICK_SIDE;
+            int h = ((z + 1) * HALO_SIDE + y + 1) * HALO_SIDE + 1;
+
+            for (int x = 0; x < BRICK_SIDE; x += SIMD_WIDTH)
+                op(i + x, h + x);
+        }
+    }
+}
+
+BrickLayout::BrickLayout(int width, int height, int depth)
+    : size(width, height, depth)
+{
+    if (width <= 0 || height <= 0 || depth <= 0 || width % BRICK_SIDE || height % BRICK_SIDE || depth % BRICK_SIDE)
+        throw runtime_error("CPU 3D backend needs dimensions that are a multiple of 8");
+
+    bricks = size / BRICK_SIDE;
+
+    for (int z = 0; z < bricks.z; z++)
+        for (int y = 0; y < bricks.y; y++)
+            for (int x = 0; x < bricks.x; x++)
+                slotCoords.push_back(ivec3(x, y, z));
+
+    sort(slotCoords.begin(), slotCoords.end(), [](const ivec3& a, const ivec3& b) {
+        return _MortonCode(a) < _MortonCode(b);
+    });
+
+    brickSlots.resize(slotCoords.size());
+    for (int slot = 0; slot < NumBricks(); slot++)
+    {
+        ivec3 c = slotCoords[slot];
+        brickSlots[c.x + bricks.x * (c.y + bricks.y * c.z)] = slot;
+    }
+}
+
+int BrickLayout::Index(int x, int y, int z) const
+{
+    int slot = brickSlots[x / BRICK_SIDE + bricks.x * (y / BRICK_SIDE + bricks.y * (z / BRICK_SIDE))];
+    return slot * BRICK_CELLS + ((z % BRICK_SIDE) * BRICK_SIDE + y % BRICK_SIDE) * BRICK_SIDE + x % BRICK_SIDE;
+}
+
+void BrickLayout::ToLinear(const float* plane, int slot, float* linear) const
+{
+    ivec3 origin = BrickOrigin(slot);
+    const float* src = plane + slot * BRICK_CELLS;
+
+    for (int z = 0; z < BRICK_SIDE; z++)
+        for (int y = 0; y < BRICK_SIDE; y++, src += BRICK_SIDE)
+            memcpy(linear + (size_t(origin.z + z) * size.y + origin.y + y) * size.x + origin.x, src, sizeof(float) * BRICK_SIDE);
+}
+
+void BrickLayout::FromLinear(const float* linear, int slot, float* plane) const
+{
+    ivec3 origin = BrickOrigin(slot);
+    float* dst = plane + slot * BRICK_CELLS;
+
+    for (int z = 0; z < BRICK_SIDE; z++)
+        for (int y = 0; y < BRICK_SIDE; y++, dst += BRICK_SIDE)
+            memcpy(dst, linear + (size_t(origin.z + z) * size.y + origin.y + y) * size.x + origin.x, sizeof(float) * BRICK_SIDE);
+}
+
+void BrickLayout::GatherHalo(const float* plane, int slot, float* halo) const
+{
+    // Per axis and halo coordinate: which brick to read from relative to this one and the cell
+    // within it. Past the far side the offset is 2 and the cell reads as 0.
+    ivec3 brick = slotCoords[slot];
+    int offsets[3][HALO_SIDE];
+    int cells[3][HALO_SIDE];
+
+    for (int a = 0; a < 3; a++)
+    {
+        for (int h = 0; h < HALO_SIDE; h++)
+        {
+            offsets[a][h] = 0;
+            cells[a][h] = h - 1;
+        }
+
+        offsets[a][0] = brick[a] > 0 ? -1 : 0;
+        cells[a][0] = brick[a] > 0 ? BRICK_SIDE - 1 : 0;
+        offsets[a][HALO_SIDE - 1] = brick[a] + 1 < bricks[a] ? 1 : 2;
+        cells[a][HALO_SIDE - 1] = 0;
+    }
+
+    // Slots of the 3x3x3 block of bricks around this one, indexed [z][y][x] with 1 as the centre
+    int neighbours[3][3][3];
+    for (int z = 0; z < 3; z++)
+        for (int y = 0; y < 3; y++)
+            for (int x = 0; x < 3; x++)
+            {
+                ivec3 b = clamp(brick + ivec3(x, y, z) - 1, ivec3(0), bricks - 1);
+                neighbours[z][y][x] = brickSlots[b.x + bricks.x * (b.y + bricks.y * b.z)];
+            }
+
+    for (int hz = 0; hz < HALO_SIDE; hz++)
+    {
+        for (int hy = 0; hy < HALO_SIDE; hy++)
+        {
+            float* row = halo + (hz * HALO_SIDE + hy) * HALO_SIDE;
+            int oy = offsets[1][hy];
+            int oz = offsets[2][hz];
+
+            if (oy == 2 || oz == 2)
+            {
+                fill(row, row + HALO_SIDE, 0.f);
+                continue;
+            }
+
+            const int* slots = neighbours[oz + 1][oy + 1];
+            const float* src = plane + (cells[2][hz] * BRICK_SIDE + cells[1][hy]) * BRICK_SIDE;
+            memcpy(row + 1, src + slots[1] * BRICK_CELLS, sizeof(float) * BRICK_SIDE);
+
+            row[0] = src[slots[1 + offsets[0][0]] * BRICK_CELLS + cells[0][0]];
+            row[HALO_SIDE - 1] = offsets[0][HALO_SIDE - 1] == 2 ? 0.f : src[slots[2] * BRICK_CELLS];
+        }
+    }
+}
+
+CPUField3D::CPUField3D(const BrickLayout& layout, int channels)
+    : size(layout.NumCells())
+    , channels(channels)
+    , front(0)
+{
+    buffers[0].resize(size_t(size) * channels, 0.f);
+    buffers[1].resize(size_t(size) * channels, 0.f);
+}
+
+void CPUField3D::Clear()
+{
+    fill(buffers[0].begin(), buffers[0].end(), 0.f);
+    fill(buffers[1].begin(), buffers[1].end(), 0.f);
+}
+
+CPUSimulation3D::CPUSimulation3D(int width, int height, int depth, SimulationVars* vars, ImpulseState* impulse, int num_threads)
+    : layout(width, height, depth)
+    , vars(vars)
+    , impulse(impulse)
+    , pool(num_threads)
+    , velocity(layout, 3)
+    , ink(layout, 4)
+    , pressure(layout, 1)
+    , divergence(layout, 1)
+    , temp(layout, 4)
+{
+    LOG_INFO("CPU backend: %dx%dx%d in %d bricks on %d threads, %d-wide SIMD", width, height, depth, layout.NumBricks(), pool.NumThreads(), SIMD_WIDTH);
+}
+
+void CPUSimulation3D::ClearFields()
+{
+    velocity.Clear();
+    ink.Clear();
+    pressure.Clear();
+    divergence.Clear();
+    temp.Clear();
+}
+
+void CPUSimulation3D::ComputeFields(float delta_t, float frame_fraction)
+{
+    if (vars->AdvectInk)
+        Advect(ink, pow(0.99f, frame_fraction), 0, delta_t);
+
+    if (vars->SelfAdvect)
+        Advect(velocity, pow(0.98f, frame_fraction), vars->Gravity * frame_fraction, delta_t);
+
+    if (impulse->ForceActive)
+    {
+        AddImpulse(velocity, impulse->CurrentPos, vec4(impulse->Delta, 0), vars->SplatRadius);
+        impulse->ForceActive = false;
+    }
+
+    if (impulse->InkActive)
+    {
+        AddImpulse(ink, impulse->CurrentPos, impulse->Colour, vars->InkVolume);
+        impulse->InkActive = false;
+    }
+
+    if (vars->DiffuseVelocity)
+    {
+        float alpha = (vars->GridScale * vars->GridScale) / (vars->Viscosity * delta_t);
+        stats.DiffusionIterations = SolvePoissonSystem(velocity, velocity, alpha, alpha + 6.0f, stats.Diffusion);
+    }
+
+    if (vars->DiffuseInk)
+    {
+        float alpha = (vars->GridScale * vars->GridScale) / (vars->InkViscosity * delta_t);
+        ResidualNorms norms;
+        SolvePoissonSystem(ink, ink, alpha, alpha + 6.0f, norms);
+    }
+
+    // Laplacian(P) = div(W) with the Laplacian's 1/gs^2 folded into alpha, like the shaders
+    ComputeDivergence();
+    if (!IniConfig::Get().PressureWarmStart)
+        pressure.Clear();
+
+    if (vars->PressureSolver == PressureSolverType::FFT && !vars->BoundariesEnabled && FFTPoissonSolver::Supports(layout.Size()))
+        stats.PressureIterations = SolvePoissonFFT(pressure, divergence, -vars->GridScale * vars->GridScale, 6.0f, stats.Pressure);
+    else
+        stats.PressureIterations = SolvePoissonSystem(pressure, divergence, -vars->GridScale * vars->GridScale, 6.0f, stats.Pressure);
+    SubtractPressureGradient();
+
+    if (vars->BoundariesEnabled)
+    {
+        ComputeBoundaryValues(velocity, -1);
+        ComputeBoundaryValues(ink, 0);
+    }
+
+    if (IniConfig::Get().AdaptiveTimestep)
+        stats.MaxSpeed = MeasureMaxSpeed();
+}
+
+void CPUSimulation3D::Advect(CPUField3D& quantity, float dissipation, float gravity, float delta_t)
+{
+    // Nearest cell back-trace of at most one cell per axis, like advection.comp. That keeps the
+    // source cell inside the halo so the brick never has to look any further.
+    float step = delta_t * vars->GridScale;
+    const float* u = velocity.Front(0);
+    const float* v = velocity.Front(1);
+    const float* w = velocity.Front(2);
+
+    pool.ParallelForEach(layout.NumBricks(), [&](int slot) {
+        int sources[BRICK_CELLS];
+        float halo[HALO_CELLS];
+        int base = slot * BRICK_CELLS;
+
+        for (int z = 0, n = 0; z < BRICK_SIDE; z++)
+        {
+            for (int y = 0; y < BRICK_SIDE; y++)
+            {
+                for (int x = 0; x < BRICK_SIDE; x++, n++)
+                {
+                    int i = base + n;
+                    int h = ((z + 1) * HALO_SIDE + y + 1) * HALO_SIDE + x + 1;
+                    sources[n] = h - _GridClamp(step * u[i]) - _GridClamp(step * v[i]) * HALO_SIDE - _GridClamp(step * w[i]) * HALO_SIDE * HALO_SIDE;
+                }
+            }
+        }
+
+        for (int c = 0; c < quantity.Channels(); c++)
+        {
+            layout.GatherHalo(quantity.Front(c), slot, halo);
+
+            float* out = quantity.Back(c) + base;
+            float add = c == 1 ? -gravity : 0.f;
+
+            for (int n = 0; n < BRICK_CELLS; n++)
+                out[n] = dissipation * halo[sources[n]] + add;
+        }
+    });
+
+    quantity.Swap();
+}
+
+void CPUSimulation3D::AddImpulse(CPUField3D& field, vec3 position, vec4 force, float radius)
+{
+    pool.ParallelForEach(layout.NumBricks(), [&](int slot) {
+        ivec3 origin = layout.BrickOrigin(slot);
+        int i = slot * BRICK_CELLS;
+
+        for (int z = 0; z < BRICK_SIDE; z++)
+        {
+            for (int y = 0; y < BRICK_SIDE; y++)
+            {
+                for (int x = 0; x < BRICK_SIDE; x++, i++)
+                {
+                    vec3 diff = position - vec3(origin + ivec3(x, y, z));
+                    float falloff = exp(-dot(diff, diff) / radius);
+
+                    for (int c = 0; c < field.Channels(); c++)
+                        field.Front(c)[i] += force[c] * falloff;
+                }
+            }
+        }
+    });
+}
+
+int CPUSimulation3D::SolvePoissonSystem(CPUField3D& x, CPUField3D& b, float alpha, float beta, ResidualNorms& norms)
+{
+    // Keep b separate from x, solving a field in place uses its starting value as b
+    CPUField3D* rhs = &b;
+    if (&x == &b)
+    {
+        for (int c = 0; c < x.Channels(); c++)
+            memcpy(temp.Front(c), x.Front(c), sizeof(float) * layout.NumCells());
+
+        rhs = &temp;
+    }
+
+    float tolerance = IniConfig::Get().ResidualTolerance;
+    if (tolerance <= 0)
+    {
+        int iterations = IniConfig::Get().NumJacobiIterations;
+        RelaxPoissonSystem(x, *rhs, alpha, beta, iterations);
+        return iterations;
+    }
+
+    // No readback latency on the CPU so the residual is always current
+    int interval = max(IniConfig::Get().ResidualCheckInterval, 1);
+    int max_iterations = IniConfig::Get().MaxJacobiIterations;
+    int iterations = 0;
+
+    while (iterations < max_iterations)
+    {
+        int n = min(interval, max_iterations - iterations);
+        RelaxPoissonSystem(x, *rhs, alpha, beta, n);
+        iterations += n;
+
+        norms = MeasureResidual(x, *rhs, alpha, beta);
+        if (norms.L2 <= tolerance)
+            break;
+    }
+
+    return iterations;
+}
+
+// One direct solve with the volume wrapping around at the edges, so the residual measured with
+// the clamped stencils isn't 0 along the sides. The FFT works on linear arrays, the bricks are
+// copied out and back in. Counts as one iteration in the stats.
+int CPUSimulation3D::SolvePoissonFFT(CPUField3D& x, CPUField3D& b, float alpha, float beta, ResidualNorms& norms)
+{
+    if (!fftSolver)
+    {
+        fftSolver = make_unique<FFTPoissonSolver>(layout.Size());
+        fftBuffer.resize(layout.NumCells());
+    }
+
+    for (int c = 0; c < x.Channels(); c++)
+    {
+        const float* bc = b.Front(c);
+        float* xc = x.Front(c);
+
+        pool.ParallelForEach(layout.NumBricks(), [&](int slot) { layout.ToLinear(bc, slot, fftBuffer.data()); });
+        fftSolver->Solve(fftBuffer.data(), fftBuffer.data(), alpha, beta, pool);
+        pool.ParallelForEach(layout.NumBricks(), [&](int slot) { layout.FromLinear(fftBuffer.data(), slot, xc); });
+    }
+
+    if (IniConfig::Get().ResidualTolerance > 0)
+        norms = MeasureResidual(x, b, alpha, beta);
+
+    return 1;
+}
+
+void CPUSimulation3D::RelaxPoissonSystem(CPUField3D& x, CPUField3D& b, float alpha, float beta, int iterations)
+{
+    float rbeta = 1.f / beta;
+
+    for (int iter = 0; iter < iterations; iter++)
+    {
+        pool.ParallelForEach(layout.NumBricks(), [&](int slot) {
+            float halo[HALO_CELLS];
+            simd_t a = SIMD_SET1(alpha);
+            simd_t rb = SIMD_SET1(rbeta);
+
+            for (int c = 0; c < x.Channels(); c++)
+            {
+                const float* bc = b.Front(c);
+                float* out = x.Back(c);
+                layout.GatherHalo(x.Front(c), slot, halo);
+
+                _ForBrickRows(slot * BRICK_CELLS, [&](int i, int h) {
+                    simd_t sum = SIMD_ADD(SIMD_ADD(SIMD_LOAD(halo + h - 1), SIMD_LOAD(halo + h + 1)),
+                                          SIMD_ADD(SIMD_LOAD(halo + h - HALO_SIDE), SIMD_LOAD(halo + h + HALO_SIDE)));
+                    sum = SIMD_ADD(sum, SIMD_ADD(SIMD_LOAD(halo + h - HALO_SIDE * HALO_SIDE), SIMD_LOAD(halo + h + HALO_SIDE * HALO_SIDE)));
+                    sum = SIMD_ADD(sum, SIMD_MUL(a, SIMD_LOAD(bc + i)));
+                    SIMD_STORE(out + i, SIMD_MUL(sum, rb));
+                });
+            }
+        });
+
+        x.Swap();
+    }
+}
+
+ResidualNorms CPUSimulation3D::MeasurePressureResidual()
+{
+    return MeasureResidual(pressure, divergence, -vars->GridScale * vars->GridScale, 6.0f);
+}
+
+ResidualNorms CPUSimulation3D::MeasureResidual(CPUField3D& x, CPUField3D& b, float alpha, float beta)
+{
+    // Same residual as residual.comp, one partial per brick so the sum doesn't depend on timing
+    vector<double> sums(layout.NumBricks());
+    vector<float> maxes(layout.NumBricks());
+
+    pool.ParallelForEach(layout.NumBricks(), [&](int slot) {
+        float halo[HALO_CELLS];
+        double brick_sum = 0;
+        float brick_max = 0;
+
+        for (int c = 0; c < x.Channels(); c++)
+        {
+            const float* bc = b.Front(c) + slot * BRICK_CELLS;
+            layout.GatherHalo(x.Front(c), slot, halo);
+
+            _ForBrickRows(0, [&](int i, int h) {
+                for (int k = 0; k < SIMD_WIDTH; k++)
+                {
+                    const float* hk = halo + h + k;
+                    float sum = hk[-1] + hk[1] + hk[-HALO_SIDE] + hk[HALO_SIDE] + hk[-HALO_SIDE * HALO_SIDE] + hk[HALO_SIDE * HALO_SIDE];
+                    float r = bc[i + k] - (beta * hk[0] - sum) / alpha;
+                    brick_sum += r * r;
+                    brick_max = max(brick_max, abs(r));
+                }
+            });
+        }
+
+        sums[slot] = brick_sum;
+        maxes[slot] = brick_max;
+    });
+
+    double sum_sq = 0;
+    ResidualNorms norms;
+    norms.Max = 0;
+
+    for (int slot = 0; slot < layout.NumBricks(); slot++)
+    {
+        sum_sq += sums[slot];
+        norms.Max = max(norms.Max, maxes[slot]);
+    }
+
+    norms.L2 = float(sqrt(sum_sq / layout.NumCells()));
+    return norms;
+}
+
+void CPUSimulation3D::ComputeDivergence()
+{
+    float inv_2gs = 1.f / (2 * vars->GridScale);
+    float* out = divergence.Front(0);
+
+    pool.ParallelForEach(layout.NumBricks(), [&](int slot) {
+        float hu[HALO_CELLS];
+        float hv[HALO_CELLS];
+        float hw[HALO_CELLS];
+        layout.GatherHalo(velocity.Front(0), slot, hu);
+        layout.GatherHalo(velocity.Front(1), slot, hv);
+        layout.GatherHalo(velocity.Front(2), slot, hw);
+
+        simd_t s = SIMD_SET1(inv_2gs);
+        _ForBrickRows(slot * BRICK_CELLS, [&](int i, int h) {
+            simd_t du = SIMD_SUB(SIMD_LOAD(hu + h + 1), SIMD_LOAD(hu + h - 1));
+            simd_t dv = SIMD_SUB(SIMD_LOAD(hv + h + HALO_SIDE), SIMD_LOAD(hv + h - HALO_SIDE));
+            simd_t dw = SIMD_SUB(SIMD_LOAD(hw + h + HALO_SIDE * HALO_SIDE), SIMD_LOAD(hw + h - HALO_SIDE * HALO_SIDE));
+            SIMD_STORE(out + i, SIMD_MUL(SIMD_ADD(SIMD_ADD(du, dv), dw), s));
+        });
+    });
+}
+
+void CPUSimulation3D::SubtractPressureGradient()
+{
+    // gradient.comp and subtract.comp in one pass
+    float inv_2gs = 1.f / (2 * vars->GridScale);
+    const int strides[3] = { 1, HALO_SIDE, HALO_SIDE * HALO_SIDE };
+
+    pool.ParallelForEach(layout.NumBricks(), [&](int slot) {
+        float hp[HALO_CELLS];
+        layout.GatherHalo(pressure.Front(0), slot, hp);
+
+        simd_t s = SIMD_SET1(inv_2gs);
+        for (int c = 0; c < 3; c++)
+        {
+            const float* in = velocity.Front(c);
+            float* out = velocity.Back(c);
+            int d = strides[c];
+
+            _ForBrickRows(slot * BRICK_CELLS, [&](int i, int h) {
+                simd_t grad = SIMD_MUL(SIMD_SUB(SIMD_LOAD(hp + h + d), SIMD_LOAD(hp + h - d)), s);
+                SIMD_STORE(out + i, SIMD_SUB(SIMD_LOAD(in + i), grad));
+            });
+        }
+    });
+
+    velocity.Swap();
+}
+
+void CPUSimulation3D::ComputeBoundaryValues(CPUField3D& field, float scale)
+{
+    // Each face cell takes the scaled value of the cell one step inwards on every axis it sits on
+    // the edge of. That neighbour is never a face cell itself so this can be done in place.
+    ivec3 size = layout.Size();
+
+    pool.ParallelFor(0, size.z, [&](int z0, int z1) {
+        for (int z = z0; z < z1; z++)
+        {
+            for (int y = 0; y < size.y; y++)
+            {
+                bool yz_face = z == 0 || z == size.z - 1 || y == 0 || y == size.y - 1;
+                int x_step = yz_face ? 1 : size.x - 1;
+
+                for (int x = 0; x < size.x; x += x_step)
+                {
+                    ivec3 coord(x, y, z);
+                    ivec3 src = coord + ivec3(equal(coord, ivec3(0))) - ivec3(equal(coord, size - 1));
+                    int i = layout.Index(x, y, z);
+                    int j = layout.Index(src.x, src.y, src.z);
+
+                    for (int c = 0; c < field.Channels(); c++)
+                        field.Front(c)[i] = scale * field.Front(c)[j];
+                }
+            }
+        }
+    });
+}
+
+// Cells per unit of delta_t the fastest cell moves, the velocity being in box widths per second
+float CPUSimulation3D::MeasureMaxSpeed()
+{
+    vector<float> brick_maxes(layout.NumBricks(), 0.f);
+    const float* u = velocity.Front(0);
+    const float* v = velocity.Front(1);
+    const float* w = velocity.Front(2);
+
+    pool.ParallelForEach(layout.NumBricks(), [&](int slot) {
+        float brick_max = 0;
+        for (int i = slot * BRICK_CELLS; i < (slot + 1) * BRICK_CELLS; i++)
+            brick_max = max(brick_max, u[i] * u[i] + v[i] * v[i] + w[i] * w[i]);
+
+        brick_maxes[slot] = brick_max;
+    });
+
+    float max_sq = *max_element(brick_maxes.begin(), brick_maxes.end());
+    return sqrt(max_sq) / vars->GridScale;
+}
+
+void CPUSimulation3D::ReadField(SimulationField field, float* rgba)
+{
+    CPUField3D* src = &ink;
+    if (field == SimulationField::Velocity)
+        src = &velocity;
+    else if (field == SimulationField::Pressure)
+        src = &pressure;
+
+    ivec3 size = layout.Size();
+
+    pool.ParallelForEach(layout.NumBricks(), [&](int slot) {
+        ivec3 origin = layout.BrickOrigin(slot);
+        int i = slot * BRICK_CELLS;
+
+        for (int z = origin.z; z < origin.z + BRICK_SIDE; z++)
+        {
+            for (int y = origin.y; y < origin.y + BRICK_SIDE; y++)
+            {
+                for (int x = origin.x; x < origin.x + BRICK_SIDE; x++, i++)
+                {
+                    float* out = rgba + (size_t(z * size.y + y) * size.x + x) * 4;
+                    for (int c = 0; c < 4; c++)
+                        out[c] = c < src->Channels() ? src->Front(c)[i] : 0.f;
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,223 @@
+#include "ConjugateGradient.h"
+
+#include <glad/glad.h>
+
+#include "Common.h"
+
+using namespace std;
+using namespace glm;
+
+#define PCG_REDUCE_GROUP_SIZE 256
+
+bool _InitPCGShader(const char* file, GLComputeShader& program, uvec3 local_size, vector<string> defines)
+{
+    GLShader cs(file, ShaderType::Compute, local_size, string(), defines);
+    if (!cs.Compile())
+        return false;
+
+    program.Init();
+    program.Attach(cs);
+    if (!program.Link())
+        return false;
+
+    program.Name = cs.FileName();
+    cs.Discard();
+    return true;
+}
+
+ConjugateGradientSolver::WorkTextures::WorkTextures(uvec3 size)
+    : X(size.x, size.y, size.z, GL_RED, GL_FLOAT, GL_R32F)
+    , R(size.x, size.y, size.z, GL_RED, GL_FLOAT, GL_R32F)
+    , Z(size.x, size.y, size.z, GL_RED, GL_FLOAT, GL_R32F)
+    , P(size.x, size.y, size.z, GL_RED, GL_FLOAT, GL_R32F)
+    , AP(size.x, size.y, size.z, GL_RED, GL_FLOAT, GL_R32F)
+{
+}
+
+ConjugateGradientSolver::ConjugateGradientSolver()
+    : numGroups(0)
+    , incompletePoisson(false)
+    , partialsBuffer(0)
+    , scalarsBuffer(0)
+{
+}
+
+ConjugateGradientSolver::~ConjugateGradientSolver()
+{
+    if (partialsBuffer != 0)
+    {
+        _GL_WRAP2(glDeleteBuffers, 1, &partialsBuffer);
+    }
+
+    if (scalarsBuffer != 0)
+    {
+        _GL_WRAP2(glDeleteBuffers, 1, &scalarsBuffer);
+    }
+}
+
+bool ConjugateGradientSolver::Init(uvec3 size, uvec3 local_size, const string& field_format, bool incomplete_poisson)
+{
+    this->size = size;
+    workGroups = size / local_size;
+    numGroups = workGroups.x * workGroups.y * workGroups.z;
+    incompletePoisson = incomplete_poisson;
+
+    vector<string> defines = { "FIELD_FORMAT " + field_format };
+    if (!incomplete_poisson)
+        defines.push_back("JACOBI_PRECONDITIONER");
+
+    if (!_InitPCGShader("3d\\pcg_init.comp", initShader, local_size, defines)
+        || !_InitPCGShader("3d\\pcg_apply.comp", applyShader, local_size, defines)
+        || !_InitPCGShader("3d\\pcg_update.comp", updateShader, local_size, defines)
+        || !_InitPCGShader("3d\\pcg_direction.comp", directionShader, local_size, defines)
+        || !_InitPCGShader("3d\\pcg_finish.comp", finishShader, local_size, defines)
+        || !_InitPCGShader("3d\\pcg_reduce.comp", reduceShader, uvec3(PCG_REDUCE_GROUP_SIZE, 1, 1), defines))
+        return false;
+
+    if (incomplete_poisson)
+    {
+        vector<string> lower = defines;
+        lower.push_back("LOWER_PASS");
+
+        if (!_InitPCGShader("3d\\pcg_precondition.comp", upperShader, local_size, defines)
+            || !_InitPCGShader("3d\\pcg_precondition.comp", lowerShader, local_size, lower))
+            return false;
+
+        upperShader.Name = "pcg_precondition.comp (upper)";
+        lowerShader.Name = "pcg_precondition.comp (lower)";
+    }
+
+    _GL_WRAP2(glGenBuffers, 1, &partialsBuffer);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, partialsBuffer);
+    _GL_WRAP4(glBufferData, GL_SHADER_STORAGE_BUFFER, sizeof(float) * numGroups, nullptr, GL_DYNAMIC_COPY);
+
+    _GL_WRAP2(glGenBuffers, 1, &scalarsBuffer);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, scalarsBuffer);
+    _GL_WRAP4(glBufferData, GL_SHADER_STORAGE_BUFFER, sizeof(vec4), nullptr, GL_DYNAMIC_COPY);
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, 0);
+
+    return true;
+}
+
+int ConjugateGradientSolver::Solve(Texture& x, Texture& b, float alpha, float beta, ResidualMonitor& monitor, int max_iterations, float tolerance, int step)
+{
+    if (!work)
+        work = make_unique<WorkTextures>(size);
+
+    // x = pressure, r = alpha*b - Ax, z = M^-1 r, p = z
+    BindBuffers();
+    initShader.Use();
+    initShader.SetFloat("alpha", alpha);
+    initShader.SetFloat("beta", beta);
+    initShader.SetImage("pressure_r", x, 0, GL_READ_ONLY);
+    initShader.SetImage("divergence_r", b, 1, GL_READ_ONLY);
+    initShader.SetImage("x_w", work->X, 2, GL_WRITE_ONLY);
+    initShader.SetImage("r_w", work->R, 3, GL_WRITE_ONLY);
+    initShader.SetImage("p_w", work->P, 4, GL_WRITE_ONLY);
+    initShader.SetImage("z_w", work->Z, 5, GL_WRITE_ONLY);
+    Execute(initShader);
+
+    if (incompletePoisson)
+        Precondition(beta);
+
+    Reduce(0);
+
+    directionShader.Use();
+    directionShader.SetImage("z_r", work->Z, 0, GL_READ_ONLY);
+    directionShader.SetImage("p", work->P, 1, GL_READ_WRITE);
+    Execute(directionShader);
+
+    // Same planning from earlier residuals as the Jacobi solver
+    if (tolerance > 0)
+        max_iterations = monitor.Plan(tolerance, max(step, 1), max_iterations);
+
+    int i = 0;
+    while (i < max_iterations)
+    {
+        // The monitor's reduction binds its own buffers
+        BindBuffers();
+
+        // alpha = r.z / p.Ap
+        applyShader.Use();
+        applyShader.SetFloat("beta", beta);
+        applyShader.SetImage("p_r", work->P, 0, GL_READ_ONLY);
+        applyShader.SetImage("ap_w", work->AP, 1, GL_WRITE_ONLY);
+        Execute(applyShader);
+        Reduce(1);
+
+        // x += alpha*p, r -= alpha*Ap
+        updateShader.Use();
+        updateShader.SetFloat("alpha", alpha);
+        updateShader.SetFloat("beta", beta);
+        updateShader.SetImage("x", work->X, 0, GL_READ_WRITE);
+        updateShader.SetImage("r", work->R, 1, GL_READ_WRITE);
+        updateShader.SetImage("p_r", work->P, 2, GL_READ_ONLY);
+        updateShader.SetImage("ap_r", work->AP, 3, GL_READ_ONLY);
+        updateShader.SetImage("z_w", work->Z, 4, GL_WRITE_ONLY);
+        monitor.BindPartials(2, numGroups);
+        Execute(updateShader);
+
+        // beta = r.z / previous r.z, p = z + beta*p
+        if (incompletePoisson)
+            Precondition(beta);
+
+        Reduce(2);
+
+        directionShader.Use();
+        directionShader.SetImage("z_r", work->Z, 0, GL_READ_ONLY);
+        directionShader.SetImage("p", work->P, 1, GL_READ_WRITE);
+        Execute(directionShader);
+
+        i++;
+    }
+
+    // The last update kernel wrote the residual's partials
+    if (tolerance > 0 && i > 0)
+        monitor.Reduce(numGroups, size.x * size.y * size.z);
+
+    finishShader.Use();
+    finishShader.SetImage("x_r", work->X, 0, GL_READ_ONLY);
+    finishShader.SetImage("pressure_w", x, 1, GL_WRITE_ONLY);
+    Execute(finishShader);
+
+    return i;
+}
+
+void ConjugateGradientSolver::BindBuffers()
+{
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, 0, partialsBuffer);
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, 1, scalarsBuffer);
+}
+
+void ConjugateGradientSolver::Execute(GLComputeShader& shader)
+{
+    // Execute only orders image accesses, the partials and scalars are buffers
+    _GL_WRAP1(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+    shader.Execute(workGroups);
+}
+
+// Incomplete Poisson: r -> AP (upper pass), AP -> Z plus the partials of r.z (lower pass)
+void ConjugateGradientSolver::Precondition(float beta)
+{
+    upperShader.Use();
+    upperShader.SetFloat("beta", beta);
+    upperShader.SetImage("field_r", work->R, 0, GL_READ_ONLY);
+    upperShader.SetImage("field_w", work->AP, 1, GL_WRITE_ONLY);
+    Execute(upperShader);
+
+    lowerShader.Use();
+    lowerShader.SetFloat("beta", beta);
+    lowerShader.SetImage("field_r", work->AP, 0, GL_READ_ONLY);
+    lowerShader.SetImage("field_w", work->Z, 1, GL_WRITE_ONLY);
+    lowerShader.SetImage("r_r", work->R, 2, GL_READ_ONLY);
+    Execute(lowerShader);
+}
+
+void ConjugateGradientSolver::Reduce(int stage)
+{
+    _GL_WRAP1(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+    reduceShader.Use();
+    reduceShader.SetInt("num_partials", numGroups);
+    reduceShader.SetInt("stage", stage);
+    reduceShader.Execute(1, 1, 1);
+}
@@ -1,4 +1,6 @@
 
+#include <stdexcept>
+
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
@@ -10,6 +12,7 @@ using namespace glm;
 
 FBO::FBO()
 	: initialized(false)
+	, secondTarget(false)
 	, width(0)
 	, height(0)
 	, depth(0)
@@ -18,25 +21,27 @@ FBO::FBO()
 }
 
 FBO::FBO(int width, int height, int depth, int channels)
-	: width(width)
+	: secondTarget(false)
+	, width(width)
 	, height(height)
 	, depth(depth)
 	, texture(width, height, depth, channels)
 	, fboId(0)
 {
 	if (!Init())
-		throw exception("Failed to intialize FBO");
+		throw runtime_error("Failed to intialize FBO");
 }
 
 FBO::FBO(int width, int height, int depth, int format, int type, int internalformat)
-	: width(width)
+	: secondTarget(false)
+	, width(width)
 	, height(height)
 	, depth(depth)
 	, texture(width, height, depth, format, type, internalformat)
 	, fboId(0)
 {
 	if (!Init())
-		throw exception("Failed to intialize FBO");
+		throw runtime_error("Failed to intialize FBO");
 }
 
 bool FBO::Init()
@@ -86,9 +91,27 @@ void FBO::Clear(float r, float g, float b, float a)
 void FBO::Bind()
 {
 	_GL_WRAP2(glBindFramebuffer, GL_FRAMEBUFFER, fboId);
+
+	// Don't leave another FBO's texture attached where it could end up in a feedback loop
+	if (secondTarget)
+	{
+		_GL_WRAP5(glFramebufferTexture2D, GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, 0, 0);
+		secondTarget = false;
+	}
+
 	_GL_WRAP1(glDrawBuffer, GL_COLOR_ATTACHMENT0);
 }
 
+void FBO::BindWith(FBO& second)
+{
+	_GL_WRAP2(glBindFramebuffer, GL_FRAMEBUFFER, fboId);
+	_GL_WRAP5(glFramebufferTexture2D, GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, second.TextureId(), 0);
+	secondTarget = true;
+
+	GLenum targets[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	_GL_WRAP2(glDrawBuffers, 2, targets);
+}
+
 void FBO::Resize(int w, int h, GLShaderProgram& shader, VertexList& quad)
 {
 	width = w;
@@ -101,10 +124,10 @@ void FBO::Resize(int w, int h, GLShaderProgram& shader, VertexList& quad)
 	fboId = 0;
 
 	if (!texture.Init(width, height, depth))
-		throw exception("Failed to resize texture");
+		throw runtime_error("Failed to resize texture");
 
 	if (!Init())
-		throw exception("Failed to resize FBO");
+		throw runtime_error("Failed to resize FBO");
 
 	// Draw old texture onto new one
 	Bind();
@@ -0,0 +1,214 @@
+#include "FFTPoisson.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include "Common.h"
+#include "Simd.h"
+
+using namespace std;
+using namespace glm;
+
+// Lines along y and z are transformed this many at a time, sideways through adjacent x (and y)
+// cells so the butterflies are contiguous loads
+#define FFT_LANE_BLOCK 64
+
+// In place radix-2 FFT of `lanes` independent sequences of n points. Point i of lane l is at
+// i * stride + l, so the butterflies of neighbouring lanes sit next to each other in memory and
+// run SIMD_WIDTH at a time. Lines along x are a single lane with stride 1 and stay scalar.
+void _FFTLanes(float* re, float* im, int n, int stride, int lanes, const float* cos_t, const float* sin_t, bool inverse)
+{
+    for (int i = 1, j = 0; i < n; i++)
+    {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+
+        if (i < j)
+        {
+            for (int l = 0; l < lanes; l++)
+            {
+                swap(re[i * stride + l], re[j * stride + l]);
+                swap(im[i * stride + l], im[j * stride + l]);
+            }
+        }
+    }
+
+    for (int len = 2; len <= n; len <<= 1)
+    {
+        int half = len >> 1;
+        int table_step = n / len;
+
+        for (int i = 0; i < n; i += len)
+        {
+            for (int k = 0; k < half; k++)
+            {
+                float wr = cos_t[k * table_step];
+                float wi = inverse ? sin_t[k * table_step] : -sin_t[k * table_step];
+
+                float* ar = re + (i + k) * stride;
+                float* ai = im + (i + k) * stride;
+                float* br = ar + half * stride;
+                float* bi = ai + half * stride;
+
+                simd_t vwr = SIMD_SET1(wr);
+                simd_t vwi = SIMD_SET1(wi);
+
+                int l = 0;
+                for (; l + SIMD_WIDTH <= lanes; l += SIMD_WIDTH)
+                {
+                    simd_t xr = SIMD_LOAD(br + l);
+                    simd_t xi = SIMD_LOAD(bi + l);
+                    simd_t tr = SIMD_SUB(SIMD_MUL(xr, vwr), SIMD_MUL(xi, vwi));
+                    simd_t ti = SIMD_ADD(SIMD_MUL(xr, vwi), SIMD_MUL(xi, vwr));
+                    simd_t yr = SIMD_LOAD(ar + l);
+                    simd_t yi = SIMD_LOAD(ai + l);
+
+                    SIMD_STORE(br + l, SIMD_SUB(yr, tr));
+                    SIMD_STORE(bi + l, SIMD_SUB(yi, ti));
+                    SIMD_STORE(ar + l, SIMD_ADD(yr, tr));
+                    SIMD_STORE(ai + l, SIMD_ADD(yi, ti));
+                }
+
+                for (; l < lanes; l++)
+                {
+                    float tr = br[l] * wr - bi[l] * wi;
+                    float ti = br[l] * wi + bi[l] * wr;
+
+                    br[l] = ar[l] - tr;
+                    bi[l] = ai[l] - ti;
+                    ar[l] += tr;
+                    ai[l] += ti;
+                }
+            }
+        }
+    }
+}
+
+FFTPoissonSolver::FFTPoissonSolver(ivec3 size)
+    : size(size)
+{
+    if (!Supports(size))
+        throw runtime_error("FFT solver dimensions have to be powers of two");
+
+    const double PI = 3.14159265358979323846;
+
+    for (int a = 0; a < 3; a++)
+    {
+        int n = size[a];
+
+        // A flat axis adds nothing to the neighbour sum
+        eigen[a].assign(n, 0.f);
+        if (n == 1)
+            continue;
+
+        cosTable[a].resize(n / 2);
+        sinTable[a].resize(n / 2);
+        for (int k = 0; k < n / 2; k++)
+        {
+            cosTable[a][k] = float(cos(2 * PI * k / n));
+            sinTable[a][k] = float(sin(2 * PI * k / n));
+        }
+
+        for (int k = 0; k < n; k++)
+            eigen[a][k] = float(2 * cos(2 * PI * k / n));
+    }
+
+    re.resize(size_t(size.x) * size.y * size.z);
+    im.resize(re.size());
+}
+
+bool FFTPoissonSolver::Supports(ivec3 size)
+{
+    for (int a = 0; a < 3; a++)
+    {
+        if (size[a] <= 0 || (size[a] & (size[a] - 1)) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+void FFTPoissonSolver::Solve(const float* b, float* x, float alpha, float beta, ThreadPool& pool)
+{
+    int slice = size.x * size.y;
+
+    pool.ParallelFor(0, size.z, [&](int z0, int z1) {
+        for (size_t i = size_t(z0) * slice; i < size_t(z1) * slice; i++)
+        {
+            re[i] = alpha * b[i];
+            im[i] = 0;
+        }
+    });
+
+    Transform(false, pool);
+
+    // The inverse transform leaves out the 1/N, fold it into the divide
+    float scale = 1.f / float(re.size());
+
+    pool.ParallelFor(0, size.z, [&](int z0, int z1) {
+        for (int z = z0; z < z1; z++)
+        {
+            for (int y = 0; y < size.y; y++)
+            {
+                float* r = &re[size_t(z) * slice + size_t(y) * size.x];
+                float* c = &im[size_t(z) * slice + size_t(y) * size.x];
+                float row = beta - eigen[1][y] - eigen[2][z];
+
+                for (int kx = 0; kx < size.x; kx++)
+                {
+                    float lambda = row - eigen[0][kx];
+                    float s = abs(lambda) > 1e-6f ? scale / lambda : 0.f;
+                    r[kx] *= s;
+                    c[kx] *= s;
+                }
+            }
+        }
+    });
+
+    Transform(true, pool);
+
+    pool.ParallelFor(0, size.z, [&](int z0, int z1) {
+        for (size_t i = size_t(z0) * slice; i < size_t(z1) * slice; i++)
+            x[i] = re[i];
+    });
+}
+
+void FFTPoissonSolver::Transform(bool inverse, ThreadPool& pool)
+{
+    int slice = size.x * size.y;
+    float* r = re.data();
+    float* c = im.data();
+
+    if (size.x > 1)
+    {
+        pool.ParallelFor(0, size.y * size.z, [&](int l0, int l1) {
+            for (int line = l0; line < l1; line++)
+                _FFTLanes(r + size_t(line) * size.x, c + size_t(line) * size.x, size.x, 1, 1, cosTable[0].data(), sinTable[0].data(), inverse);
+        });
+    }
+
+    if (size.y > 1)
+    {
+        int blocks = (size.x + FFT_LANE_BLOCK - 1) / FFT_LANE_BLOCK;
+
+        pool.ParallelForEach(blocks * size.z, [&](int item) {
+            size_t first = size_t(item / blocks) * slice + (item % blocks) * FFT_LANE_BLOCK;
+            int lanes = min(FFT_LANE_BLOCK, size.x - (item % blocks) * FFT_LANE_BLOCK);
+            _FFTLanes(r + first, c + first, size.y, size.x, lanes, cosTable[1].data(), sinTable[1].data(), inverse);
+        });
+    }
+
+    if (size.z > 1)
+    {
+        int blocks = (slice + FFT_LANE_BLOCK - 1) / FFT_LANE_BLOCK;
+
+        pool.ParallelForEach(blocks, [&](int item) {
+            int first = item * FFT_LANE_BLOCK;
+            _FFTLanes(r + first, c + first, size.z, slice, min(FFT_LANE_BLOCK, slice - first), cosTable[2].data(), sinTable[2].data(), inverse);
+        });
+    }
+}
@@ -0,0 +1,315 @@
+#include "GPUProfiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include <glad/glad.h>
+
+#include "Common.h"
+#include "TraceRecorder.h"
+
+using namespace std;
+
+#define QUERY_POOL_GROWTH 64
+
+// Singleton
+GPUProfiler& GPUProfiler::Get()
+{
+    static GPUProfiler profiler;
+    return profiler;
+}
+
+GPUProfiler::GPUProfiler()
+    : numSlots(0)
+    , current(0)
+    , passOpen(false)
+    , framesMeasured(0)
+    , framesDropped(0)
+{
+    for (auto& slot : slots)
+    {
+        slot.Used = 0;
+        slot.Pending = false;
+        slot.Traced = false;
+        slot.ClockOffset = 0;
+    }
+}
+
+GPUProfiler::PassHistory::PassHistory(const string& label)
+    : Label(label)
+    , NextSample(0)
+    , NextFrame(0)
+{
+}
+
+void GPUProfiler::Init(int frames_in_flight)
+{
+    if (IsActive() || frames_in_flight <= 0)
+        return;
+
+    // Two slots is the least that lets one frame be read while the next records
+    numSlots = min(max(frames_in_flight, 2), GPU_PROFILER_MAX_FRAMES);
+    current = 0;
+}
+
+void GPUProfiler::NewFrame()
+{
+    if (!IsActive())
+        return;
+
+    if (passOpen)
+        End();
+
+    slots[current].Pending = slots[current].Used > 0;
+    Collect(false);
+
+    current = (current + 1) % numSlots;
+    FrameSlot& slot = slots[current];
+
+    // The GPU is further behind than the ring is deep, rather than wait just lose the frame
+    if (slot.Pending)
+        framesDropped++;
+
+    slot.Pending = false;
+    slot.Used = 0;
+    slot.Passes.clear();
+
+    // GL_TIMESTAMP is when the commands issued so far reach the GPU, not when they finish, so
+    // this doesn't wait on anything
+    slot.Traced = TraceRecorder::Get().IsRecording();
+    if (slot.Traced)
+    {
+        GLint64 gpu_now = 0;
+        _GL_WRAP2(glGetInteger64v, GL_TIMESTAMP, &gpu_now);
+        slot.ClockOffset = TraceRecorder::Get().Now() - double(gpu_now) / 1000;
+    }
+}
+
+void GPUProfiler::Begin(const string& label)
+{
+    if (!IsActive())
+        return;
+
+    if (passOpen)
+        End();
+
+    int id;
+    auto it = labelIds.find(label);
+    if (it == labelIds.end())
+    {
+        lock_guard<mutex> guard(historyLock);
+        id = int(history.size());
+        labelIds.emplace(label, id);
+        history.emplace_back(label);
+    }
+    else
+    {
+        id = it->second;
+    }
+
+    FrameSlot& slot = slots[current];
+    if (slot.Used + 2 > int(slot.Queries.size()))
+    {
+        size_t first = slot.Queries.size();
+        slot.Queries.resize(first + QUERY_POOL_GROWTH);
+        _GL_WRAP2(glGenQueries, QUERY_POOL_GROWTH, &slot.Queries[first]);
+    }
+
+    slot.Passes.push_back({ id, slot.Used });
+    _GL_WRAP2(glQueryCounter, slot.Queries[slot.Used], GL_TIMESTAMP);
+    slot.Used++;
+    passOpen = true;
+}
+
+void GPUProfiler::End()
+{
+    if (!IsActive() || !passOpen)
+        return;
+
+    FrameSlot& slot = slots[current];
+    _GL_WRAP2(glQueryCounter, slot.Queries[slot.Used], GL_TIMESTAMP);
+    slot.Used++;
+    passOpen = false;
+}
+
+void GPUProfiler::Collect(bool wait)
+{
+    if (!IsActive())
+        return;
+
+    if (wait)
+    {
+        if (passOpen)
+            End();
+
+        slots[current].Pending = slots[current].Used > 0;
+    }
+
+    // Oldest first so the history rings stay in frame order
+    for (int k = 1; k <= numSlots; k++)
+    {
+        FrameSlot& slot = slots[(current + k) % numSlots];
+        if (!TryRead(slot, wait) && !wait)
+            break;
+    }
+}
+
+void GPUProfiler::Reset()
+{
+    lock_guard<mutex> guard(historyLock);
+
+    for (PassHistory& h : history)
+    {
+        h.Samples.clear();
+        h.FrameTimes.clear();
+        h.FrameCalls.clear();
+        h.NextSample = 0;
+        h.NextFrame = 0;
+    }
+
+    framesMeasured = 0;
+    framesDropped = 0;
+}
+
+bool GPUProfiler::TryRead(FrameSlot& slot, bool wait)
+{
+    if (!slot.Pending)
+        return false;
+
+    // Timestamps land in submission order, if the last one is there they all are
+    if (!wait)
+    {
+        int available = 0;
+        _GL_WRAP3(glGetQueryObjectiv, slot.Queries[slot.Used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+    }
+
+    timestamps.resize(slot.Used);
+    for (int i = 0; i < slot.Used; i++)
+    {
+        GLuint64 t = 0;
+        _GL_WRAP3(glGetQueryObjectui64v, slot.Queries[i], GL_QUERY_RESULT, &t);
+        timestamps[i] = t;
+    }
+
+    lock_guard<mutex> guard(historyLock);
+
+    vector<float> frame_times(history.size(), 0.0f);
+    vector<int> frame_calls(history.size(), 0);
+
+    for (const Pass& pass : slot.Passes)
+    {
+        float ms = float(double(timestamps[pass.FirstQuery + 1] - timestamps[pass.FirstQuery]) / 1e6);
+        PassHistory& h = history[pass.Label];
+
+        if (int(h.Samples.size()) < GPU_PROFILER_SAMPLES)
+            h.Samples.push_back(ms);
+        else
+            h.Samples[h.NextSample] = ms;
+
+        h.NextSample = (h.NextSample + 1) % GPU_PROFILER_SAMPLES;
+        frame_times[pass.Label] += ms;
+        frame_calls[pass.Label]++;
+
+        if (slot.Traced)
+            TraceRecorder::Get().AddEvent(TraceTrack::GPU, h.Label, double(timestamps[pass.FirstQuery]) / 1000 + slot.ClockOffset, double(ms) * 1000);
+    }
+
+    for (size_t i = 0; i < history.size(); i++)
+    {
+        PassHistory& h = history[i];
+
+        if (int(h.FrameTimes.size()) < GPU_PROFILER_HISTORY)
+        {
+            h.FrameTimes.push_back(frame_times[i]);
+            h.FrameCalls.push_back(frame_calls[i]);
+        }
+        else
+        {
+            h.FrameTimes[h.NextFrame] = frame_times[i];
+            h.FrameCalls[h.NextFrame] = frame_calls[i];
+        }
+
+        h.NextFrame = (h.NextFrame + 1) % GPU_PROFILER_HISTORY;
+    }
+
+    framesMeasured++;
+    slot.Pending = false;
+    slot.Used = 0;
+    slot.Passes.clear();
+    return true;
+}
+
+vector<PassTimings> GPUProfiler::Timings() const
+{
+    vector<PassTimings> timings;
+    lock_guard<mutex> guard(historyLock);
+
+    for (const PassHistory& h : history)
+    {
+        if (h.Samples.empty())
+            continue;
+
+        vector<float> sorted(h.Samples);
+        sort(sorted.begin(), sorted.end());
+
+        PassTimings t;
+        t.Label = h.Label;
+        t.Min = sorted.front();
+        t.Avg = 0;
+        for (float s : sorted)
+            t.Avg += s;
+        t.Avg /= sorted.size();
+
+        int p99 = int(ceil(sorted.size() * 0.99)) - 1;
+        t.P99 = sorted[min(max(p99, 0), int(sorted.size()) - 1)];
+
+        t.FrameTotal = 0;
+        t.CallsPerFrame = 0;
+        for (size_t i = 0; i < h.FrameTimes.size(); i++)
+        {
+            t.FrameTotal += h.FrameTimes[i];
+            t.CallsPerFrame += h.FrameCalls[i];
+        }
+
+        t.FrameTotal /= h.FrameTimes.size();
+        t.CallsPerFrame /= h.FrameTimes.size();
+        timings.push_back(t);
+    }
+
+    return timings;
+}
+
+string GPUProfiler::Report() const
+{
+    ostringstream out;
+    char line[256];
+
+    snprintf(line, sizeof(line), "GPU pass timings in ms, %d frames measured (%d dropped)", framesMeasured.load(), framesDropped.load());
+    out << line << endl;
+    snprintf(line, sizeof(line), "%-24s %8s %8s %8s %8s %10s", "pass", "calls", "min", "avg", "p99", "per frame");
+    out << line << endl;
+
+    float total = 0;
+    for (const PassTimings& t : Timings())
+    {
+        snprintf(line, sizeof(line), "%-24s %8.1f %8.3f %8.3f %8.3f %10.3f", t.Label.c_str(), t.CallsPerFrame, t.Min, t.Avg, t.P99, t.FrameTotal);
+        out << line << endl;
+        total += t.FrameTotal;
+    }
+
+    snprintf(line, sizeof(line), "%-24s %46.3f", "total", total);
+    out << line << endl;
+    return out.str();
+}
+
+void GPUProfiler::LogReport() const
+{
+    istringstream report(Report());
+    string line;
+
+    while (getline(report, line))
+        LOG_INFO("%s", line.c_str());
+}
@@ -26,6 +26,33 @@ IniConfig& IniConfig::Get()
 
 IniConfig::IniConfig()
 	: NumJacobiIterations(4)
+	, PressureSolver("jacobi")
+	, MultigridLevels(5)
+	, MultigridSmoothingIterations(2)
+	, MultigridCycles(1)
+	, SOROmega(1.5)
+	, PCGPreconditioner("incomplete_poisson")
+	, ResidualTolerance(0)
+	, ResidualCheckInterval(4)
+	, ResidualPlanStep(4)
+	, MaxJacobiIterations(64)
+	, JacobiKernel("simple")
+	, JacobiSweepsPerDispatch(2)
+	, PressureWarmStart(true)
+	, FuseDivergenceJacobi(true)
+	, SparseBricks(false)
+	, BrickActivityThreshold(1e-3f)
+	, AdvectionScheme("trilinear")
+	, AdvectionRK2(false)
+	, AdaptiveTimestep(false)
+	, CFLNumber(2)
+	, MaxSubsteps(4)
+	, SubstepBudgetMs(12)
+	, SimulationTickRate(60)
+	, ControlPanelFPS(30)
+	, RenderScale(1)
+	, SimulationBackend("gpu")
+	, CPUThreads(0)
 	, ScrollSensitivity(0.08)
 	, MouseOrbitSensitivity(0.008)
 	, KeyOrbitSensitivity(0.06)
@@ -33,6 +60,11 @@ IniConfig::IniConfig()
 	, UseSnormTextures(false)
 	, RainbowModeHueMultiplier(1.0)
 	, DropletsModeDelay(1.0)
+	, RandomSeed(1)
+	, GPUProfilerFrames(4)
+	, TraceFile("inkbox_trace.json")
+	, TraceFrames(120)
+	, ShaderCacheDir("shader_cache")
 	, ColourBorderWithCoord(false)
 {
 	fs::path config_path(CONFIG_FILE_NAME);
@@ -59,6 +91,33 @@ void IniConfig::Save()
 	{
 		fout << "[inkbox]" << endl;
 		WRITE_SETTING(NumJacobiIterations);
+		WRITE_SETTING(PressureSolver);
+		WRITE_SETTING(MultigridLevels);
+		WRITE_SETTING(MultigridSmoothingIterations);
+		WRITE_SETTING(MultigridCycles);
+		WRITE_SETTING(SOROmega);
+		WRITE_SETTING(PCGPreconditioner);
+		WRITE_SETTING(ResidualTolerance);
+		WRITE_SETTING(ResidualCheckInterval);
+		WRITE_SETTING(ResidualPlanStep);
+		WRITE_SETTING(MaxJacobiIterations);
+		WRITE_SETTING(JacobiKernel);
+		WRITE_SETTING(JacobiSweepsPerDispatch);
+		WRITE_SETTING(PressureWarmStart);
+		WRITE_SETTING(FuseDivergenceJacobi);
+		WRITE_SETTING(SparseBricks);
+		WRITE_SETTING(BrickActivityThreshold);
+		WRITE_SETTING(AdvectionScheme);
+		WRITE_SETTING(AdvectionRK2);
+		WRITE_SETTING(AdaptiveTimestep);
+		WRITE_SETTING(CFLNumber);
+		WRITE_SETTING(MaxSubsteps);
+		WRITE_SETTING(SubstepBudgetMs);
+		WRITE_SETTING(SimulationTickRate);
+		WRITE_SETTING(ControlPanelFPS);
+		WRITE_SETTING(RenderScale);
+		WRITE_SETTING(SimulationBackend);
+		WRITE_SETTING(CPUThreads);
 		WRITE_SETTING(ScrollSensitivity);
 		WRITE_SETTING(MouseOrbitSensitivity);
 		WRITE_SETTING(KeyOrbitSensitivity);
@@ -66,6 +125,11 @@ void IniConfig::Save()
 		WRITE_SETTING(UseSnormTextures);
 		WRITE_SETTING(RainbowModeHueMultiplier);
 		WRITE_SETTING(DropletsModeDelay);
+		WRITE_SETTING(RandomSeed);
+		WRITE_SETTING(GPUProfilerFrames);
+		WRITE_SETTING(TraceFile);
+		WRITE_SETTING(TraceFrames);
+		WRITE_SETTING(ShaderCacheDir);
 		WRITE_SETTING(ColourBorderWithCoord);
 	}
 	else
@@ -102,6 +166,33 @@ void IniConfig::Load(std::istream& stream)
 			string value = match[2].str();
 
 			PARSE_INT(key, value, NumJacobiIterations)
+			PARSE_STR(key, value, PressureSolver)
+			PARSE_INT(key, value, MultigridLevels)
+			PARSE_INT(key, value, MultigridSmoothingIterations)
+			PARSE_INT(key, value, MultigridCycles)
+			PARSE_FLOAT(key, value, SOROmega)
+			PARSE_STR(key, value, PCGPreconditioner)
+			PARSE_FLOAT(key, value, ResidualTolerance)
+			PARSE_INT(key, value, ResidualCheckInterval)
+			PARSE_INT(key, value, ResidualPlanStep)
+			PARSE_INT(key, value, MaxJacobiIterations)
+			PARSE_STR(key, value, JacobiKernel)
+			PARSE_INT(key, value, JacobiSweepsPerDispatch)
+			PARSE_BOOL(key, value, PressureWarmStart)
+			PARSE_BOOL(key, value, FuseDivergenceJacobi)
+			PARSE_BOOL(key, value, SparseBricks)
+			PARSE_FLOAT(key, value, BrickActivityThreshold)
+			PARSE_STR(key, value, AdvectionScheme)
+			PARSE_BOOL(key, value, AdvectionRK2)
+			PARSE_BOOL(key, value, AdaptiveTimestep)
+			PARSE_FLOAT(key, value, CFLNumber)
+			PARSE_INT(key, value, MaxSubsteps)
+			PARSE_FLOAT(key, value, SubstepBudgetMs)
+			PARSE_FLOAT(key, value, SimulationTickRate)
+			PARSE_FLOAT(key, value, ControlPanelFPS)
+			PARSE_FLOAT(key, value, RenderScale)
+			PARSE_STR(key, value, SimulationBackend)
+			PARSE_INT(key, value, CPUThreads)
 			PARSE_FLOAT(key, value, ScrollSensitivity)
 			PARSE_FLOAT(key, value, MouseOrbitSensitivity)
 			PARSE_FLOAT(key, value, KeyOrbitSensitivity)
@@ -109,6 +200,11 @@ void IniConfig::Load(std::istream& stream)
 			PARSE_BOOL(key, value, UseSnormTextures)
 			PARSE_FLOAT(key, value, RainbowModeHueMultiplier)
 			PARSE_FLOAT(key, value, DropletsModeDelay)
+			PARSE_INT(key, value, RandomSeed)
+			PARSE_INT(key, value, GPUProfilerFrames)
+			PARSE_STR(key, value, TraceFile)
+			PARSE_INT(key, value, TraceFrames)
+			PARSE_STR(key, value, ShaderCacheDir)
 			PARSE_BOOL(key, value, ColourBorderWithCoord)
 		}
 	}
@@ -123,6 +219,33 @@ void IniConfig::Print()
 {
 	LOG_INFO("Config value:");
 	LOG_INFO("\tNumJacobiIterations: %d", NumJacobiIterations);
+	LOG_INFO("\tPressureSolver: %s", PressureSolver.c_str());
+	LOG_INFO("\tMultigridLevels: %d", MultigridLevels);
+	LOG_INFO("\tMultigridSmoothingIterations: %d", MultigridSmoothingIterations);
+	LOG_INFO("\tMultigridCycles: %d", MultigridCycles);
+	LOG_INFO("\tSOROmega: %.2f", SOROmega);
+	LOG_INFO("\tPCGPreconditioner: %s", PCGPreconditioner.c_str());
+	LOG_INFO("\tResidualTolerance: %g", ResidualTolerance);
+	LOG_INFO("\tResidualCheckInterval: %d", ResidualCheckInterval);
+	LOG_INFO("\tResidualPlanStep: %d", ResidualPlanStep);
+	LOG_INFO("\tMaxJacobiIterations: %d", MaxJacobiIterations);
+	LOG_INFO("\tJacobiKernel: %s", JacobiKernel.c_str());
+	LOG_INFO("\tJacobiSweepsPerDispatch: %d", JacobiSweepsPerDispatch);
+	LOG_INFO("\tPressureWarmStart: %d", PressureWarmStart);
+	LOG_INFO("\tFuseDivergenceJacobi: %d", FuseDivergenceJacobi);
+	LOG_INFO("\tSparseBricks: %d", SparseBricks);
+	LOG_INFO("\tBrickActivityThreshold: %g", BrickActivityThreshold);
+	LOG_INFO("\tAdvectionScheme: %s", AdvectionScheme.c_str());
+	LOG_INFO("\tAdvectionRK2: %d", AdvectionRK2);
+	LOG_INFO("\tAdaptiveTimestep: %d", AdaptiveTimestep);
+	LOG_INFO("\tCFLNumber: %.2f", CFLNumber);
+	LOG_INFO("\tMaxSubsteps: %d", MaxSubsteps);
+	LOG_INFO("\tSubstepBudgetMs: %.1f", SubstepBudgetMs);
+	LOG_INFO("\tSimulationTickRate: %.1f", SimulationTickRate);
+	LOG_INFO("\tControlPanelFPS: %.1f", ControlPanelFPS);
+	LOG_INFO("\tRenderScale: %.2f", RenderScale);
+	LOG_INFO("\tSimulationBackend: %s", SimulationBackend.c_str());
+	LOG_INFO("\tCPUThreads: %d", CPUThreads);
 	LOG_INFO("\tScrollSensitivity: %.2f", ScrollSensitivity);
 	LOG_INFO("\tMouseOrbitSensitivity: %.2f", MouseOrbitSensitivity);
 	LOG_INFO("\tKeyOrbitSensitivity: %.2f", KeyOrbitSensitivity);
@@ -130,4 +253,9 @@ void IniConfig::Print()
 	LOG_INFO("\tUseSnormTextures: %d", UseSnormTextures);
 	LOG_INFO("\tRainbowModeHueMultiplier: %.2f", RainbowModeHueMultiplier);
 	LOG_INFO("\tDropletsModeDelay (sec): %.2f", DropletsModeDelay);
+	LOG_INFO("\tRandomSeed: %d", RandomSeed);
+	LOG_INFO("\tGPUProfilerFrames: %d", GPUProfilerFrames);
+	LOG_INFO("\tTraceFile: %s", TraceFile.c_str());
+	LOG_INFO("\tTraceFrames: %d", TraceFrames);
+	LOG_INFO("\tShaderCacheDir: %s", ShaderCacheDir.c_str());
 }
@@ -0,0 +1,128 @@
+#include "InputLog.h"
+
+#include <stdexcept>
+
+#include "Common.h"
+
+using namespace std;
+using namespace glm;
+
+InputLog::InputLog(InputLogMode mode, const string& path, ivec3 size)
+    : mode(mode)
+    , path(path)
+    , version(INPUT_LOG_VERSION)
+    , frames(0)
+    , finished(false)
+{
+    if (mode == InputLogMode::Record)
+    {
+        out.open(path, ios::out | ios::binary | ios::trunc);
+        if (!out.good())
+            throw runtime_error("Could not create input log");
+
+        Write(uint32_t(INPUT_LOG_MAGIC));
+        Write(uint32_t(INPUT_LOG_VERSION));
+        Write(size);
+
+        LOG_INFO("Recording input to %s", path.c_str());
+    }
+    else
+    {
+        in.open(path, ios::in | ios::binary);
+        if (!in.good())
+            throw runtime_error("Could not open input log");
+
+        uint32_t magic = 0;
+        ivec3 logged_size;
+        if (!Read(magic) || !Read(version) || !Read(logged_size) || magic != INPUT_LOG_MAGIC)
+            throw runtime_error("Not an input log");
+
+        if (version == 0 || version > INPUT_LOG_VERSION)
+            throw runtime_error("Unsupported input log version");
+
+        // Positions are in grid cells so a different size gives a different workload
+        if (logged_size != size)
+            LOG_WARN("Input log was recorded at %dx%dx%d, replaying at %dx%dx%d", logged_size.x, logged_size.y, logged_size.z, size.x, size.y, size.z);
+
+        LOG_INFO("Replaying input from %s", path.c_str());
+    }
+}
+
+bool InputLog::Step(FrameSteps& steps, ImpulseState& impulse)
+{
+    if (finished)
+        return false;
+
+    if (mode == InputLogMode::Record)
+    {
+        Record(steps, impulse);
+        frames++;
+        return true;
+    }
+
+    if (!Replay(steps, impulse))
+    {
+        finished = true;
+        impulse.ForceActive = false;
+        impulse.InkActive = false;
+        LOG_INFO("Input log finished after %d frames", frames);
+        return false;
+    }
+
+    frames++;
+    return true;
+}
+
+void InputLog::Record(const FrameSteps& steps, const ImpulseState& impulse)
+{
+    uint8_t flags = (impulse.ForceActive ? Force : 0) | (impulse.InkActive ? Ink : 0) | (impulse.Radial ? Radial : 0);
+    Write(flags);
+    Write(steps.FrameTime);
+    Write(int32_t(steps.Substeps));
+    Write(steps.SubstepTime);
+
+    if (flags & (Force | Ink))
+    {
+        Write(impulse.CurrentPos);
+        Write(impulse.Delta);
+    }
+
+    if (flags & Ink)
+        Write(impulse.Colour);
+
+    // Keep the log usable if the app doesn't shut down cleanly
+    out.flush();
+}
+
+bool InputLog::Replay(FrameSteps& steps, ImpulseState& impulse)
+{
+    uint8_t flags = 0;
+    float frame_time = 0;
+    if (!Read(flags) || !Read(frame_time))
+        return false;
+
+    int32_t substeps = 1;
+    float substep_time = frame_time;
+    if (version >= 2 && (!Read(substeps) || !Read(substep_time) || substeps < 1))
+        return false;
+
+    impulse.ForceActive = (flags & Force) != 0;
+    impulse.InkActive = (flags & Ink) != 0;
+    impulse.Radial = (flags & Radial) != 0;
+
+    if (flags & (Force | Ink))
+    {
+        if (!Read(impulse.CurrentPos) || !Read(impulse.Delta))
+            return false;
+
+        impulse.LastPos = impulse.CurrentPos - impulse.Delta;
+    }
+
+    if ((flags & Ink) && !Read(impulse.Colour))
+        return false;
+
+    steps.FrameTime = frame_time;
+    steps.Substeps = substeps;
+    steps.SubstepTime = substep_time;
+    return true;
+}
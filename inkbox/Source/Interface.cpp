@@ -3,15 +3,22 @@
 
 #include <string>
 #include <iostream>
+#include <cmath>
 #include <cstdio>
 #include <regex>
-#include <thread>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
+#ifdef _WIN32
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <GLFW/glfw3native.h>
+#endif
+
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -19,7 +26,10 @@
 
 #include "../resource.h"
 #include "Common.h"
+#include "GPUProfiler.h"
 #include "IniConfig.h"
+#include "ResidualMonitor.h"
+#include "TraceRecorder.h"
 
 using namespace std;
 using namespace glm;
@@ -32,7 +42,11 @@ void GLErrorCallback(int error_code, const char* description)
 InkBoxWindows::InkBoxWindows()
     : Main(nullptr)
     , Controls(nullptr)
+    , Worker(nullptr)
     , ViewportSize(0,0)
+    , Headless(false)
+    , eglDisplay(nullptr)
+    , eglContext(nullptr)
 {}
 
 InkBoxWindows::~InkBoxWindows()
@@ -42,6 +56,18 @@ InkBoxWindows::~InkBoxWindows()
 
     if (Controls)
         glfwDestroyWindow(Controls);
+
+    if (Worker)
+        glfwDestroyWindow(Worker);
+
+#ifdef __linux__
+    if (eglContext)
+    {
+        eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(eglDisplay, eglContext);
+        eglTerminate(eglDisplay);
+    }
+#endif
 }
 
 bool InkBoxWindows::InitGLContexts(int width, int height, bool main_resizeable, int ctrl_width, int ctrl_height)
@@ -76,6 +102,15 @@ bool InkBoxWindows::InitGLContexts(int width, int height, bool main_resizeable,
         }
     }
 
+    glfwWindowHint(GLFW_VISIBLE, 0);
+    Worker = glfwCreateWindow(1, 1, "", nullptr, Main);
+    glfwWindowHint(GLFW_VISIBLE, 1);
+    if (Worker == nullptr)
+    {
+        cout << "Failed to create GLFW window" << endl;
+        return false;
+    }
+
     glfwMakeContextCurrent(Main);
     glfwSetErrorCallback(GLErrorCallback);
 
@@ -85,6 +120,7 @@ bool InkBoxWindows::InitGLContexts(int width, int height, bool main_resizeable,
         return false;
     }
 
+#ifdef _WIN32
     HINSTANCE hinst = GetModuleHandle(nullptr);
     HICON hico = LoadIcon(hinst, MAKEINTRESOURCE(IDI_ICON1));
 
@@ -102,7 +138,11 @@ bool InkBoxWindows::InitGLContexts(int width, int height, bool main_resizeable,
         hwnd = glfwGetWin32Window(Controls);
         SendMessage(hwnd, WM_SETICON, ICON_SMALL, (LPARAM)hico);
         SendMessage(hwnd, WM_SETICON, ICON_BIG, (LPARAM)hico);
+    }
+#endif
 
+    if (create_ctrl_pnl)
+    {
         // Setup Dear ImGui context
         IMGUI_CHECKVERSION();
         ImGui::CreateContext();
@@ -115,7 +155,95 @@ bool InkBoxWindows::InitGLContexts(int width, int height, bool main_resizeable,
         ImGui_ImplOpenGL3_Init("#version 330 core");
     }
 
+    // The simulation creates its GL objects on the worker's context, framebuffers and vertex
+    // arrays aren't shared so they have to live where the sim thread will use them
+    glfwMakeContextCurrent(Worker);
+
+    ViewportSize = vec2(width, height);
+    return true;
+}
+
+bool InkBoxWindows::InitHeadlessContext(int width, int height)
+{
+    Headless = true;
     ViewportSize = vec2(width, height);
+
+#ifdef __linux__
+    // Prefer a surfaceless EGL context so no display server is needed (e.g. llvmpipe on a CI host)
+    EGLDisplay display = EGL_NO_DISPLAY;
+    auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display)
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+
+    if (display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint egl_major, egl_minor;
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, &egl_major, &egl_minor))
+    {
+        EGLint context_attribs[] =
+        {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+
+        EGLContext context = EGL_NO_CONTEXT;
+        if (eglBindAPI(EGL_OPENGL_API))
+            context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, context_attribs);
+
+        if (context != EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+        {
+            if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+            {
+                cout << "Failed to initialize GL loader" << endl;
+                return false;
+            }
+
+            eglDisplay = display;
+            eglContext = context;
+            LOG_INFO("Created surfaceless EGL %d.%d context: %s", egl_major, egl_minor, (const char*)glGetString(GL_RENDERER));
+            return true;
+        }
+
+        if (context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+
+        eglTerminate(display);
+    }
+
+    LOG_WARN("Couldn't create a surfaceless EGL context, falling back to a hidden window");
+#endif
+
+    if (glfwInit() != GLFW_TRUE)
+    {
+        cout << "Failed to initialize GL" << endl;
+        return false;
+    }
+
+    glfwSetErrorCallback(GLErrorCallback);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    Main = glfwCreateWindow(width, height, MAIN_WINDOW_TITLE, nullptr, nullptr);
+    if (Main == nullptr)
+    {
+        cout << "Failed to create GLFW window" << endl;
+        return false;
+    }
+
+    glfwMakeContextCurrent(Main);
+
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        cout << "Failed to initialize GL loader" << endl;
+        return false;
+    }
+
+    LOG_INFO("Created hidden window context: %s", (const char*)glGetString(GL_RENDERER));
     return true;
 }
 
@@ -129,10 +257,12 @@ ControlPanel::ControlPanel()
     , simvars(nullptr)
     , texts(nullptr)
     , impulse(nullptr)
+    , solverStats(nullptr)
     , velocity(nullptr)
     , pressure(nullptr)
     , ink(nullptr)
     , vorticity(nullptr)
+    , thumbnailsVisible(false)
     , is3D(false)
 {
 }
@@ -142,13 +272,16 @@ ControlPanel::ControlPanel(GLFWwindow* win, SimulationVars* vars, VarTextBoxes*
     , simvars(vars)
     , texts(texts)
     , impulse(impulse)
+    , solverStats(nullptr)
     , velocity(ufbo)
     , pressure(pfbo)
     , ink(ifbo)
     , vorticity(vfbo)
+    , thumbnailsVisible(false)
     , is3D(false)
 {
-    glfwSetWindowUserPointer(win, this);
+    if (win)
+        glfwSetWindowUserPointer(win, this);
 }
 
 ControlPanel::ControlPanel(GLFWwindow* win, SimulationVars* vars, VarTextBoxes* texts, ImpulseState* impulse)
@@ -156,10 +289,34 @@ ControlPanel::ControlPanel(GLFWwindow* win, SimulationVars* vars, VarTextBoxes*
     , simvars(vars)
     , texts(texts)
     , impulse(impulse)
+    , solverStats(nullptr)
+    , thumbnailsVisible(false)
     , is3D(true)
 {
 }
 
+void ControlPanel::SetThumbnails(FBO* ufbo, FBO* pfbo, FBO* ifbo, FBO* vfbo)
+{
+    velocity = ufbo;
+    pressure = pfbo;
+    ink = ifbo;
+    vorticity = vfbo;
+}
+
+// Combo over a subset of the solvers, in the order given
+void PressureSolverCombo(PressureSolverType& value, const PressureSolverType* solvers, int count, const char* labels)
+{
+    int solver = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (value == solvers[i])
+            solver = i;
+    }
+
+    if (ImGui::Combo("Pressure Solver", &solver, labels))
+        value = solvers[solver];
+}
+
 void ControlPanel::Render(bool& update_vars, bool& clear_buffers)
 {
 #define TEXTBOX(text,var) ImGui::SetNextItemWidth(80); ImGui::InputText((text), (var), 16);
@@ -196,6 +353,25 @@ void ControlPanel::Render(bool& update_vars, bool& clear_buffers)
 
     ImGui::Checkbox("Boundary Conditions", &simvars->BoundariesEnabled);
 
+    // No multigrid in 3D, conjugate gradient is 3D only
+    ImGui::SetNextItemWidth(120);
+    if (!is3D)
+    {
+        const PressureSolverType solvers[] = { PressureSolverType::Jacobi, PressureSolverType::Multigrid, PressureSolverType::RedBlack, PressureSolverType::FFT };
+        PressureSolverCombo(simvars->PressureSolver, solvers, 4, "Jacobi\0Multigrid\0Red-Black SOR\0FFT (CPU)\0");
+    }
+    else
+    {
+        const PressureSolverType solvers[] = { PressureSolverType::Jacobi, PressureSolverType::RedBlack, PressureSolverType::ConjugateGradient, PressureSolverType::FFT };
+        PressureSolverCombo(simvars->PressureSolver, solvers, 4, "Jacobi\0Red-Black SOR\0Conjugate Gradient\0FFT (CPU)\0");
+    }
+
+    if (simvars->PressureSolver == PressureSolverType::RedBlack)
+    {
+        ImGui::SameLine(300);
+        TEXTBOX("SOR Omega", texts->SOROmega);
+    }
+
     ImGui::Separator();
     ImGui::Text("Variables");
     TEXTBOX("Grid Scale", texts->GridScale);
@@ -264,29 +440,107 @@ void ControlPanel::Render(bool& update_vars, bool& clear_buffers)
     else
         ImGui::Text("Force: (%.2f,%.2f,%.2f) | Position: (%.0f,%.0f,%.0f)", impulse->Delta.x, impulse->Delta.y, impulse->Delta.z, impulse->CurrentPos.x, impulse->CurrentPos.y, impulse->CurrentPos.z);
 
+    if (solverStats && IniConfig::Get().ResidualTolerance > 0)
+    {
+        ImGui::Separator();
+        ImGui::Text("Pressure residual: %.2e (max %.2e) | %d iters", solverStats->Pressure.L2, solverStats->Pressure.Max, solverStats->PressureIterations);
+        ImGui::Text("Diffusion residual: %.2e (max %.2e) | %d iters", solverStats->Diffusion.L2, solverStats->Diffusion.Max, solverStats->DiffusionIterations);
+    }
+
+    if (solverStats && IniConfig::Get().AdaptiveTimestep && solverStats->MaxSpeed >= 0)
+    {
+        ImGui::Text("Max speed: %.2f cells/s | %d substeps", solverStats->MaxSpeed, solverStats->Substeps);
+    }
+
+    if (solverStats && solverStats->ActiveBricks >= 0)
+    {
+        ImGui::Text("Active bricks: %.1f%%", 100 * solverStats->ActiveBricks);
+    }
+
+    GPUProfiler& profiler = GPUProfiler::Get();
+    if (profiler.IsActive() && ImGui::CollapsingHeader("GPU Timings"))
+    {
+        ImGui::Columns(5, "gpu_timings");
+        ImGui::Text("Pass"); ImGui::NextColumn();
+        ImGui::Text("Calls"); ImGui::NextColumn();
+        ImGui::Text("Avg ms"); ImGui::NextColumn();
+        ImGui::Text("P99 ms"); ImGui::NextColumn();
+        ImGui::Text("Frame ms"); ImGui::NextColumn();
+        ImGui::Separator();
+
+        for (const PassTimings& t : profiler.Timings())
+        {
+            ImGui::Text("%s", t.Label.c_str()); ImGui::NextColumn();
+            ImGui::Text("%.1f", t.CallsPerFrame); ImGui::NextColumn();
+            ImGui::Text("%.3f", t.Avg); ImGui::NextColumn();
+            ImGui::Text("%.3f", t.P99); ImGui::NextColumn();
+            ImGui::Text("%.3f", t.FrameTotal); ImGui::NextColumn();
+        }
+
+        ImGui::Columns(1);
+        if (ImGui::Button("Log Report"))
+            profiler.LogReport();
+
+        ImGui::SameLine();
+        ImGui::Text("%d frames measured, %d dropped", profiler.FramesMeasured(), profiler.FramesDropped());
+    }
+
     ImGui::Separator();
     ImGui::Text("Frame Rate: %.3f ms (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+
+    if (solverStats && solverStats->TickRate >= 0)
+        ImGui::Text("Simulation: %.1f ticks/s", solverStats->TickRate);
+
+    if (TraceRecorder::Get().IsRecording())
+    {
+        ImGui::Text("Tracing...");
+    }
+    else if (ImGui::Button("Capture Trace"))
+    {
+        TraceRecorder::Get().Start(IniConfig::Get().TraceFile, IniConfig::Get().TraceFrames);
+    }
+
     ImGui::End();
 
-    if (!is3D)
+    // Begin returns false for collapsed windows, the simulation stops drawing the thumbnails
+    // when none of them is shown or the panel is minimized. The windows open before the first
+    // thumbnails arrive, those are only drawn once the simulation has published some.
+    thumbnailsVisible = false;
+    if (!is3D && !glfwGetWindowAttrib(window, GLFW_ICONIFIED))
     {
-        float ratio = (float)velocity->Width() / velocity->Height();
+        float ratio = velocity ? (float)velocity->Width() / velocity->Height() : 1.f;
         ImVec2 dims(150, 150 / ratio);
 
-        ImGui::Begin("Ink");
-        ImGui::Image((ImTextureID)(intptr_t)ink->TextureId(), dims, uv_min, uv_max, tint_col, border_col);
+        if (ImGui::Begin("Ink"))
+        {
+            if (ink)
+                ImGui::Image((ImTextureID)(intptr_t)ink->TextureId(), dims, uv_min, uv_max, tint_col, border_col);
+            thumbnailsVisible = true;
+        }
         ImGui::End();
 
-        ImGui::Begin("Velocity");
-        ImGui::Image((ImTextureID)(intptr_t)velocity->TextureId(), dims, uv_min, uv_max, tint_col, border_col);
+        if (ImGui::Begin("Velocity"))
+        {
+            if (velocity)
+                ImGui::Image((ImTextureID)(intptr_t)velocity->TextureId(), dims, uv_min, uv_max, tint_col, border_col);
+            thumbnailsVisible = true;
+        }
         ImGui::End();
 
-        ImGui::Begin("Pressure");
-        ImGui::Image((ImTextureID)(intptr_t)pressure->TextureId(), dims, uv_min, uv_max, tint_col, border_col);
+        if (ImGui::Begin("Pressure"))
+        {
+            if (pressure)
+                ImGui::Image((ImTextureID)(intptr_t)pressure->TextureId(), dims, uv_min, uv_max, tint_col, border_col);
+            thumbnailsVisible = true;
+        }
         ImGui::End();
 
-        ImGui::Begin("Vorticity##2");
-        ImGui::Image((ImTextureID)(intptr_t)vorticity->TextureId(), dims, uv_min, uv_max, tint_col, border_col);
+        if (ImGui::Begin("Vorticity##2"))
+        {
+            if (vorticity)
+                ImGui::Image((ImTextureID)(intptr_t)vorticity->TextureId(), dims, uv_min, uv_max, tint_col, border_col);
+            thumbnailsVisible = true;
+        }
         ImGui::End();
     }
 
@@ -312,6 +566,10 @@ ImpulseState::ImpulseState()
     , CurrentPos()
     , Delta()
     , RainbowModeHue()
+    , Colour()
+    , DropletsAcc(0)
+    , NextDroplet(0)
+    , Rng(unsigned(IniConfig::Get().RandomSeed))
 {
 }
 
@@ -393,6 +651,90 @@ glm::vec4 ImpulseState::TickRainbowMode(float delta_t)
     return HSLToRGB(RainbowModeHue / 360, 1, 0.5);
 }
 
+void ImpulseState::PrepareFrame(const SimulationVars& vars, float delta_t)
+{
+    if (InkActive)
+        Colour = vars.RainbowMode ? TickRainbowMode(delta_t) : vars.InkColour;
+}
+
+void ImpulseState::Seed(unsigned int seed)
+{
+    Rng.seed(seed);
+    DropletsAcc = 0;
+    NextDroplet = 0;
+}
+
+void ImpulseState::TickDropletsMode(float delta_t, int width, int height)
+{
+    DropletsAcc += delta_t * 1000;
+    if (DropletsAcc >= NextDroplet)
+    {
+        DropletsAcc = 0;
+        float delay = IniConfig::Get().DropletsModeDelay * 1000;
+
+        // One draw per statement, argument evaluation order isn't fixed and would break replays
+        float sign = Random(2) == 0 ? 1.f : -1.f;
+        NextDroplet = delay + sign * Random(int(0.5 * delay));
+
+        LastPos.x = Random(width);
+        LastPos.y = Random(height);
+        LastPos.z = 0;
+        CurrentPos.x = Random(width);
+        CurrentPos.y = Random(height);
+        CurrentPos.z = 0;
+        Delta = CurrentPos - LastPos;
+        ForceActive = true;
+        InkActive = true;
+        Radial = true;
+    }
+    else
+    {
+        ForceActive = false;
+        InkActive = false;
+        Radial = false;
+    }
+}
+
+void ImpulseState::TickDropletsMode(ivec3 size, float force_multiplier, bool drop_now)
+{
+    static ivec2 freq_range(30, 60);
+
+    DropletsAcc++;
+    if (DropletsAcc > NextDroplet || drop_now)
+    {
+        vec3 rand_pos, rand_force;
+
+        DropletsAcc = 0;
+        NextDroplet = float(Random(freq_range.y - freq_range.x) + freq_range.x);
+
+        if (Random(2) == 1)
+        {
+            rand_pos.x = Random(size.x);
+            rand_pos.y = size.y / 2;
+            rand_pos.z = Random(size.z);
+
+            rand_force.x = 0;
+            rand_force.y = -1 * float(Random(1000)) / 1000 * force_multiplier;
+            rand_force.z = 0;
+        }
+        else
+        {
+            rand_pos.x = size.x / 2;
+            rand_pos.z = Random(size.z);
+            rand_pos.y = Random(size.y);
+
+            rand_force.x = -1 * float(Random(1000)) / 1000 * force_multiplier;
+            rand_force.y = 0;
+            rand_force.z = 0;
+        }
+
+        ForceActive = true;
+        InkActive = true;
+        Delta = rand_force;
+        CurrentPos = rand_pos;
+    }
+}
+
 ///////////////////////////
 ///    VarTextBoxes     ///
 ///////////////////////////
@@ -407,6 +749,7 @@ VarTextBoxes::VarTextBoxes()
     memset(InkAdvDissipation, 0, TEXTBUFF_LEN);
     memset(Vorticity, 0, TEXTBUFF_LEN);
     memset(Gravity, 0, TEXTBUFF_LEN);
+    memset(SOROmega, 0, TEXTBUFF_LEN);
 }
 
 void FormatFloatText(char cstr[TEXTBOX_LEN], float value)
@@ -415,7 +758,7 @@ void FormatFloatText(char cstr[TEXTBOX_LEN], float value)
 
     static regex pattern("^\\d*\\.\\d+?(0*)$", regex_constants::optimize | regex_constants::ECMAScript);
 
-    sprintf_s((char*)cstr, TEXTBOX_LEN, "%f", value);
+    snprintf((char*)cstr, TEXTBOX_LEN, "%f", value);
     string s(cstr);
     smatch match;
     if (regex_match(s, match, pattern))
@@ -424,7 +767,7 @@ void FormatFloatText(char cstr[TEXTBOX_LEN], float value)
         if (group.length() > 0)
         {
             string trimmed = s.substr(0, s.length() - group.length());
-            sprintf_s((char*)cstr, TEXTBOX_LEN, "%s", trimmed.c_str());
+            snprintf((char*)cstr, TEXTBOX_LEN, "%s", trimmed.c_str());
         }
     }
 }
@@ -441,6 +784,7 @@ void VarTextBoxes::SetValues(SimulationVars& vars)
     FormatFloatText(InkVolume, vars.InkVolume);
     FormatFloatText(Gravity, vars.Gravity);
     FormatFloatText(ForceMultiplier, vars.ForceMultiplier);
+    FormatFloatText(SOROmega, vars.SOROmega);
 }
 
 void VarTextBoxes::SetValues(float gridscale, float viscosity, float ink_viscosity, float vorticity, float splat_radius, float adv_dissipation, float ink_adv_dissipation, float ink_volume, float gravity, float fmult)
@@ -469,6 +813,7 @@ void VarTextBoxes::UpdateVars(SimulationVars& vars)
     vars.GridScale = stof(GridScale);
     vars.Gravity = stof(Gravity);
     vars.ForceMultiplier = stof(ForceMultiplier);
+    vars.SOROmega = stof(SOROmega);
 }
 
 ///////////////////////////
@@ -497,45 +842,53 @@ SimulationVars::SimulationVars()
     , RainbowMode(false)
     , InkColour(0.54, 0.2, 0.78, 1.0)
     , DisplayField(SimulationField::Ink)
+    , PressureSolver(ParsePressureSolverType(IniConfig::Get().PressureSolver))
+    , SOROmega(IniConfig::Get().SOROmega)
 {
 }
 
-///////////////////////////
-///     FPSLimiter      ///
-///////////////////////////
-
-FPSLimiter::FPSLimiter(int fps)
-    : simFrameTime(1000.0f / fps)
-    , adjustmentCtr(FRAME_DELAY_ADJUSTMENT_MOD)
-    , avgFrameTime(0)
-    , fpsDelay(int(simFrameTime * 0.6))
+void SimulationVars::Set3DDefaults(int width)
 {
+    GridScale = 1.0f / width;
+    Viscosity = 0.0004;
+    InkViscosity = 0.0005;
+    BoundariesEnabled = false;
+    SplatRadius = width * 0.37;
+    InkVolume = width * 0.37;
+    Gravity = 8;
+    InkColour = vec4(1, 1, 1, 1);
 }
 
-void FPSLimiter::Regulate()
+PressureSolverType ParsePressureSolverType(const string& name)
 {
-    using namespace std::chrono;
+    if (name.compare("multigrid") == 0)
+        return PressureSolverType::Multigrid;
 
-    if (fpsDelay != 0)
-        this_thread::sleep_for(milliseconds(fpsDelay));
+    if (name.compare("redblack") == 0)
+        return PressureSolverType::RedBlack;
 
-    if (--adjustmentCtr == 0)
-    {
-        auto now = high_resolution_clock::now();
+    if (name.compare("pcg") == 0)
+        return PressureSolverType::ConjugateGradient;
 
-        if (lastTime.time_since_epoch().count() != 0)
-        {
-            duration<float, milli> time_taken = now - lastTime;
-            avgFrameTime = time_taken.count() / FRAME_DELAY_ADJUSTMENT_MOD;
-
-            float diff = simFrameTime - avgFrameTime;
-            if (diff >= 1.0f)
-                fpsDelay++;
-            else if (diff <= -1.0f)
-                fpsDelay = fpsDelay > 0 ? fpsDelay - 1 : 0;
-        }
+    if (name.compare("fft") == 0)
+        return PressureSolverType::FFT;
 
-        lastTime = now;
-        adjustmentCtr = FRAME_DELAY_ADJUSTMENT_MOD;
-    }
+    if (name.compare("jacobi") != 0)
+        LOG_WARN("Unknown pressure solver '%s', using jacobi", name.c_str());
+
+    return PressureSolverType::Jacobi;
+}
+
+AdvectionType ParseAdvectionType(const string& name)
+{
+    if (name.compare("nearest") == 0)
+        return AdvectionType::Nearest;
+
+    if (name.compare("maccormack") == 0)
+        return AdvectionType::MacCormack;
+
+    if (name.compare("trilinear") != 0)
+        LOG_WARN("Unknown advection scheme '%s', using trilinear", name.c_str());
+
+    return AdvectionType::Trilinear;
 }
@@ -1,10 +1,20 @@
 
+#include <algorithm>
+#include <climits>
 #include <iostream>
+#include <memory>
+
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 #include "Simulation2D.h"
 #include "Simulation3D.h"
+#include "CPUSimulation2D.h"
+#include "CPUSimulation3D.h"
 #include "IniConfig.h"
+#include "InputLog.h"
+#include "TraceRecorder.h"
 
 #ifndef NDEBUG
 #include "Tests.h"
@@ -20,6 +30,8 @@ using namespace std;
 
 #define _3D_FIELD_SIDE 128
 
+#define HEADLESS_DEFAULT_FRAMES 600
+
 once_flag shutdown_flag;
 
 void _AppShutdown()
@@ -32,6 +44,7 @@ void _AtExitHandler()
     call_once(shutdown_flag, _AppShutdown);
 }
 
+#ifdef _WIN32
 BOOL WINAPI _ConsoleCtrlHandler(DWORD type)
 {
     if (type == CTRL_CLOSE_EVENT)
@@ -42,6 +55,7 @@ BOOL WINAPI _ConsoleCtrlHandler(DWORD type)
 
     return FALSE;
 }
+#endif
 
 int main(int argc, char* argv[])
 {
@@ -52,25 +66,85 @@ int main(int argc, char* argv[])
 #ifndef NDEBUG
     if (args.size() >= 1 && args[0].compare("run-tests") == 0)
     {
-        TestManager::Get().RunTests();
-        return 0;
+        return TestManager::Get().RunTests() ? 0 : 1;
     }
 #endif
 
+#ifdef _WIN32
     if (SetConsoleCtrlHandler(_ConsoleCtrlHandler, TRUE) == 0)
     {
         LOG_WARN("Couldn't register console ctrl handler");
     }
+#endif
 
     atexit(_AtExitHandler);
 
+    // inkbox --headless 2d|3d [--frames N] [sizes...]
+    bool headless = false;
+    int headless_frames = HEADLESS_DEFAULT_FRAMES;
+    bool frames_given = false;
+    if (args.size() >= 1 && args[0].compare("--headless") == 0)
+    {
+        headless = true;
+        args.erase(args.begin());
+
+        auto frames_arg = find(args.begin(), args.end(), string("--frames"));
+        if (frames_arg != args.end() && frames_arg + 1 != args.end())
+        {
+            headless_frames = max(atoi((frames_arg + 1)->c_str()), 1);
+            frames_given = true;
+            args.erase(frames_arg, frames_arg + 2);
+        }
+    }
+
+    // [--record file | --replay file] works in any mode
+    string log_path;
+    InputLogMode log_mode = InputLogMode::Record;
+    for (const char* flag : { "--record", "--replay" })
+    {
+        auto log_arg = find(args.begin(), args.end(), string(flag));
+        if (log_arg != args.end() && log_arg + 1 != args.end())
+        {
+            log_mode = string(flag).compare("--record") == 0 ? InputLogMode::Record : InputLogMode::Replay;
+            log_path = *(log_arg + 1);
+            args.erase(log_arg, log_arg + 2);
+        }
+    }
+
+    // [--trace file] writes a Chrome trace of the first TraceFrames frames
+    string trace_path;
+    auto trace_arg = find(args.begin(), args.end(), string("--trace"));
+    if (trace_arg != args.end() && trace_arg + 1 != args.end())
+    {
+        trace_path = *(trace_arg + 1);
+        args.erase(trace_arg, trace_arg + 2);
+    }
+
+    // A replay runs to the end of the log unless told otherwise
+    if (log_mode == InputLogMode::Replay && !log_path.empty() && !frames_given)
+        headless_frames = INT_MAX;
+
     bool is_3d = false;
     bool run_tests = false;
+    int sim_w = WINDOW_WIDTH;
+    int sim_h = WINDOW_HEIGHT;
     int cube_w = _3D_FIELD_SIDE;
     int cube_h = _3D_FIELD_SIDE;
     int cube_d = _3D_FIELD_SIDE;
 
-    if (args.size() >= 1 && args[0].compare("3d") == 0)
+    if (headless && args.size() >= 1 && args[0].compare("2d") == 0)
+    {
+        if (args.size() >= 3)
+        {
+            sim_w = atoi(args[1].c_str());
+            sim_h = atoi(args[2].c_str());
+        }
+        else if (args.size() >= 2)
+        {
+            sim_w = sim_h = atoi(args[1].c_str());
+        }
+    }
+    else if (args.size() >= 1 && args[0].compare("3d") == 0)
     {
         is_3d = true;
 
@@ -92,11 +166,47 @@ int main(int argc, char* argv[])
     {
         IniConfig::Get().Print();
 
+        unique_ptr<InputLog> input_log;
+        if (!log_path.empty())
+        {
+            glm::ivec3 size = is_3d ? glm::ivec3(cube_w, cube_h, cube_d) : glm::ivec3(sim_w, sim_h, 0);
+            input_log = make_unique<InputLog>(log_mode, log_path, size);
+        }
+
+        if (!trace_path.empty())
+            TraceRecorder::Get().Start(trace_path, IniConfig::Get().TraceFrames);
+
         int ctrl_h = UI_WINDOW_HEIGHT;
         int ctrl_w = UI_WINDOW_WIDTH;
         ctrl_w -= is_3d ? 343 : 0;
 
-        if (!app.InitGLContexts(WINDOW_WIDTH, WINDOW_HEIGHT, !is_3d, ctrl_w, ctrl_h))
+        // The CPU backend doesn't need a GL context at all when there's nothing to display
+        if (headless && IniConfig::Get().SimulationBackend.compare("cpu") == 0)
+        {
+            SimulationVars vars;
+            ImpulseState impulse;
+
+            if (is_3d)
+            {
+                vars.Set3DDefaults(cube_w);
+                CPUSimulation3D sim(cube_w, cube_h, cube_d, &vars, &impulse, IniConfig::Get().CPUThreads);
+                RunHeadless(sim, vars, impulse, glm::ivec3(cube_w, cube_h, cube_d), headless_frames, input_log.get());
+            }
+            else
+            {
+                CPUSimulation2D sim(sim_w, sim_h, &vars, &impulse, IniConfig::Get().CPUThreads);
+                RunHeadless(sim, vars, impulse, glm::ivec3(sim_w, sim_h, 0), headless_frames, input_log.get());
+            }
+
+            return 0;
+        }
+
+        if (headless)
+        {
+            if (!app.InitHeadlessContext(sim_w, sim_h))
+                return -1;
+        }
+        else if (!app.InitGLContexts(WINDOW_WIDTH, WINDOW_HEIGHT, !is_3d, ctrl_w, ctrl_h))
         {
             return -1;
         }
@@ -110,12 +220,18 @@ int main(int argc, char* argv[])
                 return -1;
             }
 
-            sim->WindowLoop();
+            sim->SetInputLog(input_log.get());
+
+            if (headless)
+                sim->RunHeadless(headless_frames);
+            else
+                sim->WindowLoop();
+
             delete sim;
         }
         else
         {
-            InkBox2DSimulation* sim = new InkBox2DSimulation(app, WINDOW_WIDTH, WINDOW_HEIGHT);
+            InkBox2DSimulation* sim = new InkBox2DSimulation(app, sim_w, sim_h);
 
             if (!sim->CreateScene())
             {
@@ -123,7 +239,13 @@ int main(int argc, char* argv[])
                 return -1;
             }
 
-            sim->WindowLoop();
+            sim->SetInputLog(input_log.get());
+
+            if (headless)
+                sim->RunHeadless(headless_frames);
+            else
+                sim->WindowLoop();
+
             delete sim;
         }
     }
@@ -0,0 +1,191 @@
+#include "ProgramCache.h"
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+
+#include <glad/glad.h>
+
+#include "Common.h"
+#include "IniConfig.h"
+#include "Shader.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+#define PROGRAM_CACHE_MAGIC 0x43504249 // "IBPC"
+#define PROGRAM_CACHE_DRIVER_FILE "driver.txt"
+
+// FNV-1a, std::hash isn't guaranteed to give the same value in another build
+uint64_t _HashString(const string& s, uint64_t hash = 14695981039346656037ull)
+{
+    for (unsigned char c : s)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+string _GLString(GLenum name)
+{
+    const GLubyte* value = glGetString(name);
+    return value ? string((const char*)value) : string();
+}
+
+// Singleton
+ProgramCache& ProgramCache::Get()
+{
+    static ProgramCache cache;
+    return cache;
+}
+
+ProgramCache::ProgramCache()
+    : initialized(false)
+    , enabled(false)
+{
+}
+
+bool ProgramCache::IsEnabled()
+{
+    lock_guard<mutex> guard(lock);
+
+    if (!initialized)
+        Init();
+
+    return enabled;
+}
+
+void ProgramCache::Init()
+{
+    initialized = true;
+
+    if (IniConfig::Get().ShaderCacheDir.empty())
+        return;
+
+    int formats = 0;
+    _GL_WRAP2(glGetIntegerv, GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats == 0)
+    {
+        LOG_WARN("Shader cache disabled, %s can't save programs", _GLString(GL_RENDERER).c_str());
+        return;
+    }
+
+    driver = _GLString(GL_VENDOR) + " | " + _GLString(GL_RENDERER) + " | " + _GLString(GL_VERSION);
+    dir = IniConfig::Get().ShaderCacheDir;
+
+    error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec)
+    {
+        LOG_WARN("Shader cache disabled, could not create %s", dir.string().c_str());
+        return;
+    }
+
+    // Binaries from another driver would only be turned down one by one, drop them all at once
+    fs::path driver_file = dir / PROGRAM_CACHE_DRIVER_FILE;
+    string cached_driver;
+    {
+        ifstream fin(driver_file);
+        getline(fin, cached_driver);
+    }
+
+    if (cached_driver != driver)
+    {
+        for (const auto& entry : fs::directory_iterator(dir, ec))
+        {
+            if (entry.path().extension() == ".bin")
+                fs::remove(entry.path(), ec);
+        }
+
+        ofstream fout(driver_file, ios::out | ios::trunc);
+        fout << driver << endl;
+    }
+
+    enabled = true;
+    LOG_INFO("Shader cache: %s (%s)", dir.string().c_str(), driver.c_str());
+}
+
+string ProgramCache::Key(const vector<GLShader*>& shaders)
+{
+    if (!IsEnabled())
+        return string();
+
+    uint64_t hash = _HashString(driver);
+    for (const GLShader* shader : shaders)
+    {
+        glm::uvec3 local_size = shader->ComputeLocalSize();
+
+        stringstream key;
+        key << int(shader->Type()) << '|' << local_size.x << 'x' << local_size.y << 'x' << local_size.z
+            << '|' << shader->OverrideImageFormat() << '|';
+
+        hash = _HashString(key.str(), hash);
+        hash = _HashString(shader->SourceCode(), hash);
+    }
+
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+    return name;
+}
+
+fs::path ProgramCache::EntryPath(const string& key) const
+{
+    return dir / (key + ".bin");
+}
+
+bool ProgramCache::Load(unsigned int program, const string& key)
+{
+    ifstream fin(EntryPath(key), ios::in | ios::binary);
+    if (!fin.good())
+        return false;
+
+    uint32_t header[3] = {}; // Magic, binary format, length
+    fin.read((char*)header, sizeof(header));
+    if (!fin.good() || header[0] != PROGRAM_CACHE_MAGIC)
+        return false;
+
+    vector<char> binary(header[2]);
+    fin.read(binary.data(), binary.size());
+    if (!fin.good())
+        return false;
+
+    _GL_WRAP4(glProgramBinary, program, GLenum(header[1]), binary.data(), GLsizei(binary.size()));
+
+    // Not an error, the driver is free to turn down a binary and the program gets compiled
+    int success = 0;
+    _GL_WRAP3(glGetProgramiv, program, GL_LINK_STATUS, &success);
+    return success != 0;
+}
+
+void ProgramCache::Store(unsigned int program, const string& key)
+{
+    int length = 0;
+    _GL_WRAP3(glGetProgramiv, program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    vector<char> binary(length);
+    GLenum format = 0;
+    _GL_WRAP5(glGetProgramBinary, program, length, &length, &format, binary.data());
+
+    // Written next to the entry and moved over it, another instance may be reading the old one
+    fs::path path = EntryPath(key);
+    fs::path temp = path;
+    temp += ".tmp";
+
+    {
+        uint32_t header[3] = { PROGRAM_CACHE_MAGIC, uint32_t(format), uint32_t(length) };
+        ofstream fout(temp, ios::out | ios::binary | ios::trunc);
+        fout.write((const char*)header, sizeof(header));
+        fout.write(binary.data(), length);
+        if (!fout.good())
+            return;
+    }
+
+    error_code ec;
+    fs::rename(temp, path, ec);
+    if (ec)
+        fs::remove(temp, ec);
+}
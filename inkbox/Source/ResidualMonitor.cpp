@@ -0,0 +1,183 @@
+#include "ResidualMonitor.h"
+
+#include "Common.h"
+
+using namespace std;
+using namespace glm;
+
+///////////////////////////
+///     SolverStats     ///
+///////////////////////////
+
+SolverStats::SolverStats()
+    : PressureIterations(0)
+    , DiffusionIterations(0)
+    , MaxSpeed(-1)
+    , Substeps(1)
+    , TickRate(-1)
+    , ActiveBricks(-1)
+{
+}
+
+///////////////////////////
+///   ResidualMonitor   ///
+///////////////////////////
+
+ResidualMonitor::ResidualMonitor()
+    : partialsBuffer(0)
+    , maxPartials(0)
+    , head(0)
+    , count(0)
+    , planned(0)
+    , latestIterations(0)
+{
+    for (auto& rb : ring)
+    {
+        rb.Buffer = 0;
+        rb.Fence = nullptr;
+        rb.Iterations = 0;
+    }
+}
+
+ResidualMonitor::~ResidualMonitor()
+{
+    for (auto& rb : ring)
+    {
+        if (rb.Fence)
+            glDeleteSync(rb.Fence);
+
+        if (rb.Buffer != 0)
+        {
+            _GL_WRAP2(glDeleteBuffers, 1, &rb.Buffer);
+        }
+    }
+
+    if (partialsBuffer != 0)
+    {
+        _GL_WRAP2(glDeleteBuffers, 1, &partialsBuffer);
+    }
+}
+
+bool ResidualMonitor::Init()
+{
+    GLShader cs("3d\\reduce_residual.comp", ShaderType::Compute, uvec3(256, 1, 1));
+    if (!cs.Compile())
+        return false;
+
+    reduceShader.Init();
+    reduceShader.Attach(cs);
+    if (!reduceShader.Link())
+        return false;
+
+    reduceShader.Name = cs.FileName();
+    cs.Discard();
+
+    _GL_WRAP2(glGenBuffers, 1, &partialsBuffer);
+
+    for (auto& rb : ring)
+    {
+        _GL_WRAP2(glGenBuffers, 1, &rb.Buffer);
+        _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, rb.Buffer);
+        _GL_WRAP4(glBufferData, GL_SHADER_STORAGE_BUFFER, sizeof(vec2), nullptr, GL_STREAM_READ);
+    }
+
+    _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, 0);
+    return true;
+}
+
+int ResidualMonitor::Plan(float tolerance, int step, int max_iterations)
+{
+    // The first solves run to the limit until their residuals come back
+    if (planned <= 0)
+        planned = max_iterations;
+
+    // Moving from the count the measured solve ran rather than from the current plan keeps the
+    // solves still in flight from pushing it any further
+    if (Poll() && latestIterations > 0)
+        planned = latest.L2 <= tolerance ? latestIterations - step : latestIterations + step;
+
+    planned = min(max(planned, min(step, max_iterations)), max_iterations);
+    return planned;
+}
+
+void ResidualMonitor::BindPartials(int binding, int num_partials)
+{
+    // The field can be resized so grow the buffer on demand
+    if (num_partials > maxPartials)
+    {
+        maxPartials = num_partials;
+        _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, partialsBuffer);
+        _GL_WRAP4(glBufferData, GL_SHADER_STORAGE_BUFFER, sizeof(vec2) * maxPartials, nullptr, GL_DYNAMIC_COPY);
+        _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, binding, partialsBuffer);
+}
+
+void ResidualMonitor::Reduce(int num_partials, int num_cells)
+{
+    // Drop the oldest readback if the GPU is that far behind
+    if (count == RESIDUAL_READBACK_DEPTH)
+    {
+        Readback& oldest = ring[(head + RESIDUAL_READBACK_DEPTH - count) % RESIDUAL_READBACK_DEPTH];
+        glDeleteSync(oldest.Fence);
+        oldest.Fence = nullptr;
+        count--;
+    }
+
+    Readback& rb = ring[head];
+
+    _GL_WRAP1(glMemoryBarrier, GL_SHADER_STORAGE_BARRIER_BIT);
+    reduceShader.Use();
+    reduceShader.SetInt("num_partials", num_partials);
+    reduceShader.SetInt("num_cells", num_cells);
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, 0, partialsBuffer);
+    _GL_WRAP3(glBindBufferBase, GL_SHADER_STORAGE_BUFFER, 1, rb.Buffer);
+    _GL_WRAP3(glDispatchCompute, 1, 1, 1);
+    _GL_WRAP1(glMemoryBarrier, GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    rb.Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    rb.Iterations = planned;
+    head = (head + 1) % RESIDUAL_READBACK_DEPTH;
+    count++;
+
+    // Make sure the fence actually gets submitted, otherwise polling it can never succeed
+    _GL_WRAP0(glFlush);
+}
+
+ResidualNorms ResidualMonitor::Wait()
+{
+    _GL_WRAP0(glFinish);
+    Poll();
+    return latest;
+}
+
+bool ResidualMonitor::Poll()
+{
+    bool received = false;
+
+    while (count > 0)
+    {
+        Readback& rb = ring[(head + RESIDUAL_READBACK_DEPTH - count) % RESIDUAL_READBACK_DEPTH];
+
+        GLenum status = glClientWaitSync(rb.Fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        vec2 norms;
+        _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, rb.Buffer);
+        _GL_WRAP4(glGetBufferSubData, GL_SHADER_STORAGE_BUFFER, 0, sizeof(vec2), &norms[0]);
+        _GL_WRAP2(glBindBuffer, GL_SHADER_STORAGE_BUFFER, 0);
+
+        glDeleteSync(rb.Fence);
+        rb.Fence = nullptr;
+        count--;
+
+        latest.L2 = norms.x;
+        latest.Max = norms.y;
+        latestIterations = rb.Iterations;
+        received = true;
+    }
+
+    return received;
+}
@@ -1,7 +1,8 @@
 
 #include "Shader.h"
 
-#include <exception>
+#include <algorithm>
+#include <stdexcept>
 #include <fstream>
 #include <filesystem>
 #include <regex>
@@ -11,13 +12,22 @@
 
 #include "FBO.h"
 #include "Common.h"
+#include "GPUProfiler.h"
+#include "ProgramCache.h"
 #include "Utils.h"
 
 using namespace std;
 
 regex re_include("^[ \\t]*#include[ \\t]+[<\"]([\\.\\w]+?)[>\"][ \\t]*$", regex_constants::optimize | regex_constants::ECMAScript);
 regex re_local_size_decl("^[ \\t]*layout[ \\t]*\\([ \\t]*local_size_.*$", regex_constants::optimize | regex_constants::ECMAScript);
-regex re_image_format("^[ \\t]*layout[ \\t]*\\([ \\t]*r[a-z0-9_]+.*$", regex_constants::optimize | regex_constants::ECMAScript);
+regex re_image_format("^[ \\t]*layout[ \\t]*\\([ \\t]*(rgba|rg|r)[0-9][a-z0-9_]*.*$", regex_constants::optimize | regex_constants::ECMAScript);
+
+// The override only swaps the component type, e.g. rgba16f over a declared r16_snorm gives r16f,
+// so scalar images keep their single channel
+string _OverrideImageFormat(const string& override_format, const string& channels)
+{
+	return channels + override_format.substr(override_format.find_first_of("0123456789"));
+}
 
 
 ///////////////////////////
@@ -42,14 +52,19 @@ void GLShaderProgram::Init()
 	id = _GL_WRAP0(glCreateProgram);
 }
 
-void GLShaderProgram::Attach(const GLShader& shader)
+void GLShaderProgram::Attach(GLShader& shader)
 {
-	_GL_WRAP2(glAttachShader, id, shader.Id());
+	// Attached at link time, the shader may not be compiled yet
+	attached.push_back(&shader);
 }
 
 void GLShaderProgram::Detach(const GLShader& shader)
 {
-	_GL_WRAP2(glDetachShader, id, shader.Id());
+	auto pending = find(attached.begin(), attached.end(), &shader);
+	if (pending != attached.end())
+		attached.erase(pending);
+	else
+		_GL_WRAP2(glDetachShader, id, shader.Id());
 }
 
 void GLShaderProgram::Use()
@@ -140,11 +155,33 @@ void GLShaderProgram::LoadIncludeFile(const char* file)
 
 bool GLShaderProgram::Link()
 {
+	vector<GLShader*> shaders;
+	shaders.swap(attached);
+
+	ProgramCache& cache = ProgramCache::Get();
+	string key = cache.Key(shaders);
+	if (!key.empty() && cache.Load(id, key))
+		return true;
+
+	for (GLShader* shader : shaders)
+	{
+		if (shader->Id() == 0 && !shader->CompileSource())
+			return false;
+
+		_GL_WRAP2(glAttachShader, id, shader->Id());
+	}
+
+	if (!key.empty())
+		_GL_WRAP3(glProgramParameteri, id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
 	_GL_WRAP1(glLinkProgram, id);
 
 	if (HasLinkErrors())
 		return false;
 
+	if (!key.empty())
+		cache.Store(id, key);
+
 	return true;
 }
 
@@ -204,27 +241,33 @@ bool GLShaderProgram::Validate()
 ////////////////////////////
 ///        GLShader      ///
 ////////////////////////////
-GLShader::GLShader(const char* path, ShaderType shader_type, glm::uvec3 compute_local_size, std::string overrideImageFormat)
+GLShader::GLShader(const char* path, ShaderType shader_type, glm::uvec3 compute_local_size, std::string overrideImageFormat, std::vector<std::string> defines)
 	: id(0)
 	, type(shader_type)
 	, computeShaderLocalSize(compute_local_size)
 	, overrideImgFmt(overrideImageFormat)
+	, defines(defines)
 {
 	namespace fs = std::filesystem;
 
 	if (shader_type != ShaderType::Compute && (computeShaderLocalSize.x != 0 || computeShaderLocalSize.y != 0 || computeShaderLocalSize.z != 0))
 	{
-		throw exception("Local size values are only valid for compute shaders");
+		throw runtime_error("Local size values are only valid for compute shaders");
 	}
 
-	if (!filesystem::exists(path))
+	sourceFile = string(path);
+#ifndef _WIN32
+	// Shader paths are written with Windows separators
+	std::replace(sourceFile.begin(), sourceFile.end(), '\\', '/');
+#endif
+
+	if (!filesystem::exists(sourceFile))
 	{
-		throw exception("Shader file not found");
+		throw runtime_error("Shader file not found");
 	}
 
-	sourceFile = string(path);
-	fileName = fs::path(path).filename().string();
-	sourceCode = ProcessSourceCode(path);
+	fileName = fs::path(sourceFile).filename().string();
+	sourceCode = ProcessSourceCode(sourceFile);
 }
 
 string GLShader::ProcessSourceCode(std::string file)
@@ -238,12 +281,19 @@ string GLShader::ProcessSourceCode(std::string file)
 	ifstream fin(file);
 	while (getline(fin, ln))
 	{
-		if (regex_match(ln, match, re_include))
+		if (utils::StringStartsWith(ln, "#version"))
+		{
+			processed << ln << endl;
+
+			for (auto& define : defines)
+				processed << "#define " << define << endl;
+		}
+		else if (regex_match(ln, match, re_include))
 		{
 			string include_file_path = absolute(source_file).parent_path().append(filesystem::path(match[1].str()).filename().string()).string();
 			if (!filesystem::exists(include_file_path))
 			{
-				throw exception(string("Could not find include file: ").append(include_file_path).c_str());
+				throw runtime_error(string("Could not find include file: ").append(include_file_path).c_str());
 			}
 
 			processed << ProcessSourceCode(include_file_path) << endl;
@@ -261,8 +311,9 @@ string GLShader::ProcessSourceCode(std::string file)
 		}
 		else if (overrideImgFmt.length() > 0 && regex_match(ln, match, re_image_format))
 		{
-			processed << "layout(" << overrideImgFmt << ")" << endl;
-			LOG_INFO("Injected custom image format into shader %s: %s", file.c_str(), overrideImgFmt.c_str());
+			string format = _OverrideImageFormat(overrideImgFmt, match[1].str());
+			processed << "layout(" << format << ")" << endl;
+			LOG_INFO("Injected custom image format into shader %s: %s", file.c_str(), format.c_str());
 		}
 		else
 		{
@@ -274,6 +325,14 @@ string GLShader::ProcessSourceCode(std::string file)
 }
 
 bool GLShader::Compile()
+{
+	if (ProgramCache::Get().IsEnabled())
+		return true;
+
+	return CompileSource();
+}
+
+bool GLShader::CompileSource()
 {
 	int type_id;
 	switch (type)
@@ -332,15 +391,6 @@ bool GLShader::HasCompileErrors(int id)
 	return false;
 }
 
-void GLComputeShader::Init()
-{
-	GLShaderProgram::Init();
-#if MEASURE_CS_TIMES
-	_GL_WRAP2(glGenQueries, 1, &timeQuery0);
-	_GL_WRAP2(glGenQueries, 1, &timeQuery1);
-#endif
-}
-
 void GLComputeShader::Execute(int x, int y, int z)
 {
 	Execute(glm::uvec3(x, y, z));
@@ -348,29 +398,22 @@ void GLComputeShader::Execute(int x, int y, int z)
 
 void GLComputeShader::Execute(glm::uvec3 num_work_groups)
 {
+	Use();
 
-#if MEASURE_CS_TIMES
-	_GL_WRAP2(glQueryCounter, timeQuery0, GL_TIMESTAMP);
-#endif
+	// Fields written through images can be read back through samplers, e.g. by the advection
+	_GL_WRAP1(glMemoryBarrier, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
 
-	Use();
-	_GL_WRAP1(glMemoryBarrier, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	GPUProfiler::Scope pass(Name);
 	_GL_WRAP3(glDispatchCompute, num_work_groups.x, num_work_groups.y, num_work_groups.z);
+}
 
-#if MEASURE_CS_TIMES
-	_GL_WRAP2(glQueryCounter, timeQuery1, GL_TIMESTAMP);
-
-	int finished = 0;
-	while (!finished)
-	{
-		_GL_WRAP3(glGetQueryObjectiv, timeQuery1, GL_QUERY_RESULT_AVAILABLE, &finished);
-	}
+void GLComputeShader::ExecuteIndirect(unsigned int buffer, long long offset)
+{
+	Use();
 
-	uint64_t start, end;
-	_GL_WRAP3(glGetQueryObjectui64v, timeQuery0, GL_QUERY_RESULT, &start);
-	_GL_WRAP3(glGetQueryObjectui64v, timeQuery1, GL_QUERY_RESULT, &end);
+	_GL_WRAP1(glMemoryBarrier, GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
 
-	timing.TotalTime += double(end - start) / 1'000'000;
-	timing.NumExecutions++;
-#endif
+	GPUProfiler::Scope pass(Name);
+	_GL_WRAP2(glBindBuffer, GL_DISPATCH_INDIRECT_BUFFER, buffer);
+	_GL_WRAP1(glDispatchComputeIndirect, GLintptr(offset));
 }
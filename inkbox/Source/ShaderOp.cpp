@@ -4,6 +4,7 @@
 #include <glad/glad.h>
 
 #include "Common.h"
+#include "GPUProfiler.h"
 #include "ShaderOp.h"
 
 using namespace std;
@@ -47,6 +48,8 @@ void _QuadShaderOp<TFunc>::Compute()
 	program->Use();
 	outputFBO->Bind();
 	SetUniforms();
+
+	GPUProfiler::Scope pass(program->Name);
 	Draw();
 }
 
@@ -3,7 +3,9 @@
 #include <iostream>
 #include <thread>
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -11,7 +13,10 @@
 
 #include "Shader.h"
 #include "Common.h"
+#include "GPUProfiler.h"
 #include "IniConfig.h"
+#include "InputLog.h"
+#include "TraceRecorder.h"
 
 using namespace std;
 using namespace glm;
@@ -21,21 +26,52 @@ InkBox2DSimulation::InkBox2DSimulation(const InkBoxWindows& app, int width, int
     , height(height)
     , fbos(width, height)
     , window(app.Main)
-    , limiter(60)
+    , worker(app.Worker)
     , rdv(1.0f / width, 1.0f / height)
     , advection(width, height, 1.f/width)
+    , macCormack(width, height, 1.f/width)
     , poissonSolver(width, height, 1.f/width)
-    , gradient(width, height, 1.f/width)
+    , project(width, height, 1.f/width)
     , divergence(width, height, 1.f/width)
     , impulse(width, height, 1.f/width)
     , vorticity(width, height, 1.f/width)
     , delta_t(0)
     , paused(false)
+    , advectionType(ParseAdvectionType(IniConfig::Get().AdvectionScheme))
+    , backend(this)
+    , inputLog(nullptr)
+    , leftDown(false)
+    , rightDown(false)
+    , frameStale(true)
+    , publishedField(SimulationField::Ink)
+    , thumbnailsStale(true)
+    , nextThumbnails(0)
 {
     ui.SetValues(vars);
-    controlPanel = ControlPanel(app.Controls, &vars, &ui, &impulseState, &fbos.VelocityVis, &fbos.PressureVis, &fbos.InkVis, &fbos.VorticityVis);
+    panelVars = vars;
+    controlPanel = ControlPanel(app.Controls, &panelVars, &ui, &panelImpulse, nullptr, nullptr, nullptr, nullptr);
+    controlPanel.SetSolverStats(&panelStats);
+    CreateBackend();
 
-    glfwSetWindowUserPointer(app.Main, this);
+    if (app.Main)
+        glfwSetWindowUserPointer(app.Main, this);
+}
+
+void InkBox2DSimulation::CreateBackend()
+{
+    if (IniConfig::Get().SimulationBackend.compare("cpu") == 0)
+    {
+        cpuBackend = make_unique<CPUSimulation2D>(width, height, &vars, &impulseState, IniConfig::Get().CPUThreads);
+        uploadBuffer.resize(width * height * 3);
+        backend = cpuBackend.get();
+    }
+    else
+    {
+        if (IniConfig::Get().SimulationBackend.compare("gpu") != 0)
+            LOG_WARN("Unknown simulation backend '%s', using gpu", IniConfig::Get().SimulationBackend.c_str());
+
+        backend = this;
+    }
 }
 
 void InkBox2DSimulation::Terminate()
@@ -43,6 +79,27 @@ void InkBox2DSimulation::Terminate()
     glfwTerminate();
 }
 
+// The quad every pass draws, inset by the one cell border
+void _InitInnerQuad(VertexList& quad, int width, int height)
+{
+    vec2 c(1.f-1.5f/width, 1.f-1.5f/height);
+    float inner_vertices[] =
+    {
+         c.x, -c.y, 0.0f,   // top right
+         c.x,  c.y, 0.0f,   // bottom right
+        -c.x,  c.y, 0.0f,   // bottom left
+        -c.x, -c.y, 0.0f,   // top left 
+    };
+
+    unsigned int quad_indices[] =
+    {
+        0, 1, 3,
+        1, 2, 3
+    };
+
+    quad.Init(&inner_vertices[0], 12, &quad_indices[0], 6);
+}
+
 bool InkBox2DSimulation::CreateScene()
 {
     vec2 c(1.f-0.5f/width, 1.f-0.5f/height);
@@ -67,22 +124,7 @@ bool InkBox2DSimulation::CreateScene()
     borderR.Init(&outer_vertices[0], 12, right, 2);
 
 
-    c = vec2(1.f-1.5f/width, 1.f-1.5f/height);
-    float inner_vertices[] =
-    {
-         c.x, -c.y, 0.0f,   // top right
-         c.x,  c.y, 0.0f,   // bottom right
-        -c.x,  c.y, 0.0f,   // bottom left
-        -c.x, -c.y, 0.0f,   // top left 
-    };
-
-    unsigned int quad_indices[] =
-    {
-        0, 1, 3,
-        1, 2, 3
-    };
-
-    quad.Init(&inner_vertices[0], 12, &quad_indices[0], 6);
+    _InitInnerQuad(quad, width, height);
 
     // Create and compiler shaders
     if (!CreateShaderOps())
@@ -91,119 +133,342 @@ bool InkBox2DSimulation::CreateScene()
         return false;
     }
 
+    GPUProfiler::Get().Init(IniConfig::Get().GPUProfilerFrames);
+
     return true;
 }
 
-void InkBox2DSimulation::DrawQuad()
+void InkBox2DSimulation::DrawQuad(const string& pass)
+{
+    DrawQuad(pass, quad);
+}
+
+void InkBox2DSimulation::DrawQuad(const string& pass, VertexList& q)
 {
-    _GL_WRAP1(glBindVertexArray, quad.VAO);
+    GPUProfiler::Scope scope(pass);
+    _GL_WRAP1(glBindVertexArray, q.VAO);
     _GL_WRAP4(glDrawElements, GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
 }
 
 void InkBox2DSimulation::WindowLoop()
 {
-    double last_time = 0.f;
-    bool curr_paused = false;
-    SimulationField curr_view = vars.DisplayField;
+    TraceRecorder::SetThreadTrack(TraceTrack::Present);
 
-    while (!glfwWindowShouldClose(window))
-    {
-        glfwMakeContextCurrent(window);
+    // Still on the worker's context from InitGLContexts
+    for (auto& frame : presentFrames)
+        frame = make_unique<FBO>(width, height);
 
-        double now = glfwGetTime();
-        glfwPollEvents();
-        double timestep_eventpoll = glfwGetTime() - now;
+    for (auto& set : thumbnails)
+        set = make_unique<ThumbnailSet>(width, height);
+
+    shared.Vars = panelVars;
+    glfwMakeContextCurrent(nullptr);
+    StartSimulationThread();
 
-        now = glfwGetTime();
-        delta_t = last_time == 0 ? 0.016667 : (now - last_time) - timestep_eventpoll;
-        last_time = now;
+    glfwMakeContextCurrent(controlPanel.WindowPtr());
+    glfwSwapInterval(0); // The panel never holds up presenting
 
-        ProcessInputs();
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(1);
+    _InitInnerQuad(presentQuad, width, height);
 
-        if (!paused)
+    double panel_interval = 1.0 / max(IniConfig::Get().ControlPanelFPS, 1.f);
+    double next_panel = 0;
+
+    while (!glfwWindowShouldClose(window))
+    {
         {
-            if (vars.DropletsMode)
-                TickDropletsMode();
-
-            // Update velocity, pressure, and ink fields
-            ComputeFields();
-
-            // Create visualizations for each one
-
-            fbos.VelocityVis.Bind();
-            vectorVisShader.Use();
-            vectorVisShader.SetVec4("bias", vec4(0.5, 0.5, 0.5, 0.5));
-            vectorVisShader.SetVec4("scale", vec4(0.5, 0.5, 0.5, 0.5));
-            vectorVisShader.SetTexture("field", fbos.Velocity, 0);
-            DrawQuad();
-
-            fbos.InkVis.Bind();
-            vectorVisShader.Use();
-            vectorVisShader.SetVec4("bias", vec4(0, 0, 0, 0));
-            vectorVisShader.SetVec4("scale", vec4(1, 1, 1, 1));
-            vectorVisShader.SetTexture("field", fbos.Ink, 0);
-            DrawQuad();
-
-            fbos.PressureVis.Bind();
-            scalarVisShader.Use();
-            scalarVisShader.SetVec4("bias", vec4(0, 0, 0, 0));
-            scalarVisShader.SetVec4("scale", vec4(2, -1, -2, 1));
-            scalarVisShader.SetTexture("field", fbos.Pressure, 0);
-            fbos.Pressure.BindTexture(0);
-            DrawQuad();
-
-            fbos.VorticityVis.Bind();
-            scalarVisShader.SetVec4("scale", vec4(1, 1, -1, -1));
-            scalarVisShader.SetTexture("field", fbos.Vorticity, 0);
-            DrawQuad();
-
-            _GL_WRAP2(glBindFramebuffer, GL_FRAMEBUFFER, 0);
-            copyShader.Use();
-            copyShader.SetInt("field", 0);
-
-            fbos.Get(vars.DisplayField).BindTexture(0);
-            DrawQuad();
-            glfwSwapBuffers(window);
+            TraceRecorder::Scope trace("glfwPollEvents");
+            glfwPollEvents();
+        }
 
-            curr_paused = false;
+        {
+            TraceRecorder::Scope trace("ProcessInputs");
+            ProcessInputs();
         }
-        else if (!curr_paused || curr_view != vars.DisplayField)
+
         {
-            _GL_WRAP2(glBindFramebuffer, GL_FRAMEBUFFER, 0);
-            copyShader.Use();
-            copyShader.SetInt("field", 0);
+            TraceRecorder::Scope trace("Present");
+            Present();
+        }
 
-            fbos.Get(vars.DisplayField).BindTexture(0);
-            DrawQuad();
+        {
+            TraceRecorder::Scope trace("glfwSwapBuffers");
             glfwSwapBuffers(window);
+        }
 
-            curr_paused = true;
-            curr_view = vars.DisplayField;
+        double now = glfwGetTime();
+        if (now >= next_panel)
+        {
+            next_panel = now + panel_interval;
+            RenderControlPanel();
+            glfwMakeContextCurrent(window);
         }
+    }
 
-        // Sleep for a little bit if needed
-        limiter.Regulate();
+    simThread.Stop();
 
-        // Render control panel window
-        bool update, clear;
-        glfwMakeContextCurrent(controlPanel.WindowPtr());
-        controlPanel.Render(update, clear);
+    // The simulation's objects are deleted on the context they were made on
+    glfwMakeContextCurrent(worker);
+}
+
+void InkBox2DSimulation::StartSimulationThread()
+{
+    simThread.Start(worker, IniConfig::Get().SimulationTickRate, [this](float tick_time) { Tick(tick_time); });
+}
+
+void InkBox2DSimulation::Tick(float tick_time)
+{
+    bool tick_paused, clear, thumbnails_visible;
+    {
+        lock_guard<mutex> lock(shared.Lock);
+        vars = shared.Vars;
+        tick_paused = shared.Paused;
+        clear = shared.ClearRequested;
+        shared.ClearRequested = false;
+        thumbnails_visible = shared.ThumbnailsVisible;
+        impulseState.Update(cursorPos.x, cursorPos.y, leftDown, rightDown);
+    }
 
-        if (update)
-            ui.UpdateVars(vars);
+    if (clear)
+    {
+        backend->ClearFields();
+
+        if (cpuBackend)
+            UploadCPUFields();
+    }
+
+    if (!tick_paused)
+    {
+        if (vars.DropletsMode)
+            impulseState.TickDropletsMode(tick_time, width, height);
 
-        if (clear)
+        impulseState.PrepareFrame(vars, tick_time);
+
+        // Update velocity, pressure, and ink fields
+        double step_start = glfwGetTime();
+
+        // A finished replay hands control back to the mouse
+        if (!RunFrame(*backend, impulseState, scheduler, tick_time, inputLog))
+            inputLog = nullptr;
+
+        if (cpuBackend)
         {
-            fbos.Velocity.Clear();
-            fbos.Vorticity.Clear();
-            fbos.Pressure.Clear();
-            fbos.Ink.Clear();
+            TraceRecorder::Scope trace("UploadCPUFields");
+            UploadCPUFields();
         }
 
+        scheduler.Measure(glfwGetTime() - step_start);
+    }
+
+    if (clear || !tick_paused)
+    {
+        frameStale = true;
+        thumbnailsStale = true;
+    }
+
+    // Only the displayed field is visualized, while paused only when it was switched
+    if (frameStale || vars.DisplayField != publishedField)
+    {
+        int slot = frames.BeginWrite();
+        RenderVisualization(vars.DisplayField, *presentFrames[slot]);
+        frames.EndWrite();
+
+        frameStale = false;
+        publishedField = vars.DisplayField;
+    }
+
+    double now = glfwGetTime();
+    if (thumbnails_visible && thumbnailsStale && now >= nextThumbnails)
+    {
+        nextThumbnails = now + 1.0 / max(IniConfig::Get().ControlPanelFPS, 1.f);
+        thumbnailsStale = false;
+        RenderThumbnails();
+    }
+
+    lock_guard<mutex> lock(shared.Lock);
+    shared.Stats = backend->Stats();
+    shared.Stats.TickRate = simThread.MeasuredRate();
+    shared.Impulse = impulseState;
+}
+
+void InkBox2DSimulation::Present()
+{
+    _GL_WRAP2(glBindFramebuffer, GL_FRAMEBUFFER, 0);
+    _GL_WRAP4(glViewport, 0, 0, width, height);
+
+    int slot = frames.BeginRead();
+    if (slot < 0)
+    {
+        _GL_WRAP1(glClear, GL_COLOR_BUFFER_BIT);
+        return;
+    }
+
+    copyShader.Use();
+    copyShader.SetInt("field", 0);
+    presentFrames[slot]->BindTexture(0);
+
+    _GL_WRAP1(glBindVertexArray, presentQuad.VAO);
+    _GL_WRAP4(glDrawElements, GL_TRIANGLES, 6, GL_UNSIGNED_INT, nullptr);
+    frames.EndRead();
+}
+
+void InkBox2DSimulation::RenderControlPanel()
+{
+    {
+        lock_guard<mutex> lock(shared.Lock);
+        panelStats = shared.Stats;
+        panelImpulse = shared.Impulse;
+    }
+
+    bool update, clear;
+    glfwMakeContextCurrent(controlPanel.WindowPtr());
+    {
+        TraceRecorder::Scope trace("ControlPanel::Render");
+
+        // The panel draws the thumbnails in Render, the slot is fenced after it
+        int slot = thumbnailFrames.BeginRead();
+        if (slot >= 0)
+        {
+            ThumbnailSet& set = *thumbnails[slot];
+            controlPanel.SetThumbnails(&set.Velocity, &set.Pressure, &set.Ink, &set.Vorticity);
+        }
+
+        controlPanel.Render(update, clear);
+        thumbnailFrames.EndRead();
+    }
+
+    if (update)
+        ui.UpdateVars(panelVars);
+
+    {
+        lock_guard<mutex> lock(shared.Lock);
+        shared.Vars = panelVars;
+        shared.ClearRequested |= clear;
+        shared.ThumbnailsVisible = controlPanel.ThumbnailsVisible();
+    }
+
+    {
+        TraceRecorder::Scope trace("glfwSwapBuffers");
         glfwSwapBuffers(controlPanel.WindowPtr());
     }
 }
 
+void InkBox2DSimulation::RenderVisualization(SimulationField field, FBO& target)
+{
+    _GL_WRAP4(glViewport, 0, 0, target.Width(), target.Height());
+    target.Bind();
+
+    if (field == SimulationField::Velocity)
+    {
+        TraceRecorder::Scope trace("velocity_vis");
+        vectorVisShader.Use();
+        vectorVisShader.SetVec4("bias", vec4(0.5, 0.5, 0.5, 0.5));
+        vectorVisShader.SetVec4("scale", vec4(0.5, 0.5, 0.5, 0.5));
+        vectorVisShader.SetTexture("field", fbos.Velocity, 0);
+        DrawQuad("velocity_vis");
+    }
+    else if (field == SimulationField::Ink)
+    {
+        TraceRecorder::Scope trace("ink_vis");
+        vectorVisShader.Use();
+        vectorVisShader.SetVec4("bias", vec4(0, 0, 0, 0));
+        vectorVisShader.SetVec4("scale", vec4(1, 1, 1, 1));
+        vectorVisShader.SetTexture("field", fbos.Ink, 0);
+        DrawQuad("ink_vis");
+    }
+    else if (field == SimulationField::Pressure)
+    {
+        TraceRecorder::Scope trace("pressure_vis");
+        scalarVisShader.Use();
+        scalarVisShader.SetVec4("bias", vec4(0, 0, 0, 0));
+        scalarVisShader.SetVec4("scale", vec4(2, -1, -2, 1));
+        scalarVisShader.SetTexture("field", fbos.Pressure, 0);
+        DrawQuad("pressure_vis");
+    }
+    else
+    {
+        TraceRecorder::Scope trace("vorticity_vis");
+        scalarVisShader.Use();
+        scalarVisShader.SetVec4("bias", vec4(0, 0, 0, 0));
+        scalarVisShader.SetVec4("scale", vec4(1, 1, -1, -1));
+        scalarVisShader.SetTexture("field", fbos.Vorticity, 0);
+        DrawQuad("vorticity_vis");
+    }
+
+    // The simulation passes all draw at the field's size
+    _GL_WRAP4(glViewport, 0, 0, width, height);
+}
+
+void InkBox2DSimulation::RenderThumbnails()
+{
+    TraceRecorder::Scope trace("RenderThumbnails");
+
+    // Drawn straight at the small size, the fields' linear filtering does the downsampling
+    int slot = thumbnailFrames.BeginWrite();
+    ThumbnailSet& set = *thumbnails[slot];
+    RenderVisualization(SimulationField::Velocity, set.Velocity);
+    RenderVisualization(SimulationField::Ink, set.Ink);
+    RenderVisualization(SimulationField::Pressure, set.Pressure);
+    RenderVisualization(SimulationField::Vorticity, set.Vorticity);
+    thumbnailFrames.EndWrite();
+}
+
+HeadlessResult InkBox2DSimulation::RunHeadless(int frames, const ImpulseScript& script)
+{
+    _GL_WRAP4(glViewport, 0, 0, width, height);
+    return ::RunHeadless(*backend, vars, impulseState, ivec3(width, height, 0), frames, inputLog, script);
+}
+
+void InkBox2DSimulation::ClearFields()
+{
+    fbos.Velocity.Clear();
+    fbos.Vorticity.Clear();
+    fbos.Pressure.Clear();
+    fbos.Ink.Clear();
+}
+
+void InkBox2DSimulation::Finish()
+{
+    _GL_WRAP0(glFinish);
+}
+
+ResidualNorms InkBox2DSimulation::MeasurePressureResidual()
+{
+    if (backend != this)
+        return backend->MeasurePressureResidual();
+
+    MeasureResidual(fbos.Pressure.Front(), fbos.Divergence, -vars.GridScale * vars.GridScale, 4.0f, pressureMonitor);
+    return pressureMonitor.Wait();
+}
+
+void InkBox2DSimulation::UploadCPUFields()
+{
+    cpuBackend->ReadField(SimulationField::Velocity, uploadBuffer.data());
+    fbos.Velocity.Front().Upload(uploadBuffer.data());
+
+    cpuBackend->ReadField(SimulationField::Ink, uploadBuffer.data());
+    fbos.Ink.Front().Upload(uploadBuffer.data());
+
+    cpuBackend->ReadField(SimulationField::Pressure, uploadBuffer.data());
+    fbos.Pressure.Front().Upload(uploadBuffer.data());
+
+    cpuBackend->ReadField(SimulationField::Vorticity, uploadBuffer.data());
+    fbos.Vorticity.Upload(uploadBuffer.data());
+}
+
+void InkBox2DSimulation::ReadField(SimulationField field, float* rgb)
+{
+    if (field == SimulationField::Velocity)
+        fbos.Velocity.Front().Download(rgb);
+    else if (field == SimulationField::Pressure)
+        fbos.Pressure.Front().Download(rgb);
+    else if (field == SimulationField::Vorticity)
+        fbos.Vorticity.Download(rgb);
+    else
+        fbos.Ink.Front().Download(rgb);
+}
+
 void InkBox2DSimulation::SetDimensions(int w, int h)
 {
     width = w;
@@ -229,7 +494,7 @@ bool _AddFragShader(GLShaderProgram& program, GLShader& vShader, GLShader& fShad
 
 bool InkBox2DSimulation::CreateShaderOps()
 {
-#define ADD_SHADER(obj,file) { GLShader fs(file, ShaderType::Fragment); if (!_AddFragShader(obj, vs, fs)) return false; obj.Use(); obj.SetVec2("stride", rdv); }
+#define ADD_SHADER(obj,file) { GLShader fs(file, ShaderType::Fragment); if (!_AddFragShader(obj, vs, fs)) return false; obj.Name = fs.FileName(); obj.Use(); obj.SetVec2("stride", rdv); }
 
     GLShader vs("2d\\tex_coords.vert", ShaderType::Vertex);
     if (!vs.Compile())
@@ -238,10 +503,13 @@ bool InkBox2DSimulation::CreateShaderOps()
     ADD_SHADER(impulseShader,       "2d\\add_impulse.frag")
     ADD_SHADER(radialImpulseShader, "2d\\add_radial_impulse.frag")
     ADD_SHADER(advectionShader,     "2d\\advection.frag")
+    ADD_SHADER(macCormackShader,    "2d\\maccormack.frag")
     ADD_SHADER(jacobiShader,        "2d\\jacobi.frag")
+    ADD_SHADER(redBlackShader,      "2d\\redblack.frag")
+    ADD_SHADER(residualShader,      "2d\\residual.frag")
+    ADD_SHADER(prolongateShader,    "2d\\prolongate.frag")
     ADD_SHADER(divShader,           "2d\\divergence.frag")
-    ADD_SHADER(gradShader,          "2d\\gradient.frag")
-    ADD_SHADER(subtractShader,      "2d\\subtract.frag")
+    ADD_SHADER(projectShader,       "2d\\project.frag")
     ADD_SHADER(boundaryShader,      "2d\\boundary.frag")
     ADD_SHADER(vorticityShader,     "2d\\vorticity.frag")
     ADD_SHADER(addVorticityShader,  "2d\\add_vorticity.frag")
@@ -249,6 +517,44 @@ bool InkBox2DSimulation::CreateShaderOps()
     ADD_SHADER(scalarVisShader,     "2d\\scalar_vis.frag")
     ADD_SHADER(copyShader,          "2d\\copy.frag")
 
+    // Divergence with the first pressure iteration written to a second target
+    vector<string> fused_defines = { "FUSE_JACOBI" };
+    if (IniConfig::Get().PressureWarmStart)
+        fused_defines.push_back("WARM_START");
+
+    GLShader fused_fs("2d\\divergence.frag", ShaderType::Fragment, uvec3(), string(), fused_defines);
+    if (!_AddFragShader(divJacobiShader, vs, fused_fs))
+        return false;
+
+    divJacobiShader.Name = "divergence.frag (fused)";
+    divJacobiShader.Use();
+    divJacobiShader.SetVec2("stride", rdv);
+
+    GLShader rcs("2d\\residual_norm.comp", ShaderType::Compute, uvec3(RESIDUAL_GROUP_SIDE, RESIDUAL_GROUP_SIDE, 1));
+    if (!rcs.Compile())
+        return false;
+
+    residualNormShader.Init();
+    residualNormShader.Attach(rcs);
+    if (!residualNormShader.Link())
+        return false;
+
+    residualNormShader.Name = rcs.FileName();
+
+    GLShader scs("2d\\speed_norm.comp", ShaderType::Compute, uvec3(RESIDUAL_GROUP_SIDE, RESIDUAL_GROUP_SIDE, 1));
+    if (!scs.Compile())
+        return false;
+
+    speedNormShader.Init();
+    speedNormShader.Attach(scs);
+    if (!speedNormShader.Link())
+        return false;
+
+    speedNormShader.Name = scs.FileName();
+
+    if (!pressureMonitor.Init() || !velocityDiffusionMonitor.Init() || !inkDiffusionMonitor.Init() || !speedMonitor.Init())
+        return false;
+
     impulse.SetShader(&impulseShader);
     impulse.SetQuad(&quad);
     impulse.SetUniformsFunc([&](GLShaderProgram& sh) -> void {
@@ -271,6 +577,16 @@ bool InkBox2DSimulation::CreateShaderOps()
         sh.SetTexture("velocity", fbos.Velocity, 0);
     });
 
+    macCormack.SetShader(&macCormackShader);
+    macCormack.SetQuad(&quad);
+    macCormack.SetUniformsFunc([&](GLShaderProgram& sh) -> void {
+        sh.SetFloat("gs", vars.GridScale);
+        sh.SetVec2("rdv", rdv);
+        sh.SetFloat("delta_t", delta_t);
+        sh.SetTexture("velocity", fbos.Velocity, 0);
+        sh.SetTexture("forward", fbos.Temp, 2);
+    });
+
     vorticity.SetShader(&vorticityShader);
     vorticity.SetQuad(&quad);
     vorticity.SetOutput(&fbos.Vorticity);
@@ -292,13 +608,6 @@ bool InkBox2DSimulation::CreateShaderOps()
     poissonSolver.SetShader(&jacobiShader);
     poissonSolver.SetQuad(&quad);
 
-    gradient.SetShader(&gradShader);
-    gradient.SetQuad(&quad);
-    gradient.SetUniformsFunc([&](GLShaderProgram& sh) -> void {
-        sh.SetFloat("gs", vars.GridScale);
-        sh.SetTexture("field", fbos.Pressure, 0);
-    });
-
     divergence.SetShader(&divShader);
     divergence.SetQuad(&quad);
     divergence.SetUniformsFunc([&](GLShaderProgram& sh) -> void {
@@ -307,11 +616,12 @@ bool InkBox2DSimulation::CreateShaderOps()
     });
 
     // Calculate U = W - grad(P) where div(U)=0
-    subtract.SetShader(&subtractShader);
-    subtract.SetQuad(&quad);
-    subtract.SetUniformsFunc([&](GLShaderProgram& sh) -> void {
-        sh.SetTexture("a", fbos.Velocity, 0);
-        sh.SetTexture("b", fbos.Pressure.Back(), 1);
+    project.SetShader(&projectShader);
+    project.SetQuad(&quad);
+    project.SetUniformsFunc([&](GLShaderProgram& sh) -> void {
+        sh.SetFloat("gs", vars.GridScale);
+        sh.SetTexture("velocity", fbos.Velocity, 0);
+        sh.SetTexture("pressure", fbos.Pressure, 1);
     });
 
     return true;
@@ -339,7 +649,14 @@ void InkBox2DSimulation::ProcessInputs()
 
     double x = 0, y = 0;
     glfwGetCursorPos(window, &x, &y);
-    impulseState.Update(x, height - y, glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS, glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS);
+
+    {
+        lock_guard<mutex> lock(shared.Lock);
+        shared.Paused = paused;
+        cursorPos = vec2(x, height - y);
+        leftDown = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+        rightDown = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+    }
 
     int w = 0, h = 0;
     int ww = 0, wh = 0;
@@ -348,20 +665,71 @@ void InkBox2DSimulation::ProcessInputs()
     if (w != width || height != h)
     {
         // For now enforce a square viewport
-        width = h;
-        height = h;
-
         if (wh != ww)
             glfwSetWindowSize(window, wh, wh);
 
-        rdv = vec2(1.0f / width, 1.0f / height);
-        fbos.Resize(width, height, copyShader, quad);
-        LOG_INFO("Resized to %dx%d", width, height);
+        Resize(h, h);
+    }
+}
+
+void InkBox2DSimulation::Resize(int w, int h)
+{
+    // Everything that changes size belongs to the sim thread's context, take it over meanwhile
+    simThread.Stop();
+    glfwMakeContextCurrent(worker);
+
+    width = w;
+    height = h;
+    rdv = vec2(1.0f / width, 1.0f / height);
+    fbos.Resize(width, height, copyShader, quad);
+
+    for (auto& frame : presentFrames)
+        frame->Resize(width, height, copyShader, quad);
+
+    for (auto& set : thumbnails)
+        set->Resize(width, height, copyShader, quad);
+
+    frameStale = true;
+    thumbnailsStale = true;
+
+    // The CPU fields don't resize, start them over at the new size
+    if (cpuBackend)
+        CreateBackend();
+
+    glfwMakeContextCurrent(nullptr);
+    StartSimulationThread();
+    glfwMakeContextCurrent(window);
+
+    LOG_INFO("Resized to %dx%d", width, height);
+}
+
+void InkBox2DSimulation::Advect(SwapFBO& quantity, float dissipation)
+{
+    // MacCormack's forward pass goes to Temp as it is, the correction applies the dissipation
+    bool maccormack = advectionType == AdvectionType::MacCormack;
+
+    advection.Use();
+    advection.SetOutput(maccormack ? (IFBO*)&fbos.Temp : &quantity.Back());
+    advection.Shader().SetFloat("dissipation", maccormack ? 1.f : dissipation);
+    advection.Shader().SetTexture("quantity", quantity, 1);
+    advection.Compute();
+
+    if (maccormack)
+    {
+        macCormack.Use();
+        macCormack.SetOutput(&quantity.Back());
+        macCormack.Shader().SetFloat("dissipation", dissipation);
+        macCormack.Shader().SetTexture("quantity", quantity, 1);
+        macCormack.Compute();
     }
+
+    quantity.Swap();
 }
 
-void InkBox2DSimulation::ComputeFields()
+void InkBox2DSimulation::ComputeFields(float dt, float frame_fraction)
 {
+    delta_t = dt;
+
     if (!vars.SelfAdvect && !vars.AdvectInk && !vars.DiffuseVelocity && !vars.AddVorticity)
         return;
 
@@ -373,13 +741,7 @@ void InkBox2DSimulation::ComputeFields()
     if (vars.SelfAdvect)
     {
         ComputeBoundaryValues(fbos.Velocity, -1);
-
-        advection.Use();
-        advection.SetOutput(&fbos.Velocity.Back());
-        advection.Shader().SetFloat("dissipation", vars.AdvectionDissipation);
-        advection.Shader().SetTexture("quantity", fbos.Velocity, 1);
-        advection.Compute();
-        fbos.Velocity.Swap();
+        Advect(fbos.Velocity, pow(vars.AdvectionDissipation, frame_fraction));
     }
 
     /***************************/
@@ -388,13 +750,7 @@ void InkBox2DSimulation::ComputeFields()
     if (vars.AdvectInk)
     {
         ComputeBoundaryValues(fbos.Ink, 0);
-
-        advection.Use();
-        advection.SetOutput(&fbos.Ink.Back());
-        advection.Shader().SetFloat("dissipation", vars.InkAdvectionDissipation);
-        advection.Shader().SetTexture("quantity", fbos.Ink, 1);
-        advection.Compute();
-        fbos.Ink.Swap();
+        Advect(fbos.Ink, pow(vars.InkAdvectionDissipation, frame_fraction));
     }
 
     /**********************************/
@@ -428,16 +784,10 @@ void InkBox2DSimulation::ComputeFields()
 
         if (impulseState.InkActive)
         {
-            vec4 colour;
-            if (vars.RainbowMode)
-                colour = impulseState.TickRainbowMode(delta_t);
-            else
-                colour = vars.InkColour;
-
             impulse.Use();
             impulse.SetOutput(&fbos.Ink.Back());
             impulse.Shader().SetVec2("position", vec2(impulseState.CurrentPos.x, impulseState.CurrentPos.y) * rdv);
-            impulse.Shader().SetVec3("force", colour);
+            impulse.Shader().SetVec3("force", impulseState.Colour);
             impulse.Shader().SetFloat("radius", vars.InkVolume);
             impulse.Shader().SetTexture("velocity", fbos.Ink, 0);
             impulse.Compute();
@@ -467,38 +817,68 @@ void InkBox2DSimulation::ComputeFields()
     {
         float alpha = (vars.GridScale * vars.GridScale) / (vars.Viscosity * delta_t);
         float beta = alpha + 4.0f;
-        SolvePoissonSystem(fbos.Velocity, alpha, beta);
+        stats.DiffusionIterations = SolvePoissonSystem(fbos.Velocity, alpha, beta, velocityDiffusionMonitor);
+        stats.Diffusion = velocityDiffusionMonitor.Latest();
     }
 
     if (vars.DiffuseInk)
     {
         float alpha = (vars.GridScale * vars.GridScale) / (vars.InkViscosity * delta_t);
         float beta = alpha + 4.0;
-        SolvePoissonSystem(fbos.Ink, alpha, beta);
+        SolvePoissonSystem(fbos.Ink, alpha, beta, inkDiffusionMonitor);
     }
 
     /***************************/
     /******** PROJECTION *******/
     /***************************/
 
-    // Calculate div(W)
-    divergence.SetOutput(&fbos.Velocity.Back());
-    divergence.Compute();
+    // Calculate div(W). The solver reads it straight from the Divergence FBO.
+    float pressure_alpha = -vars.GridScale * vars.GridScale;
+    int pressure_iterations = 0;
+
+    if (IniConfig::Get().FuseDivergenceJacobi)
+    {
+        // The first pressure iteration comes out of the same pass
+        fbos.Divergence.BindWith(fbos.Pressure.Back());
+        divJacobiShader.Use();
+        divJacobiShader.SetFloat("gs", vars.GridScale);
+        divJacobiShader.SetFloat("alpha", pressure_alpha);
+        divJacobiShader.SetFloat("beta", 4.0f);
+        divJacobiShader.SetTexture("field", fbos.Velocity, 0);
+        if (IniConfig::Get().PressureWarmStart)
+            divJacobiShader.SetTexture("pressure", fbos.Pressure, 1);
+
+        DrawQuad(divJacobiShader.Name);
+        fbos.Pressure.Swap();
+        pressure_iterations = 1;
+    }
+    else
+    {
+        if (!IniConfig::Get().PressureWarmStart)
+            fbos.Pressure.Front().Clear();
+
+        divergence.SetOutput(&fbos.Divergence);
+        divergence.Compute();
+    }
 
     // Solve for P in: Laplacian(P) = div(W)
-    SolvePoissonSystem(fbos.Pressure, fbos.Velocity.Back(), -vars.GridScale * vars.GridScale, 4.0f);
+    if (vars.PressureSolver == PressureSolverType::Multigrid)
+        stats.PressureIterations = SolvePressureMultigrid(fbos.Pressure, fbos.Divergence, pressure_alpha);
+    else
+        stats.PressureIterations = SolvePoissonSystem(fbos.Pressure, fbos.Divergence, pressure_alpha, 4.0f, pressureMonitor, pressure_iterations,
+            vars.PressureSolver == PressureSolverType::RedBlack);
 
-    // Calculate grad(P)
-    gradient.SetOutput(&fbos.Pressure.Back());
-    gradient.Compute();
-    // No swap, back buffer has the gradient
+    stats.Pressure = pressureMonitor.Latest();
 
     // Calculate U = W - grad(P) where div(U)=0
-    subtract.SetOutput(&fbos.Velocity.Back());
-    subtract.Compute();
+    project.SetOutput(&fbos.Velocity.Back());
+    project.Compute();
     fbos.Velocity.Swap();
     
     ComputeBoundaryValues(fbos.Velocity, -1);
+
+    if (IniConfig::Get().AdaptiveTimestep)
+        MeasureMaxSpeed();
 }
 
 void InkBox2DSimulation::ComputeBoundaryValues(SwapFBO& swap, float scale)
@@ -507,6 +887,8 @@ void InkBox2DSimulation::ComputeBoundaryValues(SwapFBO& swap, float scale)
         return;
 
     CopyFBO(swap.Back(), swap.Front());
+
+    GPUProfiler::Scope pass(boundaryShader.Name);
     boundaryShader.Use();
     boundaryShader.SetVec2("rdv", rdv);
     boundaryShader.SetTexture("field", swap.Front(), 0);
@@ -533,74 +915,254 @@ void InkBox2DSimulation::ComputeBoundaryValues(SwapFBO& swap, float scale)
     swap.Swap();
 }
 
-void InkBox2DSimulation::SolvePoissonSystem(SwapFBO& swap, FBO& initial_value, float alpha, float beta)
+int InkBox2DSimulation::SolvePoissonSystem(SwapFBO& swap, FBO& b, float alpha, float beta, ResidualMonitor& monitor, int iterations, bool red_black)
+{
+    FBO* x = &swap.Front();
+    FBO* scratch = &swap.Back();
+    iterations = SolvePoissonSystem(x, scratch, b, alpha, beta, monitor, iterations, red_black);
+
+    if (x != &swap.Front())
+        swap.Swap();
+
+    return iterations;
+}
+
+int InkBox2DSimulation::SolvePoissonSystem(SwapFBO& swap, float alpha, float beta, ResidualMonitor& monitor)
+{
+    // The field is its own b so it has to stay put. Rather than copy it somewhere first, the first
+    // iteration reads it into the back buffer and the rest alternate between the back buffer and Temp.
+    FBO& b = swap.Front();
+    FBO* x = &b;
+    FBO* scratch = &swap.Back();
+    RelaxPoissonSystem(x, scratch, b, alpha, beta, rdv, 1);
+
+    scratch = &fbos.Temp;
+    int iterations = SolvePoissonSystem(x, scratch, b, alpha, beta, monitor, 1);
+
+    // One more iteration is cheaper than copying the result out of Temp
+    if (x == &fbos.Temp)
+    {
+        RelaxPoissonSystem(x, scratch, b, alpha, beta, rdv, 1);
+        iterations++;
+    }
+
+    swap.Swap();
+    return iterations;
+}
+
+int InkBox2DSimulation::SolvePoissonSystem(FBO*& x, FBO*& scratch, FBO& b, float alpha, float beta, ResidualMonitor& monitor, int iterations, bool red_black)
+{
+    auto relax = [&](int n)
+    {
+        if (red_black)
+            RelaxRedBlack(x, scratch, b, alpha, beta, n);
+        else
+            RelaxPoissonSystem(x, scratch, b, alpha, beta, rdv, n);
+    };
+
+    // A red-black iteration is two passes and does about as much as two Jacobi ones, so it runs
+    // half as many
+    int rounds = NUM_JACOBI_ROUNDS & (~0x1);
+    int most_iterations = IniConfig::Get().MaxJacobiIterations;
+    if (red_black)
+    {
+        rounds /= 2;
+        most_iterations = max(most_iterations / 2, 1);
+    }
+
+    float tolerance = IniConfig::Get().ResidualTolerance;
+    if (tolerance <= 0)
+    {
+        int n = max(rounds - iterations, 0);
+        relax(n);
+        return iterations + n;
+    }
+
+    // The residuals of the last few solves pick the iteration count and this one's residual is
+    // measured at the end. Readbacks never wait on the GPU so they're a frame or two behind.
+    int max_iterations = monitor.Plan(tolerance, max(IniConfig::Get().ResidualPlanStep, 1), most_iterations);
+    int n = max(max_iterations - iterations, 0);
+    relax(n);
+    MeasureResidual(*x, b, alpha, beta, monitor);
+
+    return iterations + n;
+}
+
+void InkBox2DSimulation::MeasureResidual(FBO& x, FBO& b, float alpha, float beta, ResidualMonitor& monitor)
+{
+    uvec3 groups((width + RESIDUAL_GROUP_SIDE - 1) / RESIDUAL_GROUP_SIDE, (height + RESIDUAL_GROUP_SIDE - 1) / RESIDUAL_GROUP_SIDE, 1);
+
+    residualNormShader.Use();
+    residualNormShader.SetFloat("alpha", alpha);
+    residualNormShader.SetFloat("beta", beta);
+    residualNormShader.SetTexture("x", x, 0);
+    residualNormShader.SetTexture("b", b, 1);
+    monitor.BindPartials(0, groups.x * groups.y);
+    residualNormShader.Execute(groups);
+    monitor.Reduce(groups.x * groups.y, width * height);
+}
+
+void InkBox2DSimulation::MeasureMaxSpeed()
+{
+    uvec3 groups((width + RESIDUAL_GROUP_SIDE - 1) / RESIDUAL_GROUP_SIDE, (height + RESIDUAL_GROUP_SIDE - 1) / RESIDUAL_GROUP_SIDE, 1);
+
+    speedNormShader.Use();
+    speedNormShader.SetTexture("velocity", fbos.Velocity, 0);
+    speedMonitor.BindPartials(0, groups.x * groups.y);
+    speedNormShader.Execute(groups);
+    speedMonitor.Reduce(groups.x * groups.y, width * height);
+
+    // The readback is a few frames old, close enough for picking the next step size. Velocity is
+    // in texture coordinates, the back-trace distance in texels scales with the grid.
+    speedMonitor.Poll();
+    if (speedMonitor.Latest().IsValid())
+        stats.MaxSpeed = vars.GridScale * max(width, height) * speedMonitor.Latest().Max;
+}
+
+void InkBox2DSimulation::RelaxPoissonSystem(SwapFBO& swap, FBO& b, float alpha, float beta, vec2 stride, VertexList& q, int iterations)
+{
+    FBO* x = &swap.Front();
+    FBO* scratch = &swap.Back();
+    poissonSolver.SetQuad(&q);
+    RelaxPoissonSystem(x, scratch, b, alpha, beta, stride, iterations);
+    poissonSolver.SetQuad(&quad);
+
+    if (x != &swap.Front())
+        swap.Swap();
+}
+
+void InkBox2DSimulation::RelaxPoissonSystem(FBO*& x, FBO*& scratch, FBO& b, float alpha, float beta, vec2 stride, int iterations)
 {
-    CopyFBO(fbos.Temp, initial_value);
     poissonSolver.Use();
+    poissonSolver.Shader().SetVec2("stride", stride);
     poissonSolver.Shader().SetFloat("alpha", alpha);
     poissonSolver.Shader().SetFloat("beta", beta);
-    poissonSolver.Shader().SetTexture("b", fbos.Temp, 1);
+    poissonSolver.Shader().SetTexture("b", b, 1);
 
-    for (int i = 0; i < (NUM_JACOBI_ROUNDS & (~0x1)); i++)
+    for (int i = 0; i < iterations; i++)
     {
-        swap.Back().Bind();
-        poissonSolver.Shader().SetTexture("x", swap.Front(), 0);
+        scratch->Bind();
+        poissonSolver.Shader().SetTexture("x", *x, 0);
+
+        GPUProfiler::Scope pass(poissonSolver.Shader().Name);
         poissonSolver.Draw();
-        swap.Swap();
+        std::swap(x, scratch);
     }
 }
 
-void InkBox2DSimulation::SolvePoissonSystem(SwapFBO& swap, float alpha, float beta)
+// Each iteration is a red pass into scratch and a black pass back into x, so x stays put
+void InkBox2DSimulation::RelaxRedBlack(FBO*& x, FBO*& scratch, FBO& b, float alpha, float beta, int iterations)
 {
-    SolvePoissonSystem(swap, swap.Front(), alpha, beta);
+    redBlackShader.Use();
+    redBlackShader.SetFloat("alpha", alpha);
+    redBlackShader.SetFloat("beta", beta);
+    redBlackShader.SetFloat("omega", vars.SOROmega);
+    redBlackShader.SetTexture("b", b, 1);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        for (int parity = 0; parity < 2; parity++)
+        {
+            FBO* src = parity == 0 ? x : scratch;
+            FBO* dest = parity == 0 ? scratch : x;
+
+            dest->Bind();
+            redBlackShader.SetInt("parity", parity);
+            redBlackShader.SetTexture("x", *src, 0);
+            DrawQuad(redBlackShader.Name);
+        }
+    }
 }
 
-vec2 InkBox2DSimulation::RandPos()
+int InkBox2DSimulation::SolvePressureMultigrid(SwapFBO& swap, FBO& initial_value, float alpha)
 {
-    int x = rand() % width;
-    int y = rand() % height;
-    return vec2(x, y);
+    // With a tolerance set the last few solves' residuals pick the number of cycles, like the
+    // Jacobi iterations
+    float tolerance = IniConfig::Get().ResidualTolerance;
+    int max_cycles = IniConfig::Get().MultigridCycles;
+    if (tolerance > 0)
+        max_cycles = pressureMonitor.Plan(tolerance, 1, max_cycles);
+
+    for (int cycle = 0; cycle < max_cycles; cycle++)
+    {
+        VCycle(swap, initial_value, 0, alpha, width, height);
+
+        // The coarse levels leave their own viewport behind
+        _GL_WRAP4(glViewport, 0, 0, width, height);
+    }
+
+    if (tolerance > 0)
+        MeasureResidual(swap.Front(), initial_value, alpha, 4.0f, pressureMonitor);
+
+    return max_cycles;
 }
 
-void InkBox2DSimulation::TickDropletsMode()
+void InkBox2DSimulation::VCycle(SwapFBO& x, FBO& b, int level, float alpha, int w, int h)
 {
-    static float acc = 0;
-    static float next_drop = 0;
-    static ivec2 freq_range(200, 1000);
+    // Pressure system only: beta*x - sum(neighbours) = alpha*b with beta = 4 and alpha = -(grid scale)^2
+    const float beta = 4.0f;
+    int smoothing = IniConfig::Get().MultigridSmoothingIterations;
+    vec2 stride(1.0f / w, 1.0f / h);
 
-    acc += delta_t * 1000;
-    if (acc >= next_drop)
-    {
-        acc = 0;
-        float delay = IniConfig::Get().DropletsModeDelay * 1000;
-        next_drop = delay + pow(-1, rand() % 2) * (rand() % int(0.5 * delay));
-        //LOG_INFO("Next drop: %.2f", next_drop);
+    // Each level only relaxes inside its own border, which holds the error at 0
+    VertexList& level_quad = level == 0 ? quad : fbos.Multigrid[level - 1]->Quad;
 
-        vec2 rand_pos0, rand_pos1;
-        rand_pos0 = RandPos();
-        rand_pos1 = RandPos();
-        impulseState.LastPos = vec3(rand_pos0.x, rand_pos0.y, 0);
-        impulseState.CurrentPos = vec3(rand_pos1.x, rand_pos1.y, 0);
-        impulseState.Delta = impulseState.CurrentPos - impulseState.LastPos;
-        impulseState.ForceActive = true;
-        impulseState.InkActive = true;
-        impulseState.Radial = true;
-    }
-    else
+    _GL_WRAP4(glViewport, 0, 0, w, h);
+
+    if (level == int(fbos.Multigrid.size()))
     {
-        impulseState.ForceActive = false;
-        impulseState.InkActive = false;
-        impulseState.Radial = false;
+        // Coarsest level, just relax it a bunch
+        RelaxPoissonSystem(x, b, alpha, beta, stride, level_quad, smoothing * 4);
+        return;
     }
+
+    // Pre-smoothing
+    RelaxPoissonSystem(x, b, alpha, beta, stride, level_quad, smoothing);
+
+    // r = b - Ax, the back buffer is free until the next relaxation
+    residualShader.Use();
+    residualShader.SetVec2("stride", stride);
+    residualShader.SetFloat("alpha", alpha);
+    residualShader.SetFloat("beta", beta);
+    residualShader.SetTexture("x", x.Front(), 0);
+    residualShader.SetTexture("b", b, 1);
+    x.Back().Bind();
+    DrawQuad(residualShader.Name, level_quad);
+
+    // Restriction: sampling the fine residual at the coarse texel centers averages 2x2 texels
+    MultigridLevel& coarse = *fbos.Multigrid[level];
+    _GL_WRAP4(glViewport, 0, 0, coarse.Width, coarse.Height);
+    CopyFBO(coarse.Rhs, x.Back(), coarse.Quad);
+    coarse.Error.Clear();
+
+    float ratio = float(w) / coarse.Width;
+    VCycle(coarse.Error, coarse.Rhs, level + 1, alpha * ratio * ratio, coarse.Width, coarse.Height);
+
+    // Prolongation: bilinearly interpolate the coarse error and correct x
+    _GL_WRAP4(glViewport, 0, 0, w, h);
+    prolongateShader.Use();
+    prolongateShader.SetTexture("x", x.Front(), 0);
+    prolongateShader.SetTexture("e", coarse.Error.Front(), 1);
+    x.Back().Bind();
+    DrawQuad(prolongateShader.Name, level_quad);
+    x.Swap();
+
+    // Post-smoothing
+    RelaxPoissonSystem(x, b, alpha, beta, stride, level_quad, smoothing);
 }
 
 void InkBox2DSimulation::CopyFBO(FBO& dest, FBO& src)
+{
+    CopyFBO(dest, src, quad);
+}
+
+void InkBox2DSimulation::CopyFBO(FBO& dest, FBO& src, VertexList& q)
 {
     dest.Bind();
     copyShader.Use();
     copyShader.SetInt("field", 0);
     src.BindTexture(0);
-    DrawQuad();
+    DrawQuad(copyShader.Name, q);
 }
 
 ///////////////////////////////
@@ -609,38 +1171,76 @@ void InkBox2DSimulation::CopyFBO(FBO& dest, FBO& src)
 
 SimulationFields::SimulationFields(int width, int height, int depth)
     : Velocity(width, height, depth)
-    , Pressure(width, height, depth)
-    , Vorticity(width, height, depth)
+    , Pressure(width, height, depth, 1)
+    , Divergence(width, height, depth, 1)
+    , Vorticity(width, height, depth, 1)
     , Ink(width, height, depth)
-    , VelocityVis(width, height, depth)
-    , PressureVis(width, height, depth)
-    , InkVis(width, height, depth)
-    , VorticityVis(width, height, depth)
     , Temp(width, height, depth)
 {
-}
-
-FBO& SimulationFields::Get(SimulationField field)
-{
-    if (field == SimulationField::Velocity)
-        return VelocityVis;
-    else if (field == SimulationField::Ink)
-        return InkVis;
-    else if (field == SimulationField::Vorticity)
-        return VorticityVis;
-    else
-        return PressureVis;
+    CreateMultigridLevels(width, height);
 }
 
 void SimulationFields::Resize(int w, int h, GLShaderProgram& shader, VertexList& quad)
 {
     Velocity.Resize(w, h, shader, quad);
     Pressure.Resize(w, h, shader, quad);
+    Divergence.Resize(w, h, shader, quad);
     Vorticity.Resize(w, h, shader, quad);
     Ink.Resize(w, h, shader, quad);
-    VelocityVis.Resize(w, h, shader, quad);
-    PressureVis.Resize(w, h, shader, quad);
-    InkVis.Resize(w, h, shader, quad);
-    VorticityVis.Resize(w, h, shader, quad);
     Temp.Resize(w, h, shader, quad);
+    CreateMultigridLevels(w, h);
+}
+
+void SimulationFields::CreateMultigridLevels(int w, int h)
+{
+    Multigrid.clear();
+
+    int max_levels = IniConfig::Get().MultigridLevels;
+    while (int(Multigrid.size()) < max_levels && min(w, h) / 2 >= MULTIGRID_MIN_SIDE)
+    {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        Multigrid.push_back(make_unique<MultigridLevel>(w, h));
+    }
+
+    // Creating an FBO changes the viewport
+    _GL_WRAP4(glViewport, 0, 0, Velocity.Front().Width(), Velocity.Front().Height());
+}
+
+///////////////////////////////
+///       ThumbnailSet      ///
+///////////////////////////////
+
+int _ThumbnailHeight(int width, int height)
+{
+    return max(1, THUMBNAIL_WIDTH * height / width);
+}
+
+ThumbnailSet::ThumbnailSet(int width, int height)
+    : Velocity(THUMBNAIL_WIDTH, _ThumbnailHeight(width, height))
+    , Pressure(THUMBNAIL_WIDTH, _ThumbnailHeight(width, height))
+    , Vorticity(THUMBNAIL_WIDTH, _ThumbnailHeight(width, height))
+    , Ink(THUMBNAIL_WIDTH, _ThumbnailHeight(width, height))
+{
+}
+
+void ThumbnailSet::Resize(int w, int h, GLShaderProgram& shader, VertexList& quad)
+{
+    Velocity.Resize(THUMBNAIL_WIDTH, _ThumbnailHeight(w, h), shader, quad);
+    Pressure.Resize(THUMBNAIL_WIDTH, _ThumbnailHeight(w, h), shader, quad);
+    Vorticity.Resize(THUMBNAIL_WIDTH, _ThumbnailHeight(w, h), shader, quad);
+    Ink.Resize(THUMBNAIL_WIDTH, _ThumbnailHeight(w, h), shader, quad);
+}
+
+///////////////////////////////
+///      MultigridLevel     ///
+///////////////////////////////
+
+MultigridLevel::MultigridLevel(int width, int height)
+    : Error(width, height, 0, 1)
+    , Rhs(width, height, 0, 1)
+    , Width(width)
+    , Height(height)
+{
+    _InitInnerQuad(Quad, width, height);
 }
@@ -1,5 +1,4 @@
 
-#include <cstdlib>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
@@ -10,38 +9,67 @@
 
 #include "Simulation3D.h"
 #include "Utils.h"
+#include "GPUProfiler.h"
 #include "IniConfig.h"
+#include "InputLog.h"
+#include "TraceRecorder.h"
 
 using namespace std;
 using namespace glm;
 
-vector<GLComputeShader*> compute_shaders;
-
 InkBox3DSimulation::InkBox3DSimulation(const InkBoxWindows& app, int width, int height, int depth)
     : window(app.Main)
+    , worker(app.Worker)
     , width(width)
     , height(height)
     , depth(depth)
     , textures(width, height, depth)
-    , limiter(60)
     , scrollAcc(0)
-    , delta_t(0)
     , paused(0)
     , computeLocalSize(4, 4, 4)
+    , jacobiSweeps(0)
+    , advectionType(AdvectionType::Trilinear)
+    , backend(this)
+    , inputLog(nullptr)
+    , picked(false)
+    , dropNow(false)
 {
-    glfwGetWindowSize(window, &wwidth, &wheight);
+    if (window)
+    {
+        glfwGetWindowSize(window, &wwidth, &wheight);
+    }
+    else
+    {
+        wwidth = int(app.ViewportSize.x);
+        wheight = int(app.ViewportSize.y);
+    }
+
     computeWorkGroups = uvec3(width / computeLocalSize.x, height / computeLocalSize.y, depth / computeLocalSize.z);
+    redBlackWorkGroups = uvec3(((width + 1) / 2 + computeLocalSize.x - 1) / computeLocalSize.x, computeWorkGroups.y, computeWorkGroups.z);
 
-    vars.GridScale = 1.0f / width;
-    vars.Viscosity = 0.0004;
-    vars.InkViscosity = 0.0005;
-    vars.BoundariesEnabled = false;
-    vars.SplatRadius = width * 0.37;
-    vars.InkVolume = width * 0.37;
-    vars.Gravity = 8;
-    vars.InkColour = vec4(1, 1, 1, 1);
+    vars.Set3DDefaults(width);
     ui.SetValues(vars);
-    controlPanel = ControlPanel(app.Controls, &vars, &ui, &impulseState);
+    panelVars = vars;
+    controlPanel = ControlPanel(app.Controls, &panelVars, &ui, &panelImpulse);
+    controlPanel.SetSolverStats(&panelStats);
+    CreateBackend();
+}
+
+void InkBox3DSimulation::CreateBackend()
+{
+    if (IniConfig::Get().SimulationBackend.compare("cpu") == 0)
+    {
+        cpuBackend = make_unique<CPUSimulation3D>(width, height, depth, &vars, &impulseState, IniConfig::Get().CPUThreads);
+        uploadBuffer.resize(size_t(width) * height * depth * 4);
+        backend = cpuBackend.get();
+    }
+    else
+    {
+        if (IniConfig::Get().SimulationBackend.compare("gpu") != 0)
+            LOG_WARN("Unknown simulation backend '%s', using gpu", IniConfig::Get().SimulationBackend.c_str());
+
+        backend = this;
+    }
 }
 
 void ScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
@@ -67,11 +95,9 @@ void PrintVec4(vec4 vec)
     printf("\t%.3f   %.3f   %.3f   %.3f\n", vec[0], vec[1], vec[2], vec[3]);
 }
 
-bool _InitComputeShader(const char* file, GLComputeShader& program, uvec3 local_size, string img_format)
+bool _InitComputeShader(const char* file, GLComputeShader& program, uvec3 local_size, string img_format, vector<string> defines = vector<string>())
 {
-
-
-    GLShader cs(file, ShaderType::Compute, local_size, img_format);
+    GLShader cs(file, ShaderType::Compute, local_size, img_format, defines);
 
     if (!cs.Compile())
         return false;
@@ -82,14 +108,13 @@ bool _InitComputeShader(const char* file, GLComputeShader& program, uvec3 local_
         return false;
 
     program.Name = cs.FileName();
-    compute_shaders.push_back(&program);
     return true;
 }
 
 
-bool _InitFragmentShader(const char* file, GLShader& vs, GLShaderProgram& program, string img_format)
+bool _InitFragmentShader(const char* file, GLShader& vs, GLShaderProgram& program, string img_format, vector<string> defines = vector<string>())
 {
-    GLShader fs(file, ShaderType::Fragment, uvec3(), img_format);
+    GLShader fs(file, ShaderType::Fragment, uvec3(), img_format, defines);
     if (!fs.Compile())
         return false;
 
@@ -99,10 +124,160 @@ bool _InitFragmentShader(const char* file, GLShader& vs, GLShaderProgram& progra
     if (!program.Link())
         return false;
 
+    program.Name = fs.FileName();
     return true;
 }
 
 bool InkBox3DSimulation::CreateScene()
+{
+    cubeModel = mat4(1.0f);
+    cubeModel = scale(cubeModel, vec3(1.0f, float(height) / width, float(depth) / width));
+
+    cubeVertices[0] = vec3(-0.5, 0.5, 0.5);   // TTL
+    cubeVertices[1] = vec3(0.5, 0.5, 0.5);    // TTR
+    cubeVertices[2] = vec3(-0.5, 0.5, -0.5);  // TBL
+    cubeVertices[3] = vec3(0.5, 0.5, -0.5);   // TBR
+    cubeVertices[4] = vec3(-0.5, -0.5, 0.5);  // BTL
+    cubeVertices[5] = vec3(0.5, -0.5, 0.5);   // BTR
+    cubeVertices[6] = vec3(-0.5, -0.5, -0.5); // BBL
+    cubeVertices[7] = vec3(0.5, -0.5, -0.5);  // BBR
+
+    string img_format;
+    if (!IniConfig::Get().UseSnormTextures)
+        img_format = IniConfig::Get().TextureComponentWidth == 32 ? "rgba32f" : "rgba16f";
+    else
+        img_format = "rgba16_snorm";
+
+    GLShader vs("3d\\tex_coords.vert", ShaderType::Vertex);
+    if (!vs.Compile())
+        return false;
+
+    _InitFragmentShader("3d\\view.frag", vs, viewShader, img_format);
+    _InitFragmentShader("3d\\view.frag", vs, viewLowResShader, img_format, { "LOW_RES" });
+    _InitFragmentShader("3d\\upsample.frag", vs, upsampleShader, img_format);
+    _InitFragmentShader("3d\\border.frag", vs, borderShader, img_format);
+
+    // The passes that write the fields cell by cell can follow the active bricks, the reductions
+    // and the solvers that sweep the whole box in place stay dense
+    if (IniConfig::Get().SparseBricks)
+    {
+        if (width % BRICK_SIDE == 0 && height % BRICK_SIDE == 0 && depth % BRICK_SIDE == 0)
+        {
+            if (!bricks.Init(uvec3(width, height, depth), computeLocalSize, img_format))
+                return false;
+
+            vector<string> sparse = { "SPARSE_BRICKS" };
+            vector<string> sparse_scalar = { "SPARSE_BRICKS", "SCALAR_FIELD" };
+            _InitComputeShader("3d\\clear.comp", sparseClearShader, computeLocalSize, img_format, sparse);
+            _InitComputeShader("3d\\clear.comp", sparseClearScalarShader, computeLocalSize, img_format, sparse_scalar);
+            sparseClearShader.Name = "clear.comp (bricks)";
+            sparseClearScalarShader.Name = "clear.comp (bricks, scalar)";
+        }
+        else
+        {
+            LOG_WARN("Sparse bricks need dimensions that are a multiple of %d, simulating the whole volume", BRICK_SIDE);
+        }
+    }
+
+    auto with_bricks = [this](vector<string> defines) {
+        if (bricks.IsActive())
+            defines.push_back("SPARSE_BRICKS");
+        return defines;
+    };
+
+    _InitComputeShader("3d\\add_impulse.comp", impulseShader, computeLocalSize, img_format, with_bricks({}));
+
+    // The old nearest cell back-trace moves at most one cell per step, whatever the velocity
+    advectionType = ParseAdvectionType(IniConfig::Get().AdvectionScheme);
+    if (advectionType == AdvectionType::Nearest)
+    {
+        _InitComputeShader("3d\\advection.comp", advectionShader, computeLocalSize, img_format, with_bricks({}));
+    }
+    else
+    {
+        vector<string> defines = with_bricks({});
+        if (IniConfig::Get().AdvectionRK2)
+            defines.push_back("RK2");
+
+        _InitComputeShader("3d\\advection_trilinear.comp", advectionShader, computeLocalSize, img_format, defines);
+
+        if (advectionType == AdvectionType::MacCormack)
+            _InitComputeShader("3d\\maccormack.comp", macCormackShader, computeLocalSize, img_format, defines);
+    }
+
+    _InitComputeShader("3d\\jacobi.comp", jacobiShader, computeLocalSize, img_format, with_bricks({}));
+    _InitComputeShader("3d\\residual.comp", residualShader, computeLocalSize, img_format);
+
+    // Pressure and divergence only have one channel
+    vector<string> scalar = { "SCALAR_FIELD" };
+    _InitComputeShader("3d\\jacobi.comp", jacobiScalarShader, computeLocalSize, img_format, with_bricks(scalar));
+    _InitComputeShader("3d\\residual.comp", residualScalarShader, computeLocalSize, img_format, scalar);
+    _InitComputeShader("3d\\clear.comp", clearScalarShader, computeLocalSize, img_format, scalar);
+    jacobiScalarShader.Name = "jacobi.comp (scalar)";
+    residualScalarShader.Name = "residual.comp (scalar)";
+    clearScalarShader.Name = "clear.comp (scalar)";
+    _InitComputeShader("3d\\redblack.comp", redBlackShader, computeLocalSize, img_format);
+
+    // The solver's own vectors are r32f, only pressure and divergence use the texture format
+    bool incomplete_poisson = IniConfig::Get().PCGPreconditioner.compare("jacobi") != 0;
+    if (!pcgSolver.Init(uvec3(width, height, depth), computeLocalSize, "r" + img_format.substr(4), incomplete_poisson))
+        return false;
+
+    if (IniConfig::Get().JacobiKernel.compare("tiled") == 0)
+    {
+        // Over the bricks each work group streams one brick, otherwise a 16x16 column 32 cells deep
+        uvec3 tile = bricks.IsActive() ? uvec3(BRICK_SIDE) : uvec3(JACOBI_TILE_SIDE, JACOBI_TILE_SIDE, JACOBI_SLAB_DEPTH);
+        if (width % tile.x == 0 && height % tile.y == 0 && depth % tile.z == 0)
+        {
+            jacobiSweeps = min(max(IniConfig::Get().JacobiSweepsPerDispatch, 1), JACOBI_MAX_SWEEPS);
+            jacobiTiledWorkGroups = uvec3(width, height, depth) / tile;
+
+            uvec3 region(tile.x + 2 * jacobiSweeps, tile.y + 2 * jacobiSweeps, 1);
+            vector<string> defines = with_bricks({ string("SWEEPS ") + to_string(jacobiSweeps), string("SLAB ") + to_string(tile.z) });
+            if (!_InitComputeShader("3d\\jacobi_tiled.comp", jacobiTiledShader, region, img_format, defines))
+                return false;
+
+            LOG_INFO("Using tiled Jacobi kernel with %d sweeps per dispatch", jacobiSweeps);
+        }
+        else
+        {
+            LOG_WARN("Tiled Jacobi kernel needs dimensions that are a multiple of %dx%dx%d, using the simple kernel", tile.x, tile.y, tile.z);
+        }
+    }
+    _InitComputeShader("3d\\divergence.comp", divShader, computeLocalSize, img_format, with_bricks({}));
+
+    // Divergence that also writes the first pressure iteration
+    vector<string> fused_defines = with_bricks({ "FUSE_JACOBI" });
+    if (IniConfig::Get().PressureWarmStart)
+        fused_defines.push_back("WARM_START");
+
+    _InitComputeShader("3d\\divergence.comp", divFusedShader, computeLocalSize, img_format, fused_defines);
+    divFusedShader.Name = "divergence.comp (fused)";
+    _InitComputeShader("3d\\project.comp", projectShader, computeLocalSize, img_format, with_bricks({}));
+    _InitComputeShader("3d\\boundary.comp", boundaryShader, computeLocalSize, img_format);
+    _InitComputeShader("3d\\copy.comp", copyShader, computeLocalSize, img_format);
+    _InitComputeShader("3d\\clear.comp", clearShader, computeLocalSize, img_format);
+    _InitComputeShader("3d\\speed_norm.comp", speedNormShader, computeLocalSize, img_format);
+    _InitComputeShader("3d\\macrocells.comp", macrocellShader, computeLocalSize, img_format);
+
+    if (!pressureMonitor.Init() || !velocityDiffusionMonitor.Init() || !inkDiffusionMonitor.Init() || !speedMonitor.Init())
+        return false;
+
+    GPUProfiler::Get().Init(IniConfig::Get().GPUProfilerFrames);
+
+    if (window)
+    {
+        glfwSetWindowUserPointer(window, this);
+        glfwSetScrollCallback(window, ::ScrollCallback);
+    }
+
+    LOG_INFO("Window size: %dx%d", wwidth, wheight);
+    LOG_INFO("Cube dimensions: %dx%dx%d", width, height, depth);
+
+    return true;
+}
+
+void InkBox3DSimulation::CreatePresentation()
 {
     vec3 c(0.5, 0.5, 0.5);
     float verts[24] =
@@ -118,10 +293,11 @@ bool InkBox3DSimulation::CreateScene()
         -c.x, -c.y, -c.z,
     };
 
+    // Counter-clockwise seen from outside, so back faces can be culled
     unsigned int indices[36] =
     {
-        7, 4, 5,
-        5, 6, 7,
+        7, 5, 4,
+        5, 7, 6,
 
         3, 0, 1,
         1, 2, 3,
@@ -129,28 +305,17 @@ bool InkBox3DSimulation::CreateScene()
         2, 6, 7,
         7, 3, 2,
 
-        1, 5, 4,
-        4, 0, 1,
+        1, 4, 5,
+        4, 1, 0,
 
         7, 4, 0,
         0, 3, 7,
 
-        6, 5, 1,
-        1, 2, 6
+        6, 1, 5,
+        1, 6, 2
     };
 
     cube.Init(&verts[0], 24, &indices[0], 36);
-    cubeModel = mat4(1.0f);
-    cubeModel = scale(cubeModel, vec3(1.0f, float(height) / width, float(depth) / width));
-
-    cubeVertices[0] = vec3(-0.5, 0.5, 0.5);   // TTL
-    cubeVertices[1] = vec3(0.5, 0.5, 0.5);    // TTR
-    cubeVertices[2] = vec3(-0.5, 0.5, -0.5);  // TBL
-    cubeVertices[3] = vec3(0.5, 0.5, -0.5);   // TBR
-    cubeVertices[4] = vec3(-0.5, -0.5, 0.5);  // BTL
-    cubeVertices[5] = vec3(0.5, -0.5, 0.5);   // BTR
-    cubeVertices[6] = vec3(-0.5, -0.5, -0.5); // BBL
-    cubeVertices[7] = vec3(0.5, -0.5, -0.5);  // BBR
 
     unsigned int border_indices[24] =
     {
@@ -172,46 +337,48 @@ bool InkBox3DSimulation::CreateScene()
 
     cubeBorder.Init(&verts[0], 24, &border_indices[0], 24);
 
-    string img_format;
-    if (!IniConfig::Get().UseSnormTextures)
-        img_format = IniConfig::Get().TextureComponentWidth == 32 ? "rgba32f" : "rgba16f";
-    else
-        img_format = "rgba16_snorm";
-
-    GLShader vs("3d\\tex_coords.vert", ShaderType::Vertex);
-    if (!vs.Compile())
-        return false;
-
-    _InitFragmentShader("3d\\view.frag", vs, viewShader, img_format);
-    _InitFragmentShader("3d\\border.frag", vs, borderShader, img_format);
-
-    _InitComputeShader("3d\\add_impulse.comp", impulseShader, computeLocalSize, img_format);
-    _InitComputeShader("3d\\advection.comp", advectionShader, computeLocalSize, img_format);
-    _InitComputeShader("3d\\jacobi.comp", jacobiShader, computeLocalSize, img_format);
-    _InitComputeShader("3d\\divergence.comp", divShader, computeLocalSize, string());
-    _InitComputeShader("3d\\gradient.comp", gradShader, computeLocalSize, img_format);
-    _InitComputeShader("3d\\subtract.comp", subtractShader, computeLocalSize, img_format);
-    _InitComputeShader("3d\\boundary.comp", boundaryShader, computeLocalSize, img_format);
-    _InitComputeShader("3d\\copy.comp", copyShader, computeLocalSize, img_format);
-    _InitComputeShader("3d\\clear.comp", clearShader, computeLocalSize, img_format);
+    // The low resolution target's alpha holds distances, so it's half floats whatever the fields use
+    glfwGetFramebufferSize(window, &framebufferSize.x, &framebufferSize.y);
+    float render_scale = IniConfig::Get().RenderScale;
+    if (render_scale < 1)
+    {
+        render_scale = max(render_scale, 0.125f);
+        int w = max(int(ceil(framebufferSize.x * render_scale)), 1);
+        int h = max(int(ceil(framebufferSize.y * render_scale)), 1);
+        lowResView = make_unique<FBO>(w, h, 0, GL_RGBA, GL_FLOAT, GL_RGBA16F);
+        LOG_INFO("Ray marching at %dx%d", w, h);
+    }
 
     _GL_WRAP1(glEnable, GL_DEPTH_TEST);
     _GL_WRAP1(glLineWidth, 1.0f);
     _GL_WRAP1(glEnable, GL_LINE_SMOOTH);
     //_GL_WRAP1(glEnable, GL_BLEND);
-
-    glfwSetWindowUserPointer(window, this);
-    glfwSetScrollCallback(window, ::ScrollCallback);
-
-    LOG_INFO("Window size: %dx%d", wwidth, wheight);
-    LOG_INFO("Cube dimensions: %dx%dx%d", width, height, depth);
-
-    return true;
 }
 
 void InkBox3DSimulation::WindowLoop()
 {
-    double last_time = 0.f;
+    TraceRecorder::SetThreadTrack(TraceTrack::Present);
+
+    // Still on the worker's context from InitGLContexts
+    uvec3 macrocells = (uvec3(width, height, depth) + uvec3(MACROCELL_SIDE - 1)) / uvec3(MACROCELL_SIDE);
+    macrocellWorkGroups = (macrocells + computeLocalSize - uvec3(1)) / computeLocalSize;
+
+    for (int i = 0; i < PRESENT_SLOTS; i++)
+    {
+        presentFrames[i] = make_unique<Texture>(width, height, depth, 4);
+        presentMacrocells[i] = make_unique<Texture>(macrocells.x, macrocells.y, macrocells.z, 1);
+    }
+
+    shared.Vars = panelVars;
+    glfwMakeContextCurrent(nullptr);
+    StartSimulationThread();
+
+    glfwMakeContextCurrent(controlPanel.WindowPtr());
+    glfwSwapInterval(0); // The panel never holds up presenting
+
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(1);
+    CreatePresentation();
 
     float aspect_ratio = float(wwidth) / wheight;
     projection = perspective(radians(45.0f), aspect_ratio, 0.1f, 100.0f);
@@ -219,103 +386,322 @@ void InkBox3DSimulation::WindowLoop()
     camera.LookAt(vec3(0, 0, 0));
     invProjView = inverse(projection * camera.ViewMatrix());
 
-    vec3 border_colour = vec3(128, 128, 128) / vec3(255, 255, 255);
+    double panel_interval = 1.0 / max(IniConfig::Get().ControlPanelFPS, 1.f);
+    double next_panel = 0;
 
     while (!glfwWindowShouldClose(window))
     {
-        glfwMakeContextCurrent(window);
+        {
+            TraceRecorder::Scope trace("glfwPollEvents");
+            glfwPollEvents();
+        }
+
+        {
+            TraceRecorder::Scope trace("ProcessInputs");
+            ProcessInputs();
+        }
+
+        {
+            TraceRecorder::Scope trace("Render");
+            Present();
+        }
+
+        {
+            TraceRecorder::Scope trace("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
+
         double now = glfwGetTime();
-        delta_t = last_time == 0 ? 0.016667 : now - last_time;
-        last_time = now;
+        if (now >= next_panel)
+        {
+            next_panel = now + panel_interval;
+            RenderControlPanel();
+            glfwMakeContextCurrent(window);
+        }
+    }
+
+    simThread.Stop();
+
+    // The simulation's objects are deleted on the context they were made on
+    glfwMakeContextCurrent(worker);
+}
+
+void InkBox3DSimulation::StartSimulationThread()
+{
+    simThread.Start(worker, IniConfig::Get().SimulationTickRate, [this](float tick_time) { Tick(tick_time); });
+}
+
+void InkBox3DSimulation::Tick(float tick_time)
+{
+    bool tick_paused, clear, drop_now;
+    {
+        lock_guard<mutex> lock(shared.Lock);
+        vars = shared.Vars;
+        tick_paused = shared.Paused;
+        clear = shared.ClearRequested;
+        shared.ClearRequested = false;
+        drop_now = dropNow;
+
+        if (picked)
+        {
+            impulseState.CurrentPos = pickPos;
+            impulseState.Delta = pickForce;
+            impulseState.ForceActive = true;
+            impulseState.InkActive = true;
+            picked = false;
+        }
+    }
+
+    if (clear)
+    {
+        backend->ClearFields();
+
+        if (cpuBackend)
+            UploadCPUFields();
+    }
+
+    if (!tick_paused)
+    {
+        TickDropletsMode(drop_now);
+        impulseState.PrepareFrame(vars, tick_time);
+
+        double step_start = glfwGetTime();
 
-        glfwPollEvents();
-        ProcessInputs();
+        // A finished replay hands control back to the mouse
+        if (!RunFrame(*backend, impulseState, scheduler, tick_time, inputLog))
+            inputLog = nullptr;
 
-        if (!paused)
+        if (cpuBackend)
         {
-            TickDropletsMode();
-            ComputeFields();
+            TraceRecorder::Scope trace("UploadCPUFields");
+            UploadCPUFields();
         }
 
-        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // also clear the depth buffer now!
+        scheduler.Measure(glfwGetTime() - step_start);
+    }
+
+    // The ink only changes while running, a paused tick has nothing new to show
+    if (!tick_paused || clear)
+    {
+        int slot = frames.BeginWrite();
+        CopyImage(*presentFrames[slot], textures.Ink.Front());
+
+        macrocellShader.Use();
+        macrocellShader.SetImage("field_r", *presentFrames[slot], 0, GL_READ_ONLY);
+        macrocellShader.SetImage("occupancy_w", *presentMacrocells[slot], 1, GL_WRITE_ONLY);
+        macrocellShader.Execute(macrocellWorkGroups);
+        frames.EndWrite();
+    }
+
+    lock_guard<mutex> lock(shared.Lock);
+    shared.Stats = backend->Stats();
+    shared.Stats.TickRate = simThread.MeasuredRate();
+    shared.Impulse = impulseState;
+}
+
+void InkBox3DSimulation::Present()
+{
+    static const vec3 border_colour = vec3(128, 128, 128) / vec3(255, 255, 255);
+
+    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // also clear the depth buffer now!
+
+    int slot = frames.BeginRead();
+    if (slot >= 0)
+    {
+        // Only one side of the cube starts rays, the front faces or from inside the cube the back
+        // faces. The low resolution target has no depth buffer to drop the other side.
+        vec3 half_size = 0.5f * vec3(cubeModel[0][0], cubeModel[1][1], cubeModel[2][2]);
+        bool inside = all(lessThan(abs(camera.Position()), half_size));
+        _GL_WRAP1(glEnable, GL_CULL_FACE);
+        _GL_WRAP1(glCullFace, inside ? GL_FRONT : GL_BACK);
+
+        // At a reduced scale the rays go to the smaller target
+        GLShaderProgram& view = lowResView ? viewLowResShader : viewShader;
+        if (lowResView)
+        {
+            lowResView->Clear();
+            lowResView->Bind();
+            _GL_WRAP4(glViewport, 0, 0, lowResView->Width(), lowResView->Height());
+        }
 
-        viewShader.Use();
-        viewShader.SetMatrix4x4("model", cubeModel);
-        viewShader.SetMatrix4x4("view", camera.ViewMatrix());
-        viewShader.SetMatrix4x4("proj", projection);
+        view.Use();
+        view.SetMatrix4x4("model", cubeModel);
+        view.SetMatrix4x4("view", camera.ViewMatrix());
+        view.SetMatrix4x4("proj", projection);
 
-        viewShader.SetVec3("cube_pos", vec3(0.f, 0.f, 0.f));
-        viewShader.SetVec3("camera_wpos", camera.Position());
-        viewShader.SetVec3("camera_dir", camera.Direction());
-        viewShader.SetVec3("box_size", vec3(width, height, depth));
-        viewShader.SetVec4("bg_colour", vec4(0.2f, 0.3f, 0.3f, 1.0f));
-        viewShader.SetImage("field", textures.Ink.Front(), 0, GL_READ_ONLY);
+        view.SetVec3("cube_pos", vec3(0.f, 0.f, 0.f));
+        view.SetVec3("camera_wpos", camera.Position());
+        view.SetVec3("camera_dir", camera.Direction());
+        view.SetVec3("box_size", vec3(width, height, depth));
+        view.SetVec4("bg_colour", vec4(0.2f, 0.3f, 0.3f, 1.0f));
+        view.SetImage("field", *presentFrames[slot], 0, GL_READ_ONLY);
+        view.SetImage("occupancy", *presentMacrocells[slot], 1, GL_READ_ONLY);
 
         _GL_WRAP1(glBindVertexArray, cube.VAO);
         _GL_WRAP4(glDrawElements, GL_TRIANGLES, cube.NumVertices, GL_UNSIGNED_INT, nullptr);
+        frames.EndRead();
+
+        if (lowResView)
+        {
+            _GL_WRAP2(glBindFramebuffer, GL_FRAMEBUFFER, 0);
+            _GL_WRAP4(glViewport, 0, 0, framebufferSize.x, framebufferSize.y);
+
+            upsampleShader.Use();
+            upsampleShader.SetMatrix4x4("model", cubeModel);
+            upsampleShader.SetMatrix4x4("view", camera.ViewMatrix());
+            upsampleShader.SetMatrix4x4("proj", projection);
+            upsampleShader.SetVec3("cube_pos", vec3(0.f, 0.f, 0.f));
+            upsampleShader.SetVec3("camera_wpos", camera.Position());
+            upsampleShader.SetVec2("scale", vec2(lowResView->Width(), lowResView->Height()) / vec2(framebufferSize));
+            upsampleShader.SetTexture("low_res", *lowResView, 0);
+            _GL_WRAP4(glDrawElements, GL_TRIANGLES, cube.NumVertices, GL_UNSIGNED_INT, nullptr);
+        }
 
-        // Draw a border around the cube
-        borderShader.Use();
-        borderShader.SetMatrix4x4("model", cubeModel);
-        borderShader.SetMatrix4x4("view", camera.ViewMatrix());
-        borderShader.SetMatrix4x4("proj", projection);
-        borderShader.SetInt("colour_with_coord", IniConfig::Get().ColourBorderWithCoord);
-        borderShader.SetVec3("colour", border_colour);
-        _GL_WRAP1(glBindVertexArray, cubeBorder.VAO);
-        _GL_WRAP4(glDrawElements, GL_LINES, cubeBorder.NumVertices, GL_UNSIGNED_INT, nullptr);
+        _GL_WRAP1(glDisable, GL_CULL_FACE);
+    }
 
-        glfwSwapBuffers(window);
+    // Draw a border around the cube
+    borderShader.Use();
+    borderShader.SetMatrix4x4("model", cubeModel);
+    borderShader.SetMatrix4x4("view", camera.ViewMatrix());
+    borderShader.SetMatrix4x4("proj", projection);
+    borderShader.SetInt("colour_with_coord", IniConfig::Get().ColourBorderWithCoord);
+    borderShader.SetVec3("colour", border_colour);
+    _GL_WRAP1(glBindVertexArray, cubeBorder.VAO);
+    _GL_WRAP4(glDrawElements, GL_LINES, cubeBorder.NumVertices, GL_UNSIGNED_INT, nullptr);
+}
 
-        limiter.Regulate();
+void InkBox3DSimulation::RenderControlPanel()
+{
+    {
+        lock_guard<mutex> lock(shared.Lock);
+        panelStats = shared.Stats;
+        panelImpulse = shared.Impulse;
+    }
 
-        // Render control panel window
-        bool update, clear;
-        glfwMakeContextCurrent(controlPanel.WindowPtr());
+    bool update, clear;
+    glfwMakeContextCurrent(controlPanel.WindowPtr());
+    {
+        TraceRecorder::Scope trace("ControlPanel::Render");
         controlPanel.Render(update, clear);
+    }
 
-        if (update)
-        {
-            ui.UpdateVars(vars);
-            LOG_INFO("Ink colour: %d, %d, %d", int(vars.InkColour.r * 255), int(vars.InkColour.g * 255), int(vars.InkColour.b * 255));
-        }
-        else if (clear)
-            ClearFields();
+    if (update)
+    {
+        ui.UpdateVars(panelVars);
+        LOG_INFO("Ink colour: %d, %d, %d", int(panelVars.InkColour.r * 255), int(panelVars.InkColour.g * 255), int(panelVars.InkColour.b * 255));
+    }
 
+    {
+        lock_guard<mutex> lock(shared.Lock);
+        shared.Vars = panelVars;
+        shared.ClearRequested |= clear && !update;
+    }
+
+    {
+        TraceRecorder::Scope trace("glfwSwapBuffers");
         glfwSwapBuffers(controlPanel.WindowPtr());
     }
 }
 
-void InkBox3DSimulation::ComputeFields()
+HeadlessResult InkBox3DSimulation::RunHeadless(int frames, const ImpulseScript& script)
 {
-    if (vars.AdvectInk)
+    return ::RunHeadless(*backend, vars, impulseState, ivec3(width, height, depth), frames, inputLog, script);
+}
+
+void InkBox3DSimulation::Finish()
+{
+    _GL_WRAP0(glFinish);
+}
+
+ResidualNorms InkBox3DSimulation::MeasurePressureResidual()
+{
+    if (backend != this)
+        return backend->MeasurePressureResidual();
+
+    MeasureResidual(textures.Pressure, textures.Divergence, -vars.GridScale * vars.GridScale, 6.0f, pressureMonitor, true);
+    return pressureMonitor.Wait();
+}
+
+Texture& InkBox3DSimulation::FieldTexture(SimulationField field)
+{
+    if (field == SimulationField::Velocity)
+        return textures.Velocity.Front();
+
+    return field == SimulationField::Pressure ? textures.Pressure : textures.Ink.Front();
+}
+
+void InkBox3DSimulation::ReadField(SimulationField field, float* rgba)
+{
+    FieldTexture(field).Download(rgba, GL_RGBA);
+}
+
+void InkBox3DSimulation::WriteField(SimulationField field, const float* rgba)
+{
+    FieldTexture(field).Upload(rgba, GL_RGBA);
+}
+
+void InkBox3DSimulation::UploadCPUFields()
+{
+    // Only the ink is ever drawn in 3D
+    cpuBackend->ReadField(SimulationField::Ink, uploadBuffer.data());
+    textures.Ink.Front().Upload(uploadBuffer.data(), GL_RGBA);
+}
+
+void InkBox3DSimulation::Advect(SwapTexture& quantity, float dissipation, float gravity, float delta_t)
+{
+    // MacCormack's forward pass goes to Temp as it is, the correction applies dissipation and gravity
+    bool maccormack = advectionType == AdvectionType::MacCormack;
+
+    advectionShader.Use();
+    advectionShader.SetFloat("delta_t", delta_t);
+    advectionShader.SetFloat("dissipation", maccormack ? 1.f : dissipation);
+    advectionShader.SetFloat("gs", vars.GridScale);
+    advectionShader.SetFloat("gravity", maccormack ? 0.f : gravity);
+    advectionShader.SetImage("quantity_w", maccormack ? textures.Temp : quantity.Back(), 1, GL_WRITE_ONLY);
+
+    if (advectionType == AdvectionType::Nearest)
     {
-        advectionShader.Use();
-        advectionShader.SetFloat("delta_t", delta_t);
-        advectionShader.SetFloat("dissipation", 0.99f);
-        advectionShader.SetFloat("gs", vars.GridScale);
-        advectionShader.SetFloat("gravity", 0);
-        advectionShader.SetImage("quantity_r", textures.Ink.Front(), 0, GL_READ_ONLY);
-        advectionShader.SetImage("quantity_w", textures.Ink.Back(), 1, GL_WRITE_ONLY);
+        advectionShader.SetImage("quantity_r", quantity.Front(), 0, GL_READ_ONLY);
         advectionShader.SetImage("velocity", textures.Velocity.Front(), 2, GL_READ_ONLY);
-        advectionShader.Execute(computeWorkGroups);
-        textures.Ink.Swap();
+    }
+    else
+    {
+        advectionShader.SetTexture("quantity_r", quantity.Front(), 0);
+        advectionShader.SetTexture("velocity", textures.Velocity.Front(), 1);
     }
 
-    if (vars.SelfAdvect)
+    Dispatch(advectionShader);
+
+    if (maccormack)
     {
-        advectionShader.Use();
-        advectionShader.SetFloat("delta_t", delta_t);
-        advectionShader.SetFloat("dissipation", 0.98f);
-        advectionShader.SetFloat("gs", vars.GridScale);
-        advectionShader.SetFloat("gravity", vars.Gravity);
-        advectionShader.SetImage("quantity_r", textures.Velocity.Front(), 0, GL_READ_ONLY);
-        advectionShader.SetImage("quantity_w", textures.Velocity.Back(), 1, GL_WRITE_ONLY);
-        advectionShader.SetImage("velocity", textures.Velocity.Front(), 2, GL_READ_ONLY);
-        advectionShader.Execute(computeWorkGroups);
-        textures.Velocity.Swap();
+        macCormackShader.Use();
+        macCormackShader.SetFloat("delta_t", delta_t);
+        macCormackShader.SetFloat("dissipation", dissipation);
+        macCormackShader.SetFloat("gs", vars.GridScale);
+        macCormackShader.SetFloat("gravity", gravity);
+        macCormackShader.SetTexture("quantity_r", quantity.Front(), 0);
+        macCormackShader.SetTexture("velocity", textures.Velocity.Front(), 1);
+        macCormackShader.SetTexture("forward", textures.Temp, 2);
+        macCormackShader.SetImage("quantity_w", quantity.Back(), 1, GL_WRITE_ONLY);
+        Dispatch(macCormackShader);
     }
 
+    quantity.Swap();
+}
+
+void InkBox3DSimulation::ComputeFields(float delta_t, float frame_fraction)
+{
+    if (bricks.IsActive())
+        UpdateActiveBricks();
+
+    if (vars.AdvectInk)
+        Advect(textures.Ink, pow(0.99f, frame_fraction), 0, delta_t);
+
+    if (vars.SelfAdvect)
+        Advect(textures.Velocity, pow(0.98f, frame_fraction), vars.Gravity * frame_fraction, delta_t);
+
     if (impulseState.ForceActive)
     {
         LOG_INFO("Splat: (%.0f, %.0f, %.0f)\tForce: (%.2f, %.2f, %.2f)", impulseState.CurrentPos.x, impulseState.CurrentPos.y, impulseState.CurrentPos.z, impulseState.Delta.x, impulseState.Delta.y, impulseState.Delta.z);
@@ -325,26 +711,20 @@ void InkBox3DSimulation::ComputeFields()
         impulseShader.SetVec4("force", vec4(impulseState.Delta.x, impulseState.Delta.y, impulseState.Delta.z, 0));
         impulseShader.SetImage("field_r", textures.Velocity.Front(), 0, GL_READ_ONLY);
         impulseShader.SetImage("field_w", textures.Velocity.Back(), 1, GL_WRITE_ONLY);
-        impulseShader.Execute(computeWorkGroups);
+        Dispatch(impulseShader);
         textures.Velocity.Swap();
         impulseState.ForceActive = false;
     }
 
     if (impulseState.InkActive)
     {
-        vec4 colour;
-        if (vars.RainbowMode)
-            colour = impulseState.TickRainbowMode(delta_t);
-        else
-            colour = vars.InkColour;
-
         impulseShader.Use();
         impulseShader.SetVec3("position", impulseState.CurrentPos);
         impulseShader.SetFloat("radius", vars.InkVolume);
-        impulseShader.SetVec4("force", colour);
+        impulseShader.SetVec4("force", impulseState.Colour);
         impulseShader.SetImage("field_r", textures.Ink.Front(), 0, GL_READ_ONLY);
         impulseShader.SetImage("field_w", textures.Ink.Back(), 1, GL_WRITE_ONLY);
-        impulseShader.Execute(computeWorkGroups);
+        Dispatch(impulseShader);
         textures.Ink.Swap();
         impulseState.InkActive = false;
     }
@@ -353,40 +733,107 @@ void InkBox3DSimulation::ComputeFields()
     {
         float alpha = (vars.GridScale * vars.GridScale) / (vars.Viscosity * delta_t);
         float beta = alpha + 6.0f;
-        SolvePoissonSystem(textures.Velocity, textures.Velocity.Front(), alpha, beta);
+        stats.DiffusionIterations = SolvePoissonSystem(textures.Velocity, alpha, beta, velocityDiffusionMonitor);
+        stats.Diffusion = velocityDiffusionMonitor.Latest();
     }
 
     if (vars.DiffuseInk)
     {
         float alpha = (vars.GridScale * vars.GridScale) / (vars.InkViscosity * delta_t);
         float beta = alpha + 6.0;
-        SolvePoissonSystem(textures.Ink, textures.Ink.Front(), alpha, beta);
+        SolvePoissonSystem(textures.Ink, alpha, beta, inkDiffusionMonitor);
     }
 
-    // Projection
-    divShader.Use();
-    divShader.SetFloat("gs", vars.GridScale);
-    divShader.SetImage("field_r", textures.Velocity.Front(), 0, GL_READ_ONLY);
-    divShader.SetImage("field_w", textures.Velocity.Back(), 1, GL_WRITE_ONLY);
-    divShader.Execute(computeWorkGroups);
+    // Projection. Red-black and conjugate gradient work on the pressure in place, Jacobi ping-pongs
+    // with the scratch texture. Laplacian(P) = (sum(neighbours) - 6P) / gs^2, so solving it for
+    // div(W) takes alpha = -gs^2 like in 2D.
+    float pressure_alpha = -vars.GridScale * vars.GridScale;
+    bool red_black = vars.PressureSolver == PressureSolverType::RedBlack;
+    bool pcg = vars.PressureSolver == PressureSolverType::ConjugateGradient;
+    Texture* pressure = &textures.Pressure;
+    Texture* scratch = nullptr;
+    if (!red_black && !pcg)
+    {
+        if (!textures.PressureScratch)
+        {
+            textures.PressureScratch = make_unique<Texture>(width, height, depth, 1);
+
+            // Bricks that never get written have to read as 0 like everywhere else
+            if (bricks.IsActive())
+            {
+                clearScalarShader.Use();
+                clearScalarShader.SetImage("field_w", *textures.PressureScratch, 0, GL_WRITE_ONLY);
+                clearScalarShader.Execute(computeWorkGroups);
+            }
+        }
+
+        scratch = textures.PressureScratch.get();
+    }
+
+    // The fused pass writes its iteration to the scratch texture, so it's Jacobi only
+    int pressure_iterations = 0;
+    if (IniConfig::Get().FuseDivergenceJacobi && scratch)
+    {
+        // The first pressure iteration comes out of the same pass
+        divFusedShader.Use();
+        divFusedShader.SetFloat("gs", vars.GridScale);
+        divFusedShader.SetFloat("alpha", pressure_alpha);
+        divFusedShader.SetFloat("beta", 6.0f);
+        divFusedShader.SetImage("field_r", textures.Velocity.Front(), 0, GL_READ_ONLY);
+        divFusedShader.SetImage("field_w", textures.Divergence, 1, GL_WRITE_ONLY);
+        divFusedShader.SetImage("pressure_w", *scratch, 2, GL_WRITE_ONLY);
+        if (IniConfig::Get().PressureWarmStart)
+            divFusedShader.SetImage("pressure_r", *pressure, 3, GL_READ_ONLY);
+
+        Dispatch(divFusedShader);
+        std::swap(pressure, scratch);
+        pressure_iterations = 1;
+    }
+    else
+    {
+        if (!IniConfig::Get().PressureWarmStart)
+        {
+            GLComputeShader& clear = bricks.IsActive() ? sparseClearScalarShader : clearScalarShader;
+            clear.Use();
+            clear.SetImage("field_w", textures.Pressure, 0, GL_WRITE_ONLY);
+            Dispatch(clear);
+        }
+
+        divShader.Use();
+        divShader.SetFloat("gs", vars.GridScale);
+        divShader.SetImage("field_r", textures.Velocity.Front(), 0, GL_READ_ONLY);
+        divShader.SetImage("field_w", textures.Divergence, 1, GL_WRITE_ONLY);
+        Dispatch(divShader);
+    }
 
     // Solve for P in: Laplacian(P) = div(W)
-    SolvePoissonSystem(textures.Pressure, textures.Velocity.Back(), -1, 6.0f);
+    if (pcg)
+    {
+        float tolerance = IniConfig::Get().ResidualTolerance;
+        int max_iterations = tolerance > 0 ? IniConfig::Get().MaxJacobiIterations : IniConfig::Get().NumJacobiIterations;
+        stats.PressureIterations = pcgSolver.Solve(textures.Pressure, textures.Divergence, pressure_alpha, 6.0f, pressureMonitor, max_iterations, tolerance, IniConfig::Get().ResidualPlanStep);
+    }
+    else
+    {
+        stats.PressureIterations = SolvePoissonSystem(pressure, scratch, textures.Divergence, pressure_alpha, 6.0f, pressureMonitor, true, pressure_iterations, red_black);
 
-    // Calculate grad(P)
-    gradShader.Use();
-    gradShader.SetFloat("gs", vars.GridScale);
-    gradShader.SetImage("field_r", textures.Pressure.Front(), 0, GL_READ_ONLY);
-    gradShader.SetImage("field_w", textures.Pressure.Back(), 1, GL_WRITE_ONLY);
-    gradShader.Execute(computeWorkGroups);
-    // No swap, back buffer has the gradient
+        // One more iteration is cheaper than copying the result out of the scratch texture
+        if (pressure != &textures.Pressure)
+        {
+            RelaxPoissonSystem(pressure, scratch, textures.Divergence, pressure_alpha, 6.0f, true);
+            stats.PressureIterations++;
+        }
+    }
+
+    stats.Pressure = pressureMonitor.Latest();
 
     // Calculate U = W - grad(P) where div(U)=0
-    subtractShader.Use();
-    subtractShader.SetImage("a", textures.Velocity.Front(), 0, GL_READ_ONLY);
-    subtractShader.SetImage("b", textures.Pressure.Back(), 1, GL_READ_ONLY);
-    subtractShader.SetImage("c", textures.Velocity.Back(), 2, GL_WRITE_ONLY);
-    subtractShader.Execute(computeWorkGroups);
+    projectShader.Use();
+    projectShader.SetFloat("gs", vars.GridScale);
+    projectShader.SetImage("velocity_r", textures.Velocity.Front(), 0, GL_READ_ONLY);
+    projectShader.SetImage("pressure_r", textures.Pressure, 1, GL_READ_ONLY);
+    projectShader.SetImage("velocity_w", textures.Velocity.Back(), 2, GL_WRITE_ONLY);
+    Dispatch(projectShader);
     textures.Velocity.Swap();
 
     if (vars.BoundariesEnabled)
@@ -394,23 +841,152 @@ void InkBox3DSimulation::ComputeFields()
         ComputeBoundaryValues(textures.Velocity, -1);
         ComputeBoundaryValues(textures.Ink, 0);
     }
+
+    if (IniConfig::Get().AdaptiveTimestep)
+        MeasureMaxSpeed();
 }
 
-void InkBox3DSimulation::SolvePoissonSystem(SwapTexture& swap, Texture& initial_value, float alpha, float beta)
+int InkBox3DSimulation::SolvePoissonSystem(SwapTexture& swap, float alpha, float beta, ResidualMonitor& monitor)
 {
-    CopyImage(textures.Temp, initial_value);
-    jacobiShader.Use();
-    jacobiShader.SetFloat("alpha", alpha);
-    jacobiShader.SetFloat("beta", beta);
-    jacobiShader.SetImage("fieldb_r", textures.Temp, 0, GL_READ_ONLY);
+    // The field is its own b so it has to stay put. Rather than copy it somewhere first, the first
+    // iteration reads it into the back buffer and the rest alternate between the back buffer and Temp.
+    Texture& b = swap.Front();
+    Texture* x = &b;
+    Texture* scratch = &swap.Back();
+    RelaxPoissonSystem(x, scratch, b, alpha, beta, false);
+
+    scratch = &textures.Temp;
+    int iterations = SolvePoissonSystem(x, scratch, b, alpha, beta, monitor, false, 1);
+
+    // One more iteration is cheaper than copying the result out of Temp
+    if (x == &textures.Temp)
+    {
+        RelaxPoissonSystem(x, scratch, b, alpha, beta, false);
+        iterations++;
+    }
+
+    swap.Swap();
+    return iterations;
+}
+
+int InkBox3DSimulation::SolvePoissonSystem(Texture*& x, Texture*& scratch, Texture& b, float alpha, float beta, ResidualMonitor& monitor, bool scalar_field, int iterations, bool red_black)
+{
+    // With a tolerance set the residuals of the last few solves pick the iteration count, between
+    // ResidualPlanStep and MaxJacobiIterations, and this one's residual is measured at the end.
+    // A red-black iteration is two passes and does about as much as two Jacobi ones, so it runs
+    // half as many.
+    float tolerance = IniConfig::Get().ResidualTolerance;
+    int max_iterations = IniConfig::Get().NumJacobiIterations;
+    int most_iterations = IniConfig::Get().MaxJacobiIterations;
+    if (red_black)
+    {
+        max_iterations = max(max_iterations / 2, 1);
+        most_iterations = max(most_iterations / 2, 1);
+    }
 
-    for (int i = 0; i < IniConfig::Get().NumJacobiIterations; i++)
+    if (tolerance > 0)
+        max_iterations = monitor.Plan(tolerance, max(IniConfig::Get().ResidualPlanStep, 1), most_iterations);
+
+    int i = iterations;
+    while (i < max_iterations)
     {
-        jacobiShader.SetImage("fieldx_r", swap.Front(), 1, GL_READ_ONLY);
-        jacobiShader.SetImage("field_out", swap.Back(), 2, GL_WRITE_ONLY);
-        jacobiShader.Execute(computeWorkGroups);
-        swap.Swap();
+        if (red_black)
+            i += RelaxRedBlack(*x, b, alpha, beta);
+        else
+            i += RelaxPoissonSystem(x, scratch, b, alpha, beta, scalar_field, max_iterations - i);
     }
+
+    if (tolerance > 0)
+        MeasureResidual(*x, b, alpha, beta, monitor, scalar_field);
+
+    return i;
+}
+
+int InkBox3DSimulation::RelaxPoissonSystem(Texture*& x, Texture*& scratch, Texture& b, float alpha, float beta, bool scalar_field, int max_iterations)
+{
+    GLComputeShader& jacobi = scalar_field ? jacobiScalarShader : jacobiShader;
+    int n = 1;
+
+    if (scalar_field && jacobiSweeps > 0)
+    {
+        // Several iterations per dispatch out of shared memory
+        n = min(jacobiSweeps, max_iterations);
+        jacobiTiledShader.Use();
+        jacobiTiledShader.SetFloat("alpha", alpha);
+        jacobiTiledShader.SetFloat("beta", beta);
+        jacobiTiledShader.SetInt("sweeps", n);
+        jacobiTiledShader.SetImage("fieldb_r", b, 0, GL_READ_ONLY);
+        jacobiTiledShader.SetImage("fieldx_r", *x, 1, GL_READ_ONLY);
+        jacobiTiledShader.SetImage("field_out", *scratch, 2, GL_WRITE_ONLY);
+
+        if (bricks.IsActive())
+            bricks.DispatchBricks(jacobiTiledShader);
+        else
+            jacobiTiledShader.Execute(jacobiTiledWorkGroups);
+    }
+    else
+    {
+        jacobi.Use();
+        jacobi.SetFloat("alpha", alpha);
+        jacobi.SetFloat("beta", beta);
+        jacobi.SetImage("fieldb_r", b, 0, GL_READ_ONLY);
+        jacobi.SetImage("fieldx_r", *x, 1, GL_READ_ONLY);
+        jacobi.SetImage("field_out", *scratch, 2, GL_WRITE_ONLY);
+        Dispatch(jacobi);
+    }
+
+    std::swap(x, scratch);
+    return n;
+}
+
+// Scalar fields only. A red dispatch then a black one, both in place.
+int InkBox3DSimulation::RelaxRedBlack(Texture& x, Texture& b, float alpha, float beta)
+{
+    redBlackShader.Use();
+    redBlackShader.SetFloat("alpha", alpha);
+    redBlackShader.SetFloat("beta", beta);
+    redBlackShader.SetFloat("omega", vars.SOROmega);
+    redBlackShader.SetImage("field", x, 0, GL_READ_WRITE);
+    redBlackShader.SetImage("fieldb_r", b, 1, GL_READ_ONLY);
+
+    for (int parity = 0; parity < 2; parity++)
+    {
+        redBlackShader.SetInt("parity", parity);
+        redBlackShader.Execute(redBlackWorkGroups);
+    }
+
+    return 1;
+}
+
+void InkBox3DSimulation::MeasureResidual(Texture& x, Texture& b, float alpha, float beta, ResidualMonitor& monitor, bool scalar_field)
+{
+    int num_groups = computeWorkGroups.x * computeWorkGroups.y * computeWorkGroups.z;
+    GLComputeShader& residual = scalar_field ? residualScalarShader : residualShader;
+
+    residual.Use();
+    residual.SetFloat("alpha", alpha);
+    residual.SetFloat("beta", beta);
+    residual.SetImage("fieldx_r", x, 0, GL_READ_ONLY);
+    residual.SetImage("fieldb_r", b, 1, GL_READ_ONLY);
+    monitor.BindPartials(0, num_groups);
+    residual.Execute(computeWorkGroups);
+    monitor.Reduce(num_groups, width * height * depth);
+}
+
+void InkBox3DSimulation::MeasureMaxSpeed()
+{
+    int num_groups = computeWorkGroups.x * computeWorkGroups.y * computeWorkGroups.z;
+
+    speedNormShader.Use();
+    speedNormShader.SetImage("velocity_r", textures.Velocity.Front(), 0, GL_READ_ONLY);
+    speedMonitor.BindPartials(0, num_groups);
+    speedNormShader.Execute(computeWorkGroups);
+    speedMonitor.Reduce(num_groups, width * height * depth);
+
+    // The readback is a few frames old, close enough for picking the next step size
+    speedMonitor.Poll();
+    if (speedMonitor.Latest().IsValid())
+        stats.MaxSpeed = speedMonitor.Latest().Max / vars.GridScale;
 }
 
 void InkBox3DSimulation::ComputeBoundaryValues(SwapTexture& swap, float scale)
@@ -423,6 +999,64 @@ void InkBox3DSimulation::ComputeBoundaryValues(SwapTexture& swap, float scale)
     swap.Swap();
 }
 
+// Past this distance a splat adds less than the threshold, 0 effect being force * exp(-d^2 / radius)
+float _SplatReach(float radius, float force, float threshold)
+{
+    if (force <= threshold || threshold <= 0)
+        return -1;
+
+    return sqrt(radius * log(force / threshold));
+}
+
+void InkBox3DSimulation::UpdateActiveBricks()
+{
+    float threshold = IniConfig::Get().BrickActivityThreshold;
+
+    // Where the impulse is about to land has to be active before it does
+    float reach = -1;
+    if (impulseState.ForceActive)
+        reach = max(reach, _SplatReach(vars.SplatRadius, length(impulseState.Delta), threshold));
+
+    if (impulseState.InkActive)
+    {
+        vec4 ink = abs(impulseState.Colour);
+        reach = max(reach, _SplatReach(vars.InkVolume, max(max(ink.x, ink.y), max(ink.z, ink.w)), threshold));
+    }
+
+    bricks.Update(textures.Velocity.Front(), textures.Ink.Front(), threshold, vec4(impulseState.CurrentPos, reach));
+
+    // Bricks that went quiet are zeroed in every field, both buffers of a pair, so the passes can
+    // skip them from now on and nothing stale comes back when a pair swaps
+    Texture* fields[] = { &textures.Velocity.Front(), &textures.Velocity.Back(), &textures.Ink.Front(), &textures.Ink.Back(), &textures.Temp };
+    sparseClearShader.Use();
+    for (Texture* field : fields)
+    {
+        sparseClearShader.SetImage("field_w", *field, 0, GL_WRITE_ONLY);
+        bricks.DispatchRetired(sparseClearShader);
+    }
+
+    Texture* scalars[] = { &textures.Pressure, &textures.Divergence, textures.PressureScratch.get() };
+    sparseClearScalarShader.Use();
+    for (Texture* field : scalars)
+    {
+        if (!field)
+            continue;
+
+        sparseClearScalarShader.SetImage("field_w", *field, 0, GL_WRITE_ONLY);
+        bricks.DispatchRetired(sparseClearScalarShader);
+    }
+
+    stats.ActiveBricks = bricks.ActiveFraction();
+}
+
+void InkBox3DSimulation::Dispatch(GLComputeShader& shader)
+{
+    if (bricks.IsActive())
+        bricks.Dispatch(shader);
+    else
+        shader.Execute(computeWorkGroups);
+}
+
 void InkBox3DSimulation::CopyImage(Texture& dest, Texture& src)
 {
     copyShader.Use();
@@ -437,62 +1071,26 @@ void InkBox3DSimulation::ClearFields()
     {
         &textures.Velocity.Front(),
         &textures.Velocity.Back(),
-        &textures.Pressure.Front(),
-        &textures.Pressure.Back(),
         &textures.Ink.Front(),
         &textures.Ink.Back(),
     };
 
     clearShader.Use();
-    for (int i = 0; i < 6; i++)
+    for (int i = 0; i < 4; i++)
     {
         clearShader.SetImage("field_w", *ptrs[i], 0, GL_WRITE_ONLY);
         clearShader.Execute(computeWorkGroups);
     }
+
+    clearScalarShader.Use();
+    clearScalarShader.SetImage("field_w", textures.Pressure, 0, GL_WRITE_ONLY);
+    clearScalarShader.Execute(computeWorkGroups);
 }
 
-void InkBox3DSimulation::TickDropletsMode()
+void InkBox3DSimulation::TickDropletsMode(bool drop_now)
 {
-    static float acc = 0;
-    static int next_drop = 0;
-    static ivec2 freq_range(30, 60);
-
-    if (vars.DropletsMode)
-        acc++;
-
-    if (acc > next_drop || glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
-    {
-        vec3 rand_pos, rand_force;
-
-        acc = 0;
-        next_drop = (rand() % (freq_range.y - freq_range.x)) + freq_range.x;
-
-        if ((rand() & 0x1) == 0x1)
-        {
-            rand_pos.x = rand() % width;
-            rand_pos.y = height / 2;
-            rand_pos.z = rand() % depth;
-
-            rand_force.x = 0;
-            rand_force.y = -1 * float(rand() % 1000) / 1000 * vars.ForceMultiplier;
-            rand_force.z = 0;
-        }
-        else
-        {
-            rand_pos.x = width / 2;
-            rand_pos.z = rand() % depth;
-            rand_pos.y = rand() % height;
-
-            rand_force.x = -1 * float(rand() % 1000) / 1000 * vars.ForceMultiplier;
-            rand_force.y = 0;
-            rand_force.z = 0;
-        }
-
-        impulseState.ForceActive = true;
-        impulseState.InkActive = true;
-        impulseState.Delta = rand_force;
-        impulseState.CurrentPos = rand_pos;
-    }
+    if (vars.DropletsMode || drop_now)
+        impulseState.TickDropletsMode(ivec3(width, height, depth), vars.ForceMultiplier, drop_now);
 }
 
 void InkBox3DSimulation::UpdatePickCoord()
@@ -522,13 +1120,11 @@ void InkBox3DSimulation::UpdatePickCoord()
     vec3 intersection;
     if (utils::LineIntersectsBox(ro, rd, cubeVertices[0], cubeVertices[1], cubeVertices[2], cubeVertices[3], cubeVertices[4], cubeVertices[5], cubeVertices[6], cubeVertices[7], intersection))
     {
-        impulseState.CurrentPos = intersection;
-        impulseState.CurrentPos += 0.5f;
-        impulseState.CurrentPos *= vec3(width, height, depth);
-
-        impulseState.ForceActive = true;
-        impulseState.InkActive = true;
-        impulseState.Delta = (intersection - ro) * vars.ForceMultiplier;
+        // The next tick turns it into an impulse
+        lock_guard<mutex> lock(shared.Lock);
+        pickPos = (intersection + 0.5f) * vec3(width, height, depth);
+        pickForce = (intersection - ro) * panelVars.ForceMultiplier;
+        picked = true;
 
         //LOG_INFO("Mouse pick pos: (%.2f, %.2f, %.2f)", intersection.x, intersection.y, intersection.z);
     }
@@ -554,6 +1150,12 @@ void InkBox3DSimulation::ProcessInputs()
             glfwSetWindowTitle(window, MAIN_WINDOW_TITLE);
     }
 
+    {
+        lock_guard<mutex> lock(shared.Lock);
+        shared.Paused = paused;
+        dropNow = glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS;
+    }
+
     static bool orbit_mode = true;
     bool camera_changed = false;
 
@@ -653,20 +1255,6 @@ void InkBox3DSimulation::ProcessInputs()
         orbit_mode = false;
         LOG_INFO("Fly mode");
     }
-
-#if MEASURE_CS_TIMES
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
-    {
-        for (auto* shader : compute_shaders)
-        {
-            if (shader->TimingInfo().NumExecutions > 0)
-            {
-                LOG_INFO("Shader: %-12s\tAverage Time: %.3f", shader->Name.c_str(), shader->TimingInfo().AverageTime());
-            }
-        }
-        LOG_INFO("");
-    }
-#endif
 }
 
 void InkBox3DSimulation::ScrollCallback(double xoffset, double yoffset)
@@ -0,0 +1,105 @@
+#include "SimulationBackend.h"
+
+#include <chrono>
+
+#include "Common.h"
+#include "GPUProfiler.h"
+#include "InputLog.h"
+#include "TraceRecorder.h"
+
+using namespace std;
+using namespace glm;
+
+static void _RunSubsteps(ISimulationBackend& backend, ImpulseState& impulse, const FrameSteps& steps)
+{
+    float covered = min(steps.FrameTime, SCHEDULER_MAX_FRAME_TIME); // A hitch is simulated as one frame
+    float fraction = covered > 0 ? min(steps.SubstepTime / covered, 1.f) : 1.f;
+
+    TraceRecorder::Scope trace("ComputeFields");
+    backend.ComputeFields(steps.SubstepTime, fraction);
+
+    // The impulse is the whole frame's input so only the first substep applies it. A 2D drag
+    // keeps its flags up from frame to frame, they're put back after the other substeps.
+    bool force_active = impulse.ForceActive;
+    bool ink_active = impulse.InkActive;
+    impulse.ForceActive = false;
+    impulse.InkActive = false;
+
+    for (int i = 1; i < steps.Substeps; i++)
+        backend.ComputeFields(steps.SubstepTime, fraction);
+
+    impulse.ForceActive = force_active;
+    impulse.InkActive = ink_active;
+
+    backend.Stats().Substeps = steps.Substeps;
+}
+
+bool RunFrame(ISimulationBackend& backend, ImpulseState& impulse, StepScheduler& scheduler, float frame_time, InputLog* log)
+{
+    FrameSteps steps;
+    steps.FrameTime = frame_time;
+    steps.Substeps = scheduler.Plan(frame_time, backend.Stats().MaxSpeed);
+    steps.SubstepTime = scheduler.SubstepTime();
+
+    // A finished replay leaves the plan alone
+    bool logged = !log || log->Step(steps, impulse);
+
+    _RunSubsteps(backend, impulse, steps);
+    return logged;
+}
+
+HeadlessResult RunHeadless(ISimulationBackend& backend, SimulationVars& vars, ImpulseState& impulse, ivec3 size, int frames, InputLog* log, const ImpulseScript& script)
+{
+    // There's no mouse input so droplets mode supplies the impulses
+    if (!script)
+        vars.DropletsMode = true;
+
+    auto start = chrono::steady_clock::now();
+
+    int frame = 0;
+    for (; frame < frames; frame++)
+    {
+        TraceRecorder::Get().NewFrame();
+        GPUProfiler::Get().NewFrame();
+
+        if (script)
+            script(frame, impulse);
+        else if (size.z == 0)
+            impulse.TickDropletsMode(HEADLESS_TIMESTEP, size.x, size.y);
+        else
+            impulse.TickDropletsMode(size, vars.ForceMultiplier, false);
+
+        impulse.PrepareFrame(vars, HEADLESS_TIMESTEP);
+
+        // One step per frame unless a replay says otherwise
+        FrameSteps steps = { HEADLESS_TIMESTEP, 1, HEADLESS_TIMESTEP };
+        if (log && !log->Step(steps, impulse))
+            break;
+
+        _RunSubsteps(backend, impulse, steps);
+    }
+
+    frames = max(frame, 1);
+    backend.Finish();
+    TraceRecorder::Get().Stop();
+    GPUProfiler::Get().Collect(true);
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    double cells = double(size.x) * size.y * max(size.z, 1);
+
+    if (size.z == 0)
+    {
+        LOG_INFO("Headless run (%s): %d frames at %dx%d in %.3f s (%.3f ms/frame, %.2f Mcells/s)",
+            backend.BackendName(), frames, size.x, size.y, secs, secs * 1000 / frames, cells * frames / secs / 1e6);
+    }
+    else
+    {
+        LOG_INFO("Headless run (%s): %d frames at %dx%dx%d in %.3f s (%.3f ms/frame, %.2f Mcells/s)",
+            backend.BackendName(), frames, size.x, size.y, size.z, secs, secs * 1000 / frames, cells * frames / secs / 1e6);
+    }
+
+    if (GPUProfiler::Get().FramesMeasured() > 0)
+        GPUProfiler::Get().LogReport();
+
+    return { frames, secs };
+}
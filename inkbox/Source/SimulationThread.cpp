@@ -0,0 +1,180 @@
+#include "SimulationThread.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <GLFW/glfw3.h>
+
+#include "Common.h"
+#include "GPUProfiler.h"
+#include "TraceRecorder.h"
+
+using namespace std;
+
+///////////////////////////
+///    FrameMailbox     ///
+///////////////////////////
+
+FrameMailbox::FrameMailbox()
+    : writing(-1)
+    , latest(-1)
+    , reading(-1)
+{
+    for (GLsync& fence : fences)
+        fence = nullptr;
+}
+
+FrameMailbox::~FrameMailbox()
+{
+    for (GLsync fence : fences)
+    {
+        if (fence)
+            glDeleteSync(fence);
+    }
+}
+
+int FrameMailbox::BeginWrite()
+{
+    lock_guard<mutex> guard(lock);
+
+    for (int i = 0; i < PRESENT_SLOTS; i++)
+    {
+        if (i != latest && i != reading)
+        {
+            writing = i;
+            break;
+        }
+    }
+
+    // The last fence on the slot is the present thread's, wait for its reads on the GPU
+    if (fences[writing])
+        _GL_WRAP3(glWaitSync, fences[writing], 0, GL_TIMEOUT_IGNORED);
+
+    return writing;
+}
+
+void FrameMailbox::EndWrite()
+{
+    lock_guard<mutex> guard(lock);
+
+    Fence(writing);
+    latest = writing;
+    writing = -1;
+}
+
+int FrameMailbox::BeginRead()
+{
+    lock_guard<mutex> guard(lock);
+
+    if (latest >= 0 && latest != reading)
+    {
+        reading = latest;
+        _GL_WRAP3(glWaitSync, fences[reading], 0, GL_TIMEOUT_IGNORED);
+    }
+
+    return reading;
+}
+
+void FrameMailbox::EndRead()
+{
+    lock_guard<mutex> guard(lock);
+
+    if (reading >= 0)
+        Fence(reading);
+}
+
+void FrameMailbox::Fence(int slot)
+{
+    if (fences[slot])
+        glDeleteSync(fences[slot]);
+
+    // The flush makes sure the fence reaches the GPU before the other context waits on it
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _GL_WRAP0(glFlush);
+}
+
+///////////////////////////////
+///  SharedSimulationState  ///
+///////////////////////////////
+
+SharedSimulationState::SharedSimulationState()
+    : Paused(false)
+    , ClearRequested(false)
+    , ThumbnailsVisible(false)
+{
+}
+
+///////////////////////////
+///  SimulationThread   ///
+///////////////////////////
+
+SimulationThread::SimulationThread()
+    : running(false)
+    , measuredRate(0)
+{
+}
+
+SimulationThread::~SimulationThread()
+{
+    Stop();
+}
+
+void SimulationThread::Start(GLFWwindow* context, float tick_rate, const function<void(float)>& tick)
+{
+    if (IsRunning())
+        return;
+
+    this->tick = tick;
+    running = true;
+    thread = std::thread(&SimulationThread::Run, this, context, tick_rate > 0 ? tick_rate : 60.f);
+}
+
+void SimulationThread::Stop()
+{
+    if (!IsRunning())
+        return;
+
+    running = false;
+    thread.join();
+}
+
+void SimulationThread::Run(GLFWwindow* context, float tick_rate)
+{
+    using namespace std::chrono;
+
+    glfwMakeContextCurrent(context);
+
+    float tick_time = 1.f / tick_rate;
+    auto period = duration_cast<steady_clock::duration>(duration<double>(tick_time));
+    auto next = steady_clock::now();
+    auto rate_start = next;
+    int rate_ticks = 0;
+    int rate_window = max(int(tick_rate), 1); // About a second's worth of ticks
+
+    while (running)
+    {
+        TraceRecorder::Get().NewFrame();
+        GPUProfiler::Get().NewFrame();
+
+        tick(tick_time);
+
+        auto now = steady_clock::now();
+        if (++rate_ticks == rate_window)
+        {
+            measuredRate = rate_ticks / duration<float>(now - rate_start).count();
+            rate_start = now;
+            rate_ticks = 0;
+        }
+
+        next += period;
+        if (now - next > period * SIM_THREAD_MAX_BACKLOG)
+            next = now;
+        else
+            this_thread::sleep_until(next);
+    }
+
+    // The profiler's queries belong to this context, a trace still running has to finish here
+    TraceRecorder::Get().Stop();
+    _GL_WRAP0(glFinish);
+    glfwMakeContextCurrent(nullptr);
+}
@@ -0,0 +1,46 @@
+#include "StepScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "IniConfig.h"
+
+using namespace std;
+
+StepScheduler::StepScheduler()
+    : enabled(IniConfig::Get().AdaptiveTimestep)
+    , cfl(max(IniConfig::Get().CFLNumber, 0.1f))
+    , maxSubsteps(max(IniConfig::Get().MaxSubsteps, 1))
+    , budget(IniConfig::Get().SubstepBudgetMs / 1000.0)
+    , stepCost(0)
+    , substepTime(0)
+    , substeps(1)
+{
+}
+
+int StepScheduler::Plan(float frame_time, float max_speed)
+{
+    if (!enabled || frame_time <= 0)
+    {
+        substepTime = frame_time;
+        substeps = 1;
+        return substeps;
+    }
+
+    frame_time = min(frame_time, SCHEDULER_MAX_FRAME_TIME);
+
+    float limit = max_speed > 0 ? cfl / max_speed : frame_time;
+    int wanted = min(int(ceil(frame_time / limit)), maxSubsteps);
+    int affordable = stepCost > 0 ? int(budget / stepCost) : maxSubsteps;
+
+    substeps = max(min(wanted, affordable), 1);
+    substepTime = min(frame_time / substeps, limit);
+    return substeps;
+}
+
+void StepScheduler::Measure(double seconds)
+{
+    // Smooth over a few frames so one slow frame doesn't halve the next frame's substeps
+    double cost = seconds / substeps;
+    stepCost = stepCost > 0 ? 0.8 * stepCost + 0.2 * cost : cost;
+}
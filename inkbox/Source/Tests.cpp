@@ -1,6 +1,14 @@
 
 #include "Tests.h"
 #include "Utils.h"
+#include "CPUSimulation2D.h"
+#include "CPUSimulation3D.h"
+#include "Simulation2D.h"
+#include "Simulation3D.h"
+#include "FFTPoisson.h"
+#include "InputLog.h"
+#include "TraceRecorder.h"
+#include "IniConfig.h"
 
 #include <glm/mat3x3.hpp>
 #include <glm/mat4x4.hpp>
@@ -8,6 +16,9 @@
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/geometric.hpp>
 
+#include <cmath>
+#include <random>
+
 using namespace glm;
 using namespace utils;
 
@@ -22,12 +33,12 @@ void TestManager::Add(class TestRoutine* test)
 	testList.push_back(test);
 }
 
-void TestManager::RunTests()
+bool TestManager::RunTests()
 {
 	if (testList.size() == 0)
 	{
 		LOG_INFO("No tests to run");
-		return;
+		return true;
 	}
 
 	LOG_INFO("Running %d tests", (int)testList.size());
@@ -40,6 +51,7 @@ void TestManager::RunTests()
 	}
 
 	LOG_INFO("Results: %d/%d passed", passed, (int)testList.size());
+	return passed == (int)testList.size();
 }
 
 TestRoutine::TestRoutine(const char* name, Test_Func func)
@@ -121,3 +133,470 @@ DEFN_TEST(Line_Intersects_Box_Shoot_From_Left)
 	return intersects == true && i.x == -0.5 && i.y == 0.25 && i.z == 0;
 }
 
+DEFN_TEST(CPU_Backend_Splat_Adds_Ink)
+{
+	SimulationVars vars;
+	ImpulseState impulse;
+	CPUSimulation2D sim(64, 64, &vars, &impulse, 2);
+
+	impulse.CurrentPos = vec3(32, 32, 0);
+	impulse.Delta = vec3(1, 0, 0);
+	impulse.ForceActive = true;
+	impulse.InkActive = true;
+	impulse.PrepareFrame(vars, HEADLESS_TIMESTEP);
+	sim.ComputeFields(HEADLESS_TIMESTEP);
+
+	std::vector<float> ink(64 * 64 * 3);
+	sim.ReadField(SimulationField::Ink, ink.data());
+
+	float centre = ink[(32 * 64 + 32) * 3];
+	float corner = ink[(4 * 64 + 4) * 3];
+	return centre > 0.1f && corner < 1e-3f;
+}
+
+DEFN_TEST(CPU_3D_Backend_Splat_Crosses_Bricks)
+{
+	SimulationVars vars;
+	ImpulseState impulse;
+	vars.Set3DDefaults(16);
+	vars.SelfAdvect = false;
+	vars.AdvectInk = false;
+	CPUSimulation3D sim(16, 16, 16, &vars, &impulse, 2);
+
+	// Centred on a brick corner so the splat has to be the same either side of the seams
+	impulse.CurrentPos = vec3(8, 8, 8);
+	impulse.InkActive = true;
+	impulse.PrepareFrame(vars, HEADLESS_TIMESTEP);
+	sim.ComputeFields(HEADLESS_TIMESTEP);
+
+	std::vector<float> ink(16 * 16 * 16 * 4);
+	sim.ReadField(SimulationField::Ink, ink.data());
+
+	auto at = [&](int x, int y, int z) { return ink[((z * 16 + y) * 16 + x) * 4]; };
+	return at(8, 8, 8) > 0.1f && abs(at(7, 8, 8) - at(9, 8, 8)) < 1e-4f && abs(at(8, 7, 8) - at(8, 9, 8)) < 1e-4f;
+}
+
+// The GPU tests share a hidden window, made by the first one that runs
+InkBoxWindows* _TestWindows()
+{
+	static InkBoxWindows app;
+	static bool ready = app.InitHeadlessContext(16, 16);
+	return ready ? &app : nullptr;
+}
+
+DEFN_TEST(GPU_3D_Advection_Moves_Blob)
+{
+	InkBoxWindows* app = _TestWindows();
+	if (!app)
+		return false;
+
+	const int n = 16;
+	InkBox3DSimulation sim(*app, n, n, n);
+	if (!sim.CreateScene())
+		return false;
+
+	SimulationVars& vars = sim.Vars();
+	vars.SelfAdvect = false;
+	vars.DiffuseVelocity = false;
+	vars.DiffuseInk = false;
+	vars.PressureEnabled = false;
+
+	// Half a box width per second for a quarter of a second is 2 voxels of a 16 voxel box
+	std::vector<float> velocity(n * n * n * 4, 0.f), ink(n * n * n * 4, 0.f);
+	for (size_t i = 0; i < velocity.size(); i += 4)
+		velocity[i] = 0.5f;
+
+	auto at = [&](int x, int y, int z) -> float& { return ink[((z * n + y) * n + x) * 4]; };
+	at(5, 8, 8) = 1;
+
+	sim.WriteField(SimulationField::Velocity, velocity.data());
+	sim.WriteField(SimulationField::Ink, ink.data());
+	sim.ComputeFields(0.25f);
+	sim.ReadField(SimulationField::Ink, ink.data());
+
+	return at(7, 8, 8) > 0.9f && at(5, 8, 8) < 0.01f && at(6, 8, 8) < 0.01f;
+}
+
+// Pressure after the same solve with the simple kernel and with the tiled one, at the most sweeps
+// per dispatch and at a count that leaves a shorter dispatch at the end
+DEFN_TEST(GPU_3D_Tiled_Jacobi_Matches_Simple)
+{
+	InkBoxWindows* app = _TestWindows();
+	if (!app)
+		return false;
+
+	// Two tiles across and two slabs deep, so every seam gets crossed
+	const int w = 2 * JACOBI_TILE_SIDE, h = 2 * JACOBI_TILE_SIDE, d = 2 * JACOBI_SLAB_DEPTH;
+	const int cells = w * h * d;
+
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+	std::vector<float> velocity(cells * 4);
+	for (float& v : velocity)
+		v = dist(rng);
+
+	// 16 iterations are an even number of dispatches with either sweep count. After an odd number
+	// the solve adds an iteration to end up back in the pressure texture.
+	IniConfig saved = IniConfig::Get();
+	IniConfig::Get().NumJacobiIterations = 2 * JACOBI_MAX_SWEEPS;
+	IniConfig::Get().ResidualTolerance = 0;
+	IniConfig::Get().PressureWarmStart = false;
+	IniConfig::Get().FuseDivergenceJacobi = false;
+	IniConfig::Get().SparseBricks = false;
+
+	auto solve = [&](const char* kernel, int sweeps, std::vector<float>& result) -> bool
+	{
+		IniConfig::Get().JacobiKernel = kernel;
+		IniConfig::Get().JacobiSweepsPerDispatch = sweeps;
+
+		InkBox3DSimulation sim(*app, w, h, d);
+		if (!sim.CreateScene())
+			return false;
+
+		SimulationVars& vars = sim.Vars();
+		vars.SelfAdvect = false;
+		vars.DiffuseVelocity = false;
+		vars.DiffuseInk = false;
+		vars.BoundariesEnabled = false;
+		vars.PressureSolver = PressureSolverType::Jacobi;
+
+		result.resize(cells * 4);
+		sim.WriteField(SimulationField::Velocity, velocity.data());
+		sim.ComputeFields(0.1f);
+		sim.ReadField(SimulationField::Pressure, result.data());
+		return true;
+	};
+
+	std::vector<float> simple, tiled;
+	bool passed = solve("simple", 1, simple);
+	for (int sweeps : { JACOBI_MAX_SWEEPS, 3 })
+	{
+		passed = passed && solve("tiled", sweeps, tiled);
+		if (!passed)
+			break;
+
+		// The simple kernel rounds to the texture format after every iteration, the tiled one
+		// only once per dispatch. A few half float ulps (2^-10 of the value) apart.
+		float largest = 0, error = 0;
+		for (int i = 0; i < cells * 4; i += 4)
+		{
+			largest = max(largest, std::abs(simple[i]));
+			error = max(error, std::abs(tiled[i] - simple[i]));
+		}
+
+		passed = largest > 0 && error <= 4e-3f * largest;
+	}
+
+	IniConfig::Get() = saved;
+	return passed;
+}
+
+DEFN_TEST(GPU_2D_Matches_CPU_Backend)
+{
+	InkBoxWindows* app = _TestWindows();
+	if (!app)
+		return false;
+
+	const int n = 16;
+	InkBox2DSimulation gpu(*app, n, n);
+	if (!gpu.CreateScene())
+		return false;
+
+	// Jacobi so both solve the pressure the same way. The CPU backend only follows the shaders'
+	// interior stencils, the border cells are left out with the boundaries off.
+	SimulationVars& vars = gpu.Vars();
+	vars.PressureSolver = PressureSolverType::Jacobi;
+	vars.BoundariesEnabled = false;
+	SimulationVars cpu_vars = vars;
+	ImpulseState cpu_impulse;
+	CPUSimulation2D cpu(n, n, &cpu_vars, &cpu_impulse, 2);
+
+	// A splat, then a frame that advects and projects it
+	ImpulseScript script = [](int frame, ImpulseState& impulse)
+	{
+		impulse.CurrentPos = vec3(8, 8, 0);
+		impulse.Delta = vec3(2, 1, 0);
+		impulse.ForceActive = frame == 0;
+		impulse.InkActive = frame == 0;
+	};
+
+	gpu.RunHeadless(2, script);
+	RunHeadless(cpu, cpu_vars, cpu_impulse, ivec3(n, n, 0), 2, nullptr, script);
+
+	const SimulationField fields[] = { SimulationField::Velocity, SimulationField::Ink, SimulationField::Pressure };
+	std::vector<float> a(n * n * 3), b(n * n * 3);
+	for (SimulationField field : fields)
+	{
+		gpu.ReadField(field, a.data());
+		cpu.ReadField(field, b.data());
+
+		float largest = 0, error = 0;
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			largest = max(largest, std::abs(b[i]));
+			error = max(error, std::abs(a[i] - b[i]));
+		}
+
+		// The textures may be half floats
+		if (largest == 0 || error > 1e-2f * largest)
+			return false;
+	}
+
+	return true;
+}
+
+DEFN_TEST(GPU_2D_VCycle_Beats_Jacobi_Per_Fetch)
+{
+	InkBoxWindows* app = _TestWindows();
+	if (!app)
+		return false;
+
+	// Both solves start from 0 and run once, a tolerance makes them run MultigridCycles and
+	// MaxJacobiIterations respectively
+	IniConfig saved = IniConfig::Get();
+	IniConfig::Get().PressureWarmStart = false;
+	IniConfig::Get().FuseDivergenceJacobi = false;
+	IniConfig::Get().ResidualTolerance = 1e-20f;
+	IniConfig::Get().MultigridLevels = 5;
+	IniConfig::Get().MultigridSmoothingIterations = 2;
+	IniConfig::Get().MultigridCycles = 1;
+
+	// Texture fetches per cell of the V-cycle. A relaxation reads x 4 times and b once, the
+	// residual x 5 times and b once, the restriction once and the prolongation twice.
+	const int n = 64;
+	int smoothing = IniConfig::Get().MultigridSmoothingIterations;
+	double fetches = 0;
+	int side = n;
+	for (int level = 0; level < IniConfig::Get().MultigridLevels && side / 2 >= MULTIGRID_MIN_SIDE; level++)
+	{
+		fetches += double(side) * side * (2 * smoothing * 5 + 6 + 2 + (level > 0 ? 1 : 0));
+		side = (side + 1) / 2;
+	}
+	fetches += double(side) * side * (smoothing * 4 * 5 + 1);
+	int jacobi_iterations = int(std::ceil(fetches / (5.0 * n * n)));
+	IniConfig::Get().MaxJacobiIterations = jacobi_iterations;
+
+	ImpulseScript script = [](int frame, ImpulseState& impulse)
+	{
+		impulse.CurrentPos = vec3(20, 28, 0);
+		impulse.Delta = vec3(6, 3, 0);
+		impulse.ForceActive = true;
+		impulse.InkActive = false;
+	};
+
+	auto residual = [&](PressureSolverType solver)
+	{
+		InkBox2DSimulation sim(*app, n, n);
+		if (!sim.CreateScene())
+			return ResidualNorms();
+
+		sim.Vars().PressureSolver = solver;
+		sim.Vars().BoundariesEnabled = false;
+		sim.RunHeadless(1, script);
+		return sim.MeasurePressureResidual();
+	};
+
+	ResidualNorms multigrid = residual(PressureSolverType::Multigrid);
+	ResidualNorms jacobi = residual(PressureSolverType::Jacobi);
+	IniConfig::Get() = saved;
+
+	LOG_INFO("V-cycle residual %g, %d Jacobi iterations %g", multigrid.L2, jacobi_iterations, jacobi.L2);
+	return multigrid.IsValid() && jacobi.IsValid() && jacobi.L2 > 0 && multigrid.L2 < jacobi.L2;
+}
+
+DEFN_TEST(GPU_3D_Matches_CPU_Backend)
+{
+	InkBoxWindows* app = _TestWindows();
+	if (!app)
+		return false;
+
+	// The CPU backend only has the nearest cell back-trace and the simple Jacobi solve. An even
+	// number of Jacobi passes leaves the GPU pressure where it started, without an extra iteration.
+	IniConfig saved = IniConfig::Get();
+	IniConfig::Get().AdvectionScheme = "nearest";
+	IniConfig::Get().AdvectionRK2 = false;
+	IniConfig::Get().JacobiKernel = "simple";
+	IniConfig::Get().SparseBricks = false;
+	IniConfig::Get().FuseDivergenceJacobi = false;
+	IniConfig::Get().ResidualTolerance = 0;
+	IniConfig::Get().NumJacobiIterations = 20;
+
+	const int n = 16;
+	InkBox3DSimulation gpu(*app, n, n, n);
+	bool passed = gpu.CreateScene();
+	if (passed)
+	{
+		SimulationVars& vars = gpu.Vars();
+		vars.PressureSolver = PressureSolverType::Jacobi;
+		vars.BoundariesEnabled = false;
+		vars.Gravity = 0;
+		SimulationVars cpu_vars = vars;
+		ImpulseState cpu_impulse;
+		CPUSimulation3D cpu(n, n, n, &cpu_vars, &cpu_impulse, 2);
+
+		ImpulseScript script = [](int frame, ImpulseState& impulse)
+		{
+			impulse.CurrentPos = vec3(8, 8, 8);
+			impulse.Delta = vec3(0.5f, 0.25f, 0);
+			impulse.ForceActive = frame == 0;
+			impulse.InkActive = frame == 0;
+		};
+
+		gpu.RunHeadless(2, script);
+		RunHeadless(cpu, cpu_vars, cpu_impulse, ivec3(n), 2, nullptr, script);
+
+		const SimulationField fields[] = { SimulationField::Velocity, SimulationField::Ink, SimulationField::Pressure };
+		std::vector<float> a(n * n * n * 4), b(n * n * n * 4);
+		for (SimulationField field : fields)
+		{
+			gpu.ReadField(field, a.data());
+			cpu.ReadField(field, b.data());
+
+			// Pressure only has the one channel, the GPU reads its alpha back as 1
+			size_t channels = field == SimulationField::Pressure ? 1 : 4;
+			float largest = 0, error = 0;
+			for (size_t i = 0; i < a.size(); i++)
+			{
+				if (i % 4 >= channels)
+					continue;
+
+				largest = max(largest, std::abs(b[i]));
+				error = max(error, std::abs(a[i] - b[i]));
+			}
+
+			// The textures may be half floats
+			passed = passed && largest > 0 && error <= 1e-2f * largest;
+		}
+	}
+
+	IniConfig::Get() = saved;
+	return passed;
+}
+
+DEFN_TEST(FFT_Poisson_Matches_Jacobi)
+{
+	// Relax the same periodic pressure system with damped Jacobi (plain Jacobi never settles the
+	// checkerboard mode on a periodic grid) and compare, both only up to a constant
+	const ivec3 sizes[] = { ivec3(16, 16, 1), ivec3(8, 8, 8) };
+	ThreadPool pool(2);
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> dist(-1, 1);
+
+	for (ivec3 size : sizes)
+	{
+		int n = size.x * size.y * size.z;
+		float alpha = -1;
+		float beta = size.z > 1 ? 6.f : 4.f;
+
+		// The constant mode has no solution, keep it out of b
+		std::vector<float> b(n), x(n), jacobi(n, 0.f), next(n);
+		float mean_b = 0;
+		for (float& v : b)
+		{
+			v = dist(rng);
+			mean_b += v / n;
+		}
+
+		for (float& v : b)
+			v -= mean_b;
+
+		FFTPoissonSolver solver(size);
+		solver.Solve(b.data(), x.data(), alpha, beta, pool);
+
+		auto at = [&](std::vector<float>& f, int px, int py, int pz) -> float& {
+			return f[((pz + size.z) % size.z * size.y + (py + size.y) % size.y) * size.x + (px + size.x) % size.x];
+		};
+
+		for (int iter = 0; iter < 4000; iter++)
+		{
+			for (int z = 0; z < size.z; z++)
+				for (int y = 0; y < size.y; y++)
+					for (int px = 0; px < size.x; px++)
+					{
+						float sum = at(jacobi, px - 1, y, z) + at(jacobi, px + 1, y, z) + at(jacobi, px, y - 1, z) + at(jacobi, px, y + 1, z);
+						if (size.z > 1)
+							sum += at(jacobi, px, y, z - 1) + at(jacobi, px, y, z + 1);
+
+						float relaxed = (sum + alpha * at(b, px, y, z)) / beta;
+						at(next, px, y, z) = 0.2f * at(jacobi, px, y, z) + 0.8f * relaxed;
+					}
+
+			jacobi.swap(next);
+		}
+
+		float mean_x = 0, mean_j = 0;
+		for (int i = 0; i < n; i++)
+		{
+			mean_x += x[i] / n;
+			mean_j += jacobi[i] / n;
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			if (std::abs((x[i] - mean_x) - (jacobi[i] - mean_j)) > 1e-3f)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+DEFN_TEST(Input_Log_Replays_Recorded_Frames)
+{
+	const char* path = "test_input.ibxl";
+	ImpulseState recorded;
+	recorded.CurrentPos = vec3(12, 34, 0);
+	recorded.Delta = vec3(-1, 2, 0);
+	recorded.Colour = vec4(0.25f, 0.5f, 0.75f, 1);
+	recorded.ForceActive = true;
+	recorded.InkActive = true;
+
+	{
+		InputLog log(InputLogMode::Record, path, ivec3(64, 64, 0));
+		FrameSteps steps = { 0.02f, 3, 0.005f };
+		log.Step(steps, recorded);
+
+		ImpulseState idle;
+		steps = { 0.03f, 1, 0.03f };
+		log.Step(steps, idle);
+	}
+
+	InputLog log(InputLogMode::Replay, path, ivec3(64, 64, 0));
+	ImpulseState replayed;
+	FrameSteps steps0 = {}, steps1 = {}, steps2 = {};
+	bool first = log.Step(steps0, replayed);
+	bool first_ok = first && steps0.FrameTime == 0.02f && steps0.Substeps == 3 && steps0.SubstepTime == 0.005f
+		&& replayed.ForceActive && replayed.InkActive && !replayed.Radial
+		&& replayed.CurrentPos == recorded.CurrentPos && replayed.Delta == recorded.Delta && replayed.Colour == recorded.Colour;
+
+	bool second = log.Step(steps1, replayed);
+	bool second_ok = second && steps1.FrameTime == 0.03f && steps1.Substeps == 1 && !replayed.ForceActive && !replayed.InkActive;
+	bool ended = !log.Step(steps2, replayed) && steps2.Substeps == 0;
+
+	std::remove(path);
+	return first_ok && second_ok && ended;
+}
+
+DEFN_TEST(Trace_Recorder_Writes_Frame_Events)
+{
+	const char* path = "test_trace.json";
+	TraceRecorder& recorder = TraceRecorder::Get();
+	recorder.Start(path, 2);
+
+	for (int i = 0; i < 3; i++)
+	{
+		recorder.NewFrame();
+		TraceRecorder::Scope trace("TestScope");
+	}
+
+	bool stopped = !recorder.IsRecording();
+	std::string json = ReadFile(path);
+	std::remove(path);
+
+	size_t first = json.find("\"name\":\"TestScope\"");
+	size_t second = first == std::string::npos ? first : json.find("\"name\":\"TestScope\"", first + 1);
+
+	return stopped && json.find("\"Frame 0\"") != std::string::npos && json.find("\"Frame 1\"") != std::string::npos
+		&& json.find("\"Frame 2\"") == std::string::npos && second != std::string::npos
+		&& json.find("]}") != std::string::npos;
+}
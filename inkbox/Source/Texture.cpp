@@ -4,7 +4,7 @@
 #include "Common.h"
 #include "IniConfig.h"
 
-#include <exception>
+#include <stdexcept>
 
 using namespace std;
 
@@ -46,11 +46,11 @@ Texture::Texture(int width, int height, int depth, int channels)
 	}
 	else
 	{
-		throw exception("Invalid number of channels");
+		throw runtime_error("Invalid number of channels");
 	}
 
 	if (!Init(width, height, depth, format, GL_FLOAT, internalFormat))
-		throw exception("Failed to create texture");
+		throw runtime_error("Failed to create texture");
 }
 
 Texture::~Texture()
@@ -64,7 +64,7 @@ Texture::~Texture()
 Texture::Texture(int width, int height, int depth, int format, int type, int internalformat)
 {
 	if (!Init(width, height, depth, format, type, internalformat))
-		throw exception("Failed to create texture");
+		throw runtime_error("Failed to create texture");
 }
 
 bool Texture::Init(int width, int height, int depth)
@@ -88,6 +88,8 @@ bool Texture::Init(int width, int height, int depth, int format, int type, int i
 
 	_GL_WRAP3(glTexParameteri, target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	_GL_WRAP3(glTexParameteri, target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	if (depth != 0)
+		_GL_WRAP3(glTexParameteri, target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 	_GL_WRAP3(glTexParameteri, target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	_GL_WRAP3(glTexParameteri, target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
@@ -115,4 +117,27 @@ void Texture::BindToImage(int unit_idx, int access)
 {
 	bool layered = depth > 0;
 	_GL_WRAP7(glBindImageTexture, unit_idx, id, 0, layered, 0, (GLenum)access, internalFormat);
+}
+
+void Texture::Upload(const float* data, int data_format)
+{
+	_GL_WRAP2(glBindTexture, TexTarget(), id);
+
+	if (depth == 0)
+	{
+		_GL_WRAP9(glTexSubImage2D, GL_TEXTURE_2D, 0, 0, 0, width, height, data_format, GL_FLOAT, data);
+	}
+	else
+	{
+		_GL_WRAP11(glTexSubImage3D, GL_TEXTURE_3D, 0, 0, 0, 0, width, height, depth, data_format, GL_FLOAT, data);
+	}
+
+	_GL_WRAP2(glBindTexture, TexTarget(), 0);
+}
+
+void Texture::Download(float* data, int data_format)
+{
+	_GL_WRAP2(glBindTexture, TexTarget(), id);
+	_GL_WRAP5(glGetTexImage, TexTarget(), 0, data_format, GL_FLOAT, data);
+	_GL_WRAP2(glBindTexture, TexTarget(), 0);
 }
\ No newline at end of file
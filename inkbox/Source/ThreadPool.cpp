@@ -0,0 +1,194 @@
+#include "ThreadPool.h"
+
+#include "Common.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int num_threads)
+    : job(nullptr)
+    , itemJob(nullptr)
+    , jobBegin(0)
+    , jobEnd(0)
+    , generation(0)
+    , pending(0)
+    , stopping(false)
+{
+    if (num_threads <= 0)
+        num_threads = max(int(thread::hardware_concurrency()), 1);
+
+    ranges = make_unique<StealRange[]>(num_threads);
+
+    for (int i = 1; i < num_threads; i++)
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        stopping = true;
+    }
+
+    wake.notify_all();
+
+    for (thread& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::ParallelFor(int begin, int end, const function<void(int, int)>& func)
+{
+    if (end <= begin)
+        return;
+
+    if (workers.empty() || end - begin < NumThreads())
+    {
+        func(begin, end);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(mtx);
+        job = &func;
+        jobBegin = begin;
+        jobEnd = end;
+    }
+
+    Dispatch();
+}
+
+void ThreadPool::ParallelForEach(int count, const function<void(int)>& func)
+{
+    if (count <= 0)
+        return;
+
+    if (workers.empty() || count < NumThreads())
+    {
+        for (int i = 0; i < count; i++)
+            func(i);
+
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(mtx);
+        itemJob = &func;
+
+        int n = NumThreads();
+        for (int i = 0; i < n; i++)
+        {
+            ranges[i].Begin = int((long long)count * i / n);
+            ranges[i].End = int((long long)count * (i + 1) / n);
+        }
+    }
+
+    Dispatch();
+}
+
+void ThreadPool::Dispatch()
+{
+    {
+        lock_guard<mutex> lock(mtx);
+        pending = int(workers.size());
+        generation++;
+    }
+
+    wake.notify_all();
+    RunJob(0);
+
+    unique_lock<mutex> lock(mtx);
+    done.wait(lock, [this] { return pending == 0; });
+    job = nullptr;
+    itemJob = nullptr;
+}
+
+void ThreadPool::RunJob(int index)
+{
+    if (itemJob)
+        RunStealing(index);
+    else
+        RunBand(index);
+}
+
+void ThreadPool::RunBand(int index)
+{
+    int count = jobEnd - jobBegin;
+    int n = NumThreads();
+    int band_begin = jobBegin + int((long long)count * index / n);
+    int band_end = jobBegin + int((long long)count * (index + 1) / n);
+
+    if (band_end > band_begin)
+        (*job)(band_begin, band_end);
+}
+
+void ThreadPool::RunStealing(int index)
+{
+    StealRange& own = ranges[index];
+    int n = NumThreads();
+
+    while (true)
+    {
+        int item = -1;
+        {
+            lock_guard<mutex> lock(own.Lock);
+            if (own.Begin < own.End)
+                item = own.Begin++;
+        }
+
+        if (item >= 0)
+        {
+            (*itemJob)(item);
+            continue;
+        }
+
+        // Out of work, take the back half of the first non-empty range found
+        int stolen_begin = 0;
+        int stolen_end = 0;
+        for (int k = 1; k < n && stolen_end == 0; k++)
+        {
+            StealRange& victim = ranges[(index + k) % n];
+            lock_guard<mutex> lock(victim.Lock);
+
+            int remaining = victim.End - victim.Begin;
+            if (remaining > 0)
+            {
+                stolen_end = victim.End;
+                stolen_begin = victim.End - (remaining + 1) / 2;
+                victim.End = stolen_begin;
+            }
+        }
+
+        if (stolen_end == 0)
+            return;
+
+        lock_guard<mutex> lock(own.Lock);
+        own.Begin = stolen_begin;
+        own.End = stolen_end;
+    }
+}
+
+void ThreadPool::WorkerLoop(int index)
+{
+    int seen = 0;
+
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(mtx);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+
+            if (stopping)
+                return;
+
+            seen = generation;
+        }
+
+        RunJob(index);
+
+        {
+            lock_guard<mutex> lock(mtx);
+            pending--;
+        }
+
+        done.notify_one();
+    }
+}
@@ -0,0 +1,158 @@
+#include "TraceRecorder.h"
+
+#include <fstream>
+
+#include "Common.h"
+#include "GPUProfiler.h"
+
+using namespace std;
+
+thread_local TraceTrack _threadTrack = TraceTrack::CPU;
+
+// Singleton
+TraceRecorder& TraceRecorder::Get()
+{
+    static TraceRecorder recorder;
+    return recorder;
+}
+
+TraceRecorder::TraceRecorder()
+    : epoch(chrono::steady_clock::now())
+    , recording(false)
+    , framesLeft(0)
+    , frameNumber(0)
+    , frameBegin(-1)
+{
+}
+
+void TraceRecorder::Start(const string& path, int frames)
+{
+    lock_guard<mutex> control(controlLock);
+
+    if (recording || frames <= 0)
+        return;
+
+    {
+        lock_guard<mutex> guard(eventsLock);
+        this->path = path;
+        events.clear();
+        framesLeft = frames;
+        frameNumber = 0;
+        frameBegin = -1;
+    }
+
+    recording = true;
+    LOG_INFO("Tracing %d frames to %s", frames, path.c_str());
+}
+
+void TraceRecorder::Stop()
+{
+    lock_guard<mutex> control(controlLock);
+
+    if (!recording)
+        return;
+
+    {
+        lock_guard<mutex> guard(eventsLock);
+        if (frameBegin >= 0)
+            events.push_back({ "Frame " + to_string(frameNumber), frameBegin, Now() - frameBegin, TraceTrack::CPU });
+    }
+
+    recording = false;
+
+    // Only happens once per capture so a wait here is fine, the GPU ranges of the last few
+    // frames are still in flight otherwise
+    GPUProfiler::Get().Collect(true);
+
+    lock_guard<mutex> guard(eventsLock);
+    if (Write())
+        LOG_INFO("Wrote %d trace events to %s", int(events.size()), path.c_str());
+    else
+        LOG_ERROR("Failed to write trace file %s", path.c_str());
+
+    events.clear();
+}
+
+void TraceRecorder::NewFrame()
+{
+    if (!recording)
+        return;
+
+    bool finished = false;
+    {
+        lock_guard<mutex> guard(eventsLock);
+
+        double now = Now();
+        if (frameBegin >= 0)
+        {
+            events.push_back({ "Frame " + to_string(frameNumber), frameBegin, now - frameBegin, TraceTrack::CPU });
+            frameNumber++;
+            finished = --framesLeft == 0;
+        }
+
+        frameBegin = finished ? -1 : now;
+    }
+
+    if (finished)
+        Stop();
+}
+
+double TraceRecorder::Now() const
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - epoch).count();
+}
+
+void TraceRecorder::AddEvent(TraceTrack track, const string& name, double begin, double duration)
+{
+    lock_guard<mutex> guard(eventsLock);
+    events.push_back({ name, begin, duration, track });
+}
+
+void TraceRecorder::SetThreadTrack(TraceTrack track)
+{
+    _threadTrack = track;
+}
+
+bool TraceRecorder::Write()
+{
+    ofstream fout(path, ios::out);
+    if (!fout.good())
+        return false;
+
+    fout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+    fout << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << int(TraceTrack::CPU) << ",\"args\":{\"name\":\"CPU\"}}," << endl;
+    fout << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << int(TraceTrack::GPU) << ",\"args\":{\"name\":\"GPU\"}}," << endl;
+    fout << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << int(TraceTrack::Present) << ",\"args\":{\"name\":\"Present\"}}";
+
+    char line[512];
+    for (const Event& e : events)
+    {
+        // Labels are shader file names and literals, nothing that needs escaping
+        snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+            e.Name.c_str(), int(e.Track), e.Begin, e.Duration);
+        fout << line;
+    }
+
+    fout << endl << "]}" << endl;
+    return fout.good();
+}
+
+///////////////////////////
+///       Scope         ///
+///////////////////////////
+
+TraceRecorder::Scope::Scope(const char* name)
+    : name(name)
+    , begin(-1)
+{
+    if (TraceRecorder::Get().IsRecording())
+        begin = TraceRecorder::Get().Now();
+}
+
+TraceRecorder::Scope::~Scope()
+{
+    TraceRecorder& recorder = TraceRecorder::Get();
+
+    if (begin >= 0 && recorder.IsRecording())
+        recorder.AddEvent(_threadTrack, name, begin, recorder.Now() - begin);
+}